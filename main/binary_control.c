@@ -0,0 +1,234 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+
+#include "binary_control.h"
+#include "commands.h"
+
+static const char *TAG = "binary_control";
+
+/* Updated from the HTTP server and UDP tasks, only accessed atomically */
+static binary_control_metrics_t metrics = {0};
+
+static void count(uint32_t *counter, uint32_t amount) {
+  __atomic_add_fetch(counter, amount, __ATOMIC_RELAXED);
+}
+
+/* Startup effect: one sequential fill per selected zone, each handing over to the next selected zone once complete */
+static command_t *create_startup_chain(rgb_t color, uint8_t zone_mask, uint32_t step_delay_ms, uint32_t sequence) {
+  command_t *chain = NULL;
+  int chain_zone = -1;
+  for (int zone = NUM_LIGHTS - 1; zone >= 0; zone--) {
+    if (!(zone_mask & (1 << zone))) {
+      continue;
+    }
+    command_t *command = create_default_sequential_command(color, false);
+    if (command == NULL) {
+      if (chain != NULL) {
+        free_command(chain->chained_command);
+        free_command(chain);
+      }
+      return NULL;
+    }
+    command->data.step.delay_ms = step_delay_ms;
+    command->sequence = sequence;
+    if (chain != NULL) {
+      command->chained_command_queue = lights[chain_zone].command_queue;
+      command->chained_command = chain;
+    }
+    chain = command;
+    chain_zone = zone;
+  }
+  return chain;
+}
+
+static int first_zone(uint8_t zone_mask) {
+  for (int zone = 0; zone < NUM_LIGHTS; zone++) {
+    if (zone_mask & (1 << zone)) {
+      return zone;
+    }
+  }
+  return -1;
+}
+
+uint8_t binary_control_apply_message(const light_message_t *message, uint32_t *sequence) {
+  rgb_t color = {message->red, message->green, message->blue};
+  uint32_t step_delay_ms = (message->duration_ms != 0) ? message->duration_ms : DEFAULT_SEQUENTIAL_DELAY_MS;
+  uint32_t shared_sequence = (sequence != NULL) ? *sequence : 0;
+
+  /* Update current color of ambient lighting */
+  xSemaphoreTake(current_color_lock, portMAX_DELAY);
+  current_color = color;
+  xSemaphoreGive(current_color_lock);
+
+  uint8_t dropped = 0;
+  if (message->opcode == LIGHT_MESSAGE_EFFECT && message->effect == LIGHT_EFFECT_STARTUP) {
+    /* One command for the whole chain, submitted to the first zone, with NUM_LIGHTS = 2 the chain is at most one deep */
+    int zone = first_zone(message->zone_mask & ((1 << NUM_LIGHTS) - 1));
+    if (zone < 0) {
+      return 0;
+    }
+    if (shared_sequence == 0) {
+      shared_sequence = lights_reserve_sequence();
+    }
+    command_t *command = create_startup_chain(color, message->zone_mask, step_delay_ms, shared_sequence);
+    if (lights_submit_command(zone, command, NULL) != ESP_OK) {
+      dropped++;
+    }
+  } else {
+    for (int zone = 0; zone < NUM_LIGHTS; zone++) {
+      if (!(message->zone_mask & (1 << zone))) {
+        continue;
+      }
+
+      /* Colors streamed from a picker coalesce, only the newest one waiting for a light is kept */
+      command_t *command = NULL;
+      bool latest = false;
+      switch (message->opcode) {
+        case LIGHT_MESSAGE_SET_COLOR:
+          command = create_set_color_command(color);
+          latest = true;
+          break;
+        case LIGHT_MESSAGE_FADE_TO:
+          command = create_default_fade_to_command(color);
+          if (command != NULL && message->duration_ms != 0) {
+            command->data.step.delay_ms = message->duration_ms / command->data.step.num_steps;
+          }
+          latest = true;
+          break;
+        case LIGHT_MESSAGE_SEQUENTIAL:
+          command = create_default_sequential_command(color, message->flags & LIGHT_PROTOCOL_FLAG_REVERSE);
+          break;
+        case LIGHT_MESSAGE_EFFECT:
+          command = create_default_sequential_command(color, message->effect == LIGHT_EFFECT_SEQUENTIAL_REVERSE);
+          if (command != NULL) {
+            command->data.step.delay_ms = step_delay_ms;
+          }
+          break;
+      }
+      if (command != NULL) {
+        command->sequence = shared_sequence;
+      }
+      esp_err_t err = latest ? lights_submit_latest(zone, command, &shared_sequence)
+                             : lights_submit_command(zone, command, &shared_sequence);
+      if (err != ESP_OK) {
+        dropped++;
+      }
+    }
+  }
+
+  if (sequence != NULL) {
+    *sequence = shared_sequence;
+  }
+  count(&metrics.messages, 1);
+  count(&metrics.dropped_commands, dropped);
+  return dropped;
+}
+
+light_packet_status_t binary_control_apply_packet(const uint8_t *data, size_t length, uint8_t *ack,
+                                                  size_t *ack_length, uint8_t *dropped) {
+  light_packet_t packet;
+  light_packet_status_t status = light_protocol_parse_packet(data, length, &packet);
+  if (status != LIGHT_PACKET_OK) {
+    count(&metrics.invalid_packets, 1);
+    if (dropped != NULL) {
+      *dropped = 0;
+    }
+    *ack_length = light_protocol_encode_ack(status, 0, 0, 0, ack, LIGHT_PROTOCOL_ACK_LENGTH);
+    return status;
+  }
+
+  /* Already validated, so every message decodes */
+  uint32_t sequence = lights_reserve_sequence();
+  unsigned dropped_commands = 0;
+  size_t offset = 0;
+  for (int i = 0; i < packet.num_messages; i++) {
+    light_message_t message;
+    offset += light_protocol_decode(packet.messages + offset, packet.length - offset, &message);
+    dropped_commands += binary_control_apply_message(&message, &sequence);
+  }
+
+  count(&metrics.packets, 1);
+  uint8_t acked_dropped = (dropped_commands > 255) ? 255 : dropped_commands;
+  if (dropped != NULL) {
+    *dropped = acked_dropped;
+  }
+  *ack_length = light_protocol_encode_ack(status, packet.num_messages, acked_dropped, sequence, ack,
+                                          LIGHT_PROTOCOL_ACK_LENGTH);
+  return status;
+}
+
+#if CONFIG_UDP_CONTROL_ENABLE
+static void udp_control_task(void *arg) {
+  int sock = (int) (intptr_t) arg;
+
+  /* One byte more than the largest packet, so longer datagrams are rejected as trailing data instead of cut short */
+  static uint8_t packet[LIGHT_PROTOCOL_MAX_PACKET + 1];
+  uint8_t ack[LIGHT_PROTOCOL_ACK_LENGTH];
+  while (1) {
+    struct sockaddr_storage source;
+    socklen_t source_length = sizeof(source);
+    int received = recvfrom(sock, packet, sizeof(packet), 0, (struct sockaddr *) &source, &source_length);
+    if (received < 0) {
+      count(&metrics.udp_errors, 1);
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+    count(&metrics.udp_packets, 1);
+
+    size_t ack_length;
+    binary_control_apply_packet(packet, received, ack, &ack_length, NULL);
+    if (sendto(sock, ack, ack_length, 0, (struct sockaddr *) &source, source_length) < 0) {
+      count(&metrics.udp_errors, 1);
+    }
+  }
+}
+#endif
+
+esp_err_t binary_control_start_udp(void) {
+#if CONFIG_UDP_CONTROL_ENABLE
+  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock < 0) {
+    ESP_LOGE(TAG, "Failed to create UDP socket");
+    return ESP_FAIL;
+  }
+  struct sockaddr_in address = {
+    .sin_family = AF_INET,
+    .sin_port = htons(CONFIG_UDP_CONTROL_PORT),
+    .sin_addr.s_addr = htonl(INADDR_ANY),
+  };
+  if (bind(sock, (struct sockaddr *) &address, sizeof(address)) < 0) {
+    ESP_LOGE(TAG, "Failed to bind UDP port %d", CONFIG_UDP_CONTROL_PORT);
+    close(sock);
+    return ESP_FAIL;
+  }
+
+  BaseType_t task_result = xTaskCreatePinnedToCore(
+    udp_control_task,                      // Task function
+    "udp_control",                         // Name of the task
+    3072,                                  // Stack size
+    (void *) (intptr_t) sock,              // Task input parameter
+    CONFIG_HTTP_SERVER_TASK_PRIORITY,      // Task priority
+    NULL,                                  // Task handle
+    CONFIG_HTTP_SERVER_TASK_CORE           // Core to run the task on
+  );
+  if (task_result != pdPASS) {
+    ESP_LOGE(TAG, "Failed to create UDP control task");
+    close(sock);
+    return ESP_FAIL;
+  }
+  ESP_LOGI(TAG, "Listening for light control packets on UDP port %d", CONFIG_UDP_CONTROL_PORT);
+#endif
+  return ESP_OK;
+}
+
+void binary_control_get_metrics(binary_control_metrics_t *out) {
+  out->packets = __atomic_load_n(&metrics.packets, __ATOMIC_RELAXED);
+  out->invalid_packets = __atomic_load_n(&metrics.invalid_packets, __ATOMIC_RELAXED);
+  out->messages = __atomic_load_n(&metrics.messages, __ATOMIC_RELAXED);
+  out->dropped_commands = __atomic_load_n(&metrics.dropped_commands, __ATOMIC_RELAXED);
+  out->udp_packets = __atomic_load_n(&metrics.udp_packets, __ATOMIC_RELAXED);
+  out->udp_errors = __atomic_load_n(&metrics.udp_errors, __ATOMIC_RELAXED);
+}
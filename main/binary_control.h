@@ -0,0 +1,55 @@
+#ifndef BINARY_CONTROL_H
+#define BINARY_CONTROL_H
+
+#include "main_common.h"
+#include "light_protocol.h"
+
+typedef struct {
+  uint32_t packets;          /* Valid packets, from /api/bin and UDP */
+  uint32_t invalid_packets;  /* Packets rejected as a whole (see light_packet_status_t) */
+  uint32_t messages;         /* Messages applied, from packets and the WebSocket channel */
+  uint32_t dropped_commands; /* Commands refused because a light was saturated or out of memory */
+  uint32_t udp_packets;      /* Datagrams received on the UDP port, valid or not */
+  uint32_t udp_errors;       /* Failed receives and acknowledgements */
+} binary_control_metrics_t;
+
+/**
+ * @brief Turns a light control message into a command for every light in its zone mask.
+ *
+ * Safe from any task. Colors and fades take the lights' latest-wins slots so streamed colors
+ * coalesce, animations are queued. The commands are stamped with *sequence if it is not 0,
+ * otherwise *sequence is set to the one the first command got.
+ *
+ * @param message  Decoded message.
+ * @param sequence Sequence number shared by the commands (may be NULL).
+ * @return Number of commands that were dropped.
+ */
+uint8_t binary_control_apply_message(const light_message_t *message, uint32_t *sequence);
+
+/**
+ * @brief Validates a packet and, only if all of it is valid, applies its messages in order.
+ *
+ * All commands of the packet share one sequence number, acknowledged along with the number of
+ * messages accepted and commands dropped.
+ *
+ * @param data       Received packet, read in place.
+ * @param length     Length of the packet.
+ * @param ack        Buffer for the acknowledgement (at least LIGHT_PROTOCOL_ACK_LENGTH bytes).
+ * @param ack_length Set to the length of the acknowledgement.
+ * @param dropped    If not NULL, set to the number of commands dropped (as acknowledged, 0 if rejected).
+ * @return LIGHT_PACKET_OK if the packet was applied, why it was rejected otherwise.
+ */
+light_packet_status_t binary_control_apply_packet(const uint8_t *data, size_t length, uint8_t *ack,
+                                                  size_t *ack_length, uint8_t *dropped);
+
+/**
+ * @brief Starts the task receiving packets on UDP port CONFIG_UDP_CONTROL_PORT, each datagram is
+ *        one packet and is answered with its acknowledgement.
+ *
+ * @return ESP_OK on success (or if disabled in the configuration), ESP_FAIL if the task cannot be created.
+ */
+esp_err_t binary_control_start_udp(void);
+
+void binary_control_get_metrics(binary_control_metrics_t *metrics);
+
+#endif
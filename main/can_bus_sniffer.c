@@ -1,169 +1,436 @@
+#include <stdlib.h>
 #include <string.h>
 
 #include "driver/twai.h"
+#include "driver/gpio.h"
+#include "esp_intr_alloc.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
 #include "main_common.h"
 #include "commands.h"
+#include "framebuffer.h"
+#include "can_signals.h"
+#include "can_frame_handler.h"
+#include "vehicle_state.h"
+#include "can_capture.h"
+#include "flight_recorder.h"
+#include "can_filter.h"
+#include "can_bus_stats.h"
+#include "deferred_log.h"
 
-/* Drain a command queue, freeing every pending command_t (and its chained command). */
-static void flush_command_queue(QueueHandle_t queue) {
-  command_t *cmd;
-  while (xQueueReceive(queue, &cmd, 0) == pdTRUE) {
-    if (cmd->chained_command != NULL) {
-      free(cmd->chained_command);
+/* Alerts waking the sniffer task: received frames, and the bus-off recovery state machine */
+#define SNIFFER_ALERTS (TWAI_ALERT_RX_DATA | TWAI_ALERT_RX_QUEUE_FULL | TWAI_ALERT_ERR_PASS | TWAI_ALERT_BUS_OFF | \
+                        TWAI_ALERT_BUS_RECOVERED)
+
+/* Longest wait for an alert, so capture mode changes and a stopped driver are handled on a silent bus */
+#define SNIFFER_HOUSEKEEPING_MS 1000
+
+/* Nominal bitrate of t_config, the bus load refers to it */
+#define CAN_BITRATE 500000
+
+#define CAN_TX_GPIO GPIO_NUM_21
+#define CAN_RX_GPIO GPIO_NUM_22
+
+/* Longest wait for the lights to fade off before sleeping, so a busy light never keeps the chip awake */
+#define SLEEP_FADE_TIMEOUT_MS 2000
+
+/* TWAI configuration */
+static twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(CAN_TX_GPIO, CAN_RX_GPIO, TWAI_MODE_NORMAL);
+static twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS();
+static twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+
+static const char *TAG = "can_sniffer";
+
+/* Receive statistics, written by the sniffer task and copied by the HTTP server (driver counters are filled in on request) */
+static can_sniffer_metrics_t sniffer_metrics;
+static portMUX_TYPE sniffer_metrics_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Per-identifier statistics and bus load, updated by the sniffer task and copied by the HTTP server */
+static can_bus_stats_t bus_stats;
+static portMUX_TYPE bus_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Signal state and edge handling, fed with every received frame */
+static can_frame_handler_t frame_handler;
+
+/* Capture mode requested over HTTP, and the one the driver is currently installed with */
+static bool promiscuous_requested = false;
+static bool promiscuous_active = false;
+
+/* Set between a bus-off and the driver reporting the 128 x 11 recessive bit recovery sequence complete */
+static bool recovering = false;
+
+/* Whether the TWAI driver is installed, it is not after a failed reinstall */
+static bool driver_installed = false;
+
+/* esp_timer time of the last received frame, for the bus silence watchdog */
+static int64_t last_frame_us = 0;
+
+/* Send a command caused by a frame received at origin_us to a light, freeing it if the light's queue is full */
+static void send_light_command(int light_index, command_t *command, int64_t origin_us, const char *description) {
+  if (command == NULL) {
+    ESP_LOGE(TAG, "Failed to allocate %s command", description);
+    return;
+  }
+
+  command->origin_us = origin_us;
+  if (lights_submit_command(light_index, command, NULL) != ESP_OK) {
+    ESP_LOGW(TAG, "Light %d queue full, dropping %s command", light_index, description);
+  }
+}
+
+static rgb_t get_current_color(void) {
+  xSemaphoreTake(current_color_lock, portMAX_DELAY);
+  rgb_t color = current_color;
+  xSemaphoreGive(current_color_lock);
+  return color;
+}
+
+/* Turn the frame handler's light actions into commands for the light tasks */
+static void perform_light_action(can_light_action_t action, const can_frame_t *frame, int64_t origin_us, void *context) {
+  switch (action) {
+    case CAN_LIGHT_ACTION_FADE_ON: {
+      rgb_t color = get_current_color();
+      send_light_command(DASHBOARD_INDEX, create_default_fade_to_command(color), origin_us, "fade-on");
+      send_light_command(DOOR_INDEX, create_default_fade_to_command(color), origin_us, "fade-on");
+      break;
     }
-    free(cmd);
+    case CAN_LIGHT_ACTION_FADE_OFF:
+      /* Flush any queued commands so the turn-off is not delayed */
+      lights_flush_commands(DASHBOARD_INDEX);
+      lights_flush_commands(DOOR_INDEX);
+
+      send_light_command(DASHBOARD_INDEX, create_default_fade_to_command(COLOR_OFF), origin_us, "turn-off");
+      send_light_command(DOOR_INDEX, create_default_fade_to_command(COLOR_OFF), origin_us, "turn-off");
+      break;
+    case CAN_LIGHT_ACTION_STARTUP_SEQUENCE: {
+      rgb_t color = get_current_color();
+
+      /* The dashboard animation hands over to the door once it completes (only the dashboard's latency is measured) */
+      command_t* door_command = create_default_sequential_command(color, false);
+      command_t* dashboard_command = create_default_sequential_command(color, false);
+      if (dashboard_command == NULL) {
+        free_command(door_command);
+      } else {
+        dashboard_command->chained_command_queue = lights[DOOR_INDEX].command_queue;
+        dashboard_command->chained_command = door_command;
+      }
+
+      send_light_command(DASHBOARD_INDEX, dashboard_command, origin_us, "startup animation");
+      break;
+    }
+    case CAN_LIGHT_ACTION_NONE:
+      break;
+  }
+}
+
+static bool lights_off(void *context) {
+  return light_get_state(&lights[DASHBOARD_INDEX]) == LIGHT_OFF;
+}
+
+/* Capture a received frame and hand it over to the driver independent frame handler */
+static void process_frame(const twai_message_t *message, int64_t timestamp_us) {
+  can_frame_t frame = {
+    .timestamp_us = timestamp_us,
+    .identifier = message->identifier,
+    .extd = message->extd,
+    .rtr = message->rtr,
+    .dlc = message->data_length_code,
+  };
+  memcpy(frame.data, message->data, sizeof(frame.data));
+  can_capture_record(&frame);
+
+  taskENTER_CRITICAL(&bus_stats_lock);
+  can_bus_stats_record(&bus_stats, &frame);
+  taskEXIT_CRITICAL(&bus_stats_lock);
+
+  bool changed = can_frame_handler_process(&frame_handler, &frame);
+  if (changed) {
+    flight_recorder_log_frame(&frame);
+    taskENTER_CRITICAL(&sniffer_metrics_lock);
+    sniffer_metrics.frames_changed++;
+    taskEXIT_CRITICAL(&sniffer_metrics_lock);
+  }
+
+  /* Filters keep settling on unchanged data */
+  if (changed || frame_handler.filtered_changed) {
+    vehicle_state_publish(frame_handler.signal_values, frame_handler.filtered_values, timestamp_us);
   }
 }
 
-/* Attempt to recover the TWAI driver from bus-off or stopped state. */
-static void recover_twai(void) {
+/* Install and start the TWAI driver, with the synthesized filter or accepting every frame */
+static esp_err_t install_twai(bool promiscuous) {
+  twai_filter_config_t accept_all = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+  esp_err_t err = twai_driver_install(&g_config, &t_config, promiscuous ? &accept_all : &f_config);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to install driver: %s", esp_err_to_name(err));
+    return err;
+  }
+  driver_installed = true;
+
+  err = twai_start();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to start driver: %s", esp_err_to_name(err));
+    return err;
+  }
+
+  promiscuous_active = promiscuous;
+  recovering = false;
+  return ESP_OK;
+}
+
+static void uninstall_twai(void) {
+  twai_stop();
+  twai_driver_uninstall();
+  driver_installed = false;
+}
+
+/* Reinstall the driver when the capture mode changed or it is missing, which is only done from the sniffer task itself */
+static void apply_capture_mode(void) {
+  bool promiscuous = __atomic_load_n(&promiscuous_requested, __ATOMIC_RELAXED);
+  if (driver_installed && promiscuous == promiscuous_active) {
+    return;
+  }
+
+  if (driver_installed) {
+    uninstall_twai();
+  }
+  if (install_twai(promiscuous) == ESP_OK) {
+    ESP_LOGI(TAG, "Capture switched to %s mode", promiscuous ? "promiscuous" : "filtered");
+  } else {
+    /* Retry on the next iteration without spinning on the missing driver */
+    vTaskDelay(pdMS_TO_TICKS(1000));
+  }
+}
+
+void can_sniffer_set_promiscuous(bool promiscuous) {
+  __atomic_store_n(&promiscuous_requested, promiscuous, __ATOMIC_RELAXED);
+}
+
+bool can_sniffer_is_promiscuous(void) {
+  return promiscuous_active;
+}
+
+/* Drain every frame queued since the last wakeup before blocking again */
+static void drain_rx_queue(void) {
+  twai_message_t message;
+  uint32_t batch = 0;
+  while (twai_receive(&message, 0) == ESP_OK) {
+    /* Stamp each frame as soon as the driver hands it over, this is the origin of its CAN-to-LED latency */
+    process_frame(&message, esp_timer_get_time());
+    batch++;
+  }
+
+  taskENTER_CRITICAL(&sniffer_metrics_lock);
+  sniffer_metrics.frames_received += batch;
+  if (batch > sniffer_metrics.max_batch) {
+    sniffer_metrics.max_batch = batch;
+  }
+  taskEXIT_CRITICAL(&sniffer_metrics_lock);
+  if (batch > 0) {
+    last_frame_us = esp_timer_get_time();
+    deferred_log_write(DEFERRED_LOG_CAN_BATCH, last_frame_us, batch, sniffer_metrics.max_batch, 0, 0);
+  }
+}
+
+/* Close the bus load window once it elapsed, the driver's error count is only read then */
+static void tick_bus_stats(void) {
+  int64_t now_us = esp_timer_get_time();
+  if (bus_stats.window_start_us != 0 && now_us - bus_stats.window_start_us < CAN_BUS_STATS_WINDOW_US) {
+    return;
+  }
+
   twai_status_info_t status;
-  if (twai_get_status_info(&status) != ESP_OK) {
+  uint32_t bus_errors = (twai_get_status_info(&status) == ESP_OK) ? status.bus_error_count : bus_stats.bus_errors;
+  taskENTER_CRITICAL(&bus_stats_lock);
+  can_bus_stats_tick(&bus_stats, now_us, bus_errors);
+  taskEXIT_CRITICAL(&bus_stats_lock);
+}
+
+/* Advance bus-off recovery from the alerts, without ever waiting for it to complete */
+static void handle_bus_alerts(uint32_t alerts) {
+  if (alerts & TWAI_ALERT_RX_QUEUE_FULL) {
+    ESP_LOGW(TAG, "RX queue full, frames are being dropped");
+  }
+  if (alerts & TWAI_ALERT_ERR_PASS) {
+    ESP_LOGW(TAG, "TWAI error passive");
+  }
+  if (alerts & TWAI_ALERT_BUS_OFF) {
+    ESP_LOGW(TAG, "TWAI bus-off detected, initiating recovery");
+    taskENTER_CRITICAL(&sniffer_metrics_lock);
+    sniffer_metrics.bus_off_events++;
+    taskEXIT_CRITICAL(&sniffer_metrics_lock);
+    recovering = (twai_initiate_recovery() == ESP_OK);
+  }
+  if (alerts & TWAI_ALERT_BUS_RECOVERED) {
+    /* The driver is left stopped once the recovery sequence completes */
+    recovering = false;
+    esp_err_t err = twai_start();
+    if (err == ESP_OK) {
+      ESP_LOGI(TAG, "TWAI recovery complete");
+    } else {
+      ESP_LOGE(TAG, "Failed to restart driver after recovery: %s", esp_err_to_name(err));
+    }
+  }
+}
+
+/* Restart a driver found stopped outside of a recovery, e.g. after a failed restart */
+static void check_driver_state(void) {
+  twai_status_info_t status;
+  if (recovering || twai_get_status_info(&status) != ESP_OK) {
     return;
   }
 
-  if (status.state == TWAI_STATE_BUS_OFF) {
-    ESP_LOGW("can_sniffer", "TWAI bus-off detected, initiating recovery");
-    twai_initiate_recovery();
-    /* Wait for the 128 × 11 recessive-bit recovery sequence to complete */
-    vTaskDelay(pdMS_TO_TICKS(1500));
-    twai_start();
-    ESP_LOGI("can_sniffer", "TWAI recovery complete");
-  } else if (status.state == TWAI_STATE_STOPPED) {
-    ESP_LOGW("can_sniffer", "TWAI stopped unexpectedly, restarting");
+  if (status.state == TWAI_STATE_STOPPED) {
+    ESP_LOGW(TAG, "TWAI stopped unexpectedly, restarting");
     twai_start();
+  } else if (status.state == TWAI_STATE_BUS_OFF) {
+    /* A bus-off alert was missed (e.g. raised while the driver was reinstalled) */
+    handle_bus_alerts(TWAI_ALERT_BUS_OFF);
   }
 }
 
-/* TWAI configuration */
-static twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(GPIO_NUM_21, GPIO_NUM_22, TWAI_MODE_NORMAL);
-static twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS();
-static twai_filter_config_t f_config = {
-  .acceptance_code = TWAI_ACCEPTANCE_CODE,
-  .acceptance_mask = TWAI_ACCEPTANCE_MASK,
-  .single_filter = true
-};
+#if CONFIG_CAN_SLEEP_ON_SILENCE
+static bool both_lights_off(void) {
+  return light_get_state(&lights[DASHBOARD_INDEX]) == LIGHT_OFF && light_get_state(&lights[DOOR_INDEX]) == LIGHT_OFF;
+}
 
-/* Previous Data */
-static uint8_t previous_light_data[8];
-static uint8_t previous_display_data[8];
+static bool any_light_transitioning(void) {
+  for (int i = 0; i < NUM_LIGHTS; i++) {
+    if (light_get_state(&lights[i]) == LIGHT_TRANSITIONING) {
+      return true;
+    }
+  }
+  return false;
+}
 
-static const char *TAG = "can_sniffer";
+/**
+ * Capture what every lit light shows as a fade back to its own framebuffer, so gradients, pixel
+ * arrays and per-zone colors come back after sleep (NULL for lights that are off). Only called
+ * while no light is transitioning: a settled light's task no longer writes its framebuffer, and
+ * the acquire load of its state orders the read after the frame it settled on.
+ */
+static void save_lights(command_t *saved[NUM_LIGHTS]) {
+  for (int i = 0; i < NUM_LIGHTS; i++) {
+    saved[i] = NULL;
+    ambient_light_t *light = &lights[i];
+    if (light_get_state(light) == LIGHT_OFF) {
+      continue;
+    }
+
+    int num_leds = light->strip_config.max_leds;
+    rgb_t *pixels = malloc(num_leds * sizeof(rgb_t));
+    if (pixels != NULL) {
+      for (int led = 0; led < num_leds; led++) {
+        pixels[led] = framebuffer_get_pixel(light->frame, led);
+      }
+      saved[i] = create_pixels_command(COMMAND_FADE_TO, pixels, num_leds);
+      free(pixels);
+    }
+    if (saved[i] == NULL) {
+      ESP_LOGE(TAG, "Failed to save light %d, it stays off after sleep", i);
+    }
+  }
+}
+
+/**
+ * The car went to sleep: fade the lights off, stop the access point and the TWAI driver, and
+ * light sleep until the RX line turns dominant. Restores the driver and each light's frame first
+ * on wakeup, the access point only after the wake budget was measured. Postponed while a light is
+ * animating, or while the HTTP server has clients (including an OTA upload), so neither is cut off.
+ */
+static void sleep_until_bus_activity(void) {
+  if (any_light_transitioning() || http_server_is_busy()) {
+    return;
+  }
+
+  /* Commands of the watchdog are not caused by a frame, so they are not measured as CAN-to-LED latency */
+  const can_frame_t no_frame = {.timestamp_us = 0};
+  command_t *saved[NUM_LIGHTS];
+  save_lights(saved);
+
+  ESP_LOGI(TAG, "No CAN frame for %d s, sleeping until bus activity", CONFIG_CAN_SILENCE_TIMEOUT_S);
+  if (!both_lights_off()) {
+    perform_light_action(CAN_LIGHT_ACTION_FADE_OFF, &no_frame, 0, NULL);
+    for (int waited_ms = 0; !both_lights_off() && waited_ms < SLEEP_FADE_TIMEOUT_MS; waited_ms += IDLE_FRAME_PERIOD_MS) {
+      vTaskDelay(pdMS_TO_TICKS(IDLE_FRAME_PERIOD_MS));
+    }
+  }
+  flight_recorder_flush();
+  wifi_ap_suspend();
+  uninstall_twai();
+
+  /* The transceiver drives RX low for a dominant bit, the frame carrying the first one is lost */
+  gpio_set_direction(CAN_RX_GPIO, GPIO_MODE_INPUT);
+  gpio_wakeup_enable(CAN_RX_GPIO, GPIO_INTR_LOW_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+
+  int64_t sleep_us = esp_timer_get_time();
+  esp_light_sleep_start();
+  int64_t wake_us = esp_timer_get_time();
+
+  gpio_wakeup_disable(CAN_RX_GPIO);
+  esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_GPIO);
+
+  /* Restore in order of urgency: receiving frames, the lights, then the access point */
+  install_twai(promiscuous_active);
+  for (int i = 0; i < NUM_LIGHTS; i++) {
+    if (saved[i] != NULL && lights_submit_command(i, saved[i], NULL) != ESP_OK) {
+      ESP_LOGW(TAG, "Light %d queue full, not restoring it", i);
+    }
+  }
+  uint32_t restore_us = (uint32_t) (esp_timer_get_time() - wake_us);
+  wifi_ap_resume();
+
+  taskENTER_CRITICAL(&sniffer_metrics_lock);
+  sniffer_metrics.sleeps++;
+  sniffer_metrics.asleep_ms += (uint32_t) ((wake_us - sleep_us) / 1000);
+  sniffer_metrics.last_wake_restore_us = restore_us;
+  if (restore_us > sniffer_metrics.max_wake_restore_us) {
+    sniffer_metrics.max_wake_restore_us = restore_us;
+  }
+  taskEXIT_CRITICAL(&sniffer_metrics_lock);
+  if (restore_us > CONFIG_CAN_WAKE_BUDGET_MS * 1000) {
+    ESP_LOGW(TAG, "Wake restore took %" PRIu32 " us, over the %d ms budget", restore_us, CONFIG_CAN_WAKE_BUDGET_MS);
+  }
+  ESP_LOGI(TAG, "Woke after %" PRId64 " s, restored in %" PRIu32 " us", (wake_us - sleep_us) / 1000000, restore_us);
+
+  /* Give the bus a full timeout to show activity before sleeping again */
+  last_frame_us = wake_us;
+}
+#endif
 
 /* CAN sniffer FreeRTOS task function */
 void can_sniffer_task() {
   while (1) {
-    /* Wait for the message to be received */
-    twai_message_t message;
-    esp_err_t receive_status = twai_receive(&message, pdMS_TO_TICKS(1000));
-    if (receive_status == ESP_ERR_TIMEOUT) {
-      continue;
-    } else if (receive_status != ESP_OK) {
-      ESP_LOGE(TAG, "Error receiving message: %s", esp_err_to_name(receive_status));
-      recover_twai();
-      continue;
-    }
+    apply_capture_mode();
 
-    ESP_LOGV(TAG, "Received CAN message with identifier: 0x%" PRIx32, message.identifier);
-
-    /* Process CAN bus messages */
-    if (message.identifier == LIGHTS_CAN_ID) {
-      if (memcmp(message.data, previous_light_data, message.data_length_code) != 0) {
-        ESP_LOGD(TAG, "New lights CAN message received");
-
-        /**
-         * There are two different cases for turning on the ambient lights:
-         * 1) Display is off, meaning that this lights should wait until display goes into the standard UI (refer to display CAN section)
-         * 2) Display is on, meaning that this is an ambient light only event, leading to a fade animation
-         */
-        if (message.data[AMBIENT_LIGHT_BYTE_INDEX] && (previous_light_data[AMBIENT_LIGHT_BYTE_INDEX] == 0)) {
-          if (previous_display_data[DISPLAY_STATUS_BYTE_INDEX] & DISPLAY_STANDARD_UI_MASK) {
-            ESP_LOGI(TAG, "Ambient lighting has turned on");
-
-            xSemaphoreTake(current_color_lock, portMAX_DELAY);
-            command_t* door_command = create_default_fade_to_command(current_color);
-            command_t* dashboard_command = create_default_fade_to_command(current_color);
-            xSemaphoreGive(current_color_lock);
-
-            if (xQueueSend(lights[DASHBOARD_INDEX].command_queue, &dashboard_command, 0) != pdTRUE) {
-              ESP_LOGW(TAG, "Dashboard queue full, dropping fade-on command");
-              free(dashboard_command);
-            }
-            if (xQueueSend(lights[DOOR_INDEX].command_queue, &door_command, 0) != pdTRUE) {
-              ESP_LOGW(TAG, "Door queue full, dropping fade-on command");
-              free(door_command);
-            }
-          }
-        }
-
-        /* If ambient lighting has turned off, flush stale commands and turn off lights */
-        if ((message.data[AMBIENT_LIGHT_BYTE_INDEX] == 0) && previous_light_data[AMBIENT_LIGHT_BYTE_INDEX]) {
-          ESP_LOGI(TAG, "Ambient lighting has turned off");
-
-          /* Flush any queued commands so the turn-off is not delayed */
-          flush_command_queue(lights[DASHBOARD_INDEX].command_queue);
-          flush_command_queue(lights[DOOR_INDEX].command_queue);
-
-          command_t* door_command = create_default_fade_to_command(COLOR_OFF);
-          command_t* dashboard_command = create_default_fade_to_command(COLOR_OFF);
-
-          if (xQueueSend(lights[DASHBOARD_INDEX].command_queue, &dashboard_command, 0) != pdTRUE) {
-            ESP_LOGE(TAG, "Failed to send turn-off command to dashboard queue");
-            free(dashboard_command);
-          }
-          if (xQueueSend(lights[DOOR_INDEX].command_queue, &door_command, 0) != pdTRUE) {
-            ESP_LOGE(TAG, "Failed to send turn-off command to door queue");
-            free(door_command);
-          }
-        }
-
-        char data_str[3 * TWAI_FRAME_MAX_DLC] = {0};
-        int offset = 0;
-        for (int i = 0; i < message.data_length_code; ++i) {
-            offset += snprintf(data_str + offset, sizeof(data_str) - offset, "%02X ", message.data[i]);
-        }
-        ESP_LOGD(TAG, "Lights CAN message data: %s", data_str);
-
-        memcpy(previous_light_data, message.data, message.data_length_code);
+    /* Sleep until the driver raises an alert, received frames wake the task immediately */
+    uint32_t alerts = 0;
+    esp_err_t err = twai_read_alerts(&alerts, pdMS_TO_TICKS(SNIFFER_HOUSEKEEPING_MS));
+    if (err == ESP_ERR_TIMEOUT) {
+      check_driver_state();
+      tick_bus_stats();
+#if CONFIG_CAN_SLEEP_ON_SILENCE
+      if (esp_timer_get_time() - last_frame_us > CONFIG_CAN_SILENCE_TIMEOUT_S * 1000000LL) {
+        sleep_until_bus_activity();
       }
+#endif
+      continue;
+    } else if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Error reading alerts: %s", esp_err_to_name(err));
+      vTaskDelay(pdMS_TO_TICKS(SNIFFER_HOUSEKEEPING_MS));
+      continue;
     }
 
-    if (message.identifier == DISPLAY_CAN_ID) {
-      if (memcmp(message.data, previous_display_data, message.data_length_code) != 0) {
-        ESP_LOGD(TAG, "New display CAN message received");
-
-        if ((message.data[DISPLAY_STATUS_BYTE_INDEX] & DISPLAY_STANDARD_UI_MASK) && !(previous_display_data[DISPLAY_STATUS_BYTE_INDEX] & DISPLAY_STANDARD_UI_MASK)) {
-          ESP_LOGI(TAG, "Display swapped to normal UI");
-
-          /* If lights are already on, then skip */
-          if (lights[0].state == LIGHT_OFF) {
-            command_t* door_command = create_default_sequential_command(current_color, false);
-            command_t* dashboard_command = create_default_sequential_command(current_color, false);
-
-            dashboard_command->chained_command_queue = lights[DOOR_INDEX].command_queue;
-            dashboard_command->chained_command = door_command;
-
-            if (xQueueSend(lights[DASHBOARD_INDEX].command_queue, &dashboard_command, 0) != pdTRUE) {
-              ESP_LOGW(TAG, "Dashboard queue full, dropping startup animation command");
-              free(door_command);
-              free(dashboard_command);
-            }
-          }
-        }
-
-        char data_str[3 * TWAI_FRAME_MAX_DLC] = {0};
-        int offset = 0;
-        for (int i = 0; i < message.data_length_code; ++i) {
-            offset += snprintf(data_str + offset, sizeof(data_str) - offset, "%02X ", message.data[i]);
-        }
-        ESP_LOGD(TAG, "Display CAN message data: %s", data_str);
-
-        memcpy(previous_display_data, message.data, message.data_length_code);
-      }
+    /* Frames received before a bus-off are still processed, the recovery runs in the controller meanwhile */
+    if (alerts & (TWAI_ALERT_RX_DATA | TWAI_ALERT_RX_QUEUE_FULL)) {
+      drain_rx_queue();
     }
+    handle_bus_alerts(alerts);
+    tick_bus_stats();
   }
 
   /* Delete the task if it exits the loop */
@@ -172,20 +439,68 @@ void can_sniffer_task() {
   return;
 }
 
-esp_err_t start_can_sniffer_task() {
-  /* Install TWAI driver */
-  if (twai_driver_install(&g_config, &t_config, &f_config) == ESP_OK) {
-    ESP_LOGI(TAG, "TWAI Driver installed");
-  } else {
-    ESP_LOGE(TAG, "Failed to install driver");
-    return -1;
+void can_sniffer_get_metrics(can_sniffer_metrics_t *metrics) {
+  taskENTER_CRITICAL(&sniffer_metrics_lock);
+  *metrics = sniffer_metrics;
+  taskEXIT_CRITICAL(&sniffer_metrics_lock);
+
+  twai_status_info_t status;
+  if (twai_get_status_info(&status) == ESP_OK) {
+    metrics->state = status.state;
+    metrics->rx_pending = status.msgs_to_rx;
+    metrics->rx_missed = status.rx_missed_count;
+    metrics->rx_overrun = status.rx_overrun_count;
+    metrics->arb_lost = status.arb_lost_count;
+    metrics->bus_errors = status.bus_error_count;
+    metrics->tx_error_counter = status.tx_error_counter;
+    metrics->rx_error_counter = status.rx_error_counter;
   }
+}
+
+void can_sniffer_get_bus_stats(can_bus_stats_t *stats) {
+  taskENTER_CRITICAL(&bus_stats_lock);
+  *stats = bus_stats;
+  taskEXIT_CRITICAL(&bus_stats_lock);
+}
+
+esp_err_t start_can_sniffer_task() {
+  /* Build the signal lookup table and decoders */
+  can_signals_init();
+  can_bus_stats_init(&bus_stats, CAN_BITRATE);
+
+  /* Route the light actions of decoded signal edges to the light tasks */
+  const can_light_actions_t actions = {
+    .perform = perform_light_action,
+    .lights_off = lights_off,
+    .context = NULL,
+  };
+  can_frame_handler_init(&frame_handler, &actions);
+
+  /* Derive the hardware acceptance filter from the identifiers in the signal database */
+  uint32_t watched_ids[CAN_SIGNAL_COUNT];
+  size_t num_watched = can_signals_watched_ids(watched_ids, CAN_SIGNAL_COUNT);
+  can_filter_config_t filter;
+  can_filter_synthesize(watched_ids, num_watched, &filter);
+  f_config.acceptance_code = filter.acceptance_code;
+  f_config.acceptance_mask = filter.acceptance_mask;
+  f_config.single_filter = filter.single_filter;
+  ESP_LOGI(TAG, "TWAI %s filter code 0x%08" PRIx32 " mask 0x%08" PRIx32 " accepts %" PRIu32 " IDs for %u watched",
+           filter.single_filter ? "single" : "dual", filter.acceptance_code, filter.acceptance_mask,
+           can_filter_accepted_id_count(&filter), (unsigned) num_watched);
+
+  /* Size the RX queue for bursts of back-to-back frames, and wake the task through alerts */
+  g_config.rx_queue_len = CONFIG_CAN_RX_QUEUE_LEN;
+  g_config.alerts_enabled = SNIFFER_ALERTS;
+#if CONFIG_TWAI_ISR_IN_IRAM
+  /* Keep the ISR moving frames from the 64 byte hardware FIFO to the queue while flight log erases disable the cache */
+  g_config.intr_flags |= ESP_INTR_FLAG_IRAM;
+#endif
 
-  // Start TWAI driver
-  if (twai_start() == ESP_OK) {
+  /* Install and start TWAI driver, the silence watchdog starts counting now */
+  last_frame_us = esp_timer_get_time();
+  if (install_twai(false) == ESP_OK) {
     ESP_LOGI(TAG, "TWAI Driver started");
   } else {
-    ESP_LOGE(TAG, "Failed to start driver");
     return -1;
   }
 
@@ -0,0 +1,125 @@
+#include <string.h>
+
+#include "can_bus_stats.h"
+
+/* Moving averages weigh each new interval with 1/8 */
+#define AVERAGE_SHIFT 3
+
+/* Error flag, echoed flags, delimiter and interframe space of an error frame */
+#define ERROR_FRAME_BITS 20
+
+/* Longest interval tracked, so that it still fits into 32 bits in Q4 */
+#define MAX_INTERVAL_US (UINT32_MAX >> CAN_BUS_STATS_Q)
+
+static inline uint32_t slot_of(uint32_t key) {
+  /* Fibonacci hashing, the top bits of the product index the table */
+  return (key * 2654435761u) >> (32 - __builtin_ctz(CAN_BUS_STATS_MAX_IDS));
+}
+
+/* Entry of the identifier, claimed if it is new, NULL when the table is full */
+static can_id_stats_t *find_entry(can_bus_stats_t *stats, const can_frame_t *frame) {
+  uint32_t slot = slot_of(frame->identifier | ((uint32_t) frame->extd << 31));
+  for (uint32_t probe = 0; probe < CAN_BUS_STATS_MAX_IDS; probe++) {
+    can_id_stats_t *entry = &stats->ids[(slot + probe) & (CAN_BUS_STATS_MAX_IDS - 1)];
+    if (!entry->used) {
+      entry->used = true;
+      entry->identifier = frame->identifier;
+      entry->extd = frame->extd;
+      stats->tracked_ids++;
+      return entry;
+    }
+    if (entry->identifier == frame->identifier && entry->extd == frame->extd) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+void can_bus_stats_init(can_bus_stats_t *stats, uint32_t bitrate) {
+  memset(stats, 0, sizeof(*stats));
+  stats->bitrate = bitrate;
+}
+
+uint32_t can_bus_stats_frame_bits(const can_frame_t *frame) {
+  uint32_t data_bits = frame->rtr ? 0 : 8 * ((frame->dlc < CAN_FRAME_MAX_DLC) ? frame->dlc : CAN_FRAME_MAX_DLC);
+
+  /* Bits from the start of frame to the end of the CRC are subject to stuffing, the rest is fixed form */
+  uint32_t stuffed_bits = (frame->extd ? 54 : 34) + data_bits;
+  uint32_t fixed_bits = 10 + 3; /* CRC delimiter, ACK, end of frame, interframe space */
+
+  /* Worst case is a stuff bit every 4 bits after the first, count half of that on average */
+  return stuffed_bits + fixed_bits + (stuffed_bits - 1) / 8;
+}
+
+void can_bus_stats_record(can_bus_stats_t *stats, const can_frame_t *frame) {
+  stats->window_bits += can_bus_stats_frame_bits(frame);
+  stats->window_frames++;
+
+  can_id_stats_t *entry = find_entry(stats, frame);
+  if (entry == NULL) {
+    stats->untracked_frames++;
+    return;
+  }
+
+  if (entry->frames > 0) {
+    int64_t interval_us = frame->timestamp_us - entry->last_us;
+    if (interval_us < 0) {
+      interval_us = 0;
+    } else if (interval_us > MAX_INTERVAL_US) {
+      interval_us = MAX_INTERVAL_US;
+    }
+
+    int64_t interval_q = interval_us << CAN_BUS_STATS_Q;
+    if (entry->frames == 1) {
+      entry->interval_q = (uint32_t) interval_q;
+    } else {
+      int64_t deviation_q = interval_q - entry->interval_q;
+      if (deviation_q < 0) {
+        deviation_q = -deviation_q;
+      }
+      entry->interval_q += (interval_q - entry->interval_q) / (1 << AVERAGE_SHIFT);
+      entry->jitter_q += (deviation_q - entry->jitter_q) / (1 << AVERAGE_SHIFT);
+    }
+  }
+  entry->frames++;
+  entry->last_us = frame->timestamp_us;
+}
+
+void can_bus_stats_tick(can_bus_stats_t *stats, int64_t now_us, uint32_t bus_errors) {
+  if (stats->window_start_us == 0) {
+    stats->window_start_us = now_us;
+    stats->bus_errors = bus_errors;
+    return;
+  }
+
+  int64_t elapsed_us = now_us - stats->window_start_us;
+  if (elapsed_us < CAN_BUS_STATS_WINDOW_US) {
+    return;
+  }
+
+  /* The driver's count restarts when it is reinstalled */
+  uint32_t errors = (bus_errors >= stats->bus_errors) ? bus_errors - stats->bus_errors : bus_errors;
+  uint64_t bits = stats->window_bits + (uint64_t) errors * ERROR_FRAME_BITS;
+  uint64_t capacity = (uint64_t) stats->bitrate * elapsed_us;
+  uint64_t load = (capacity > 0) ? (bits * 1000 * 1000000) / capacity : 0;
+
+  stats->load_permille = (load < 1000) ? (uint16_t) load : 1000;
+  if (stats->load_permille > stats->peak_load_permille) {
+    stats->peak_load_permille = stats->load_permille;
+  }
+  stats->frames_per_s = (uint32_t) (((uint64_t) stats->window_frames * 1000000) / elapsed_us);
+  stats->errors_per_s = (uint32_t) (((uint64_t) errors * 1000000) / elapsed_us);
+
+  stats->window_start_us = now_us;
+  stats->window_bits = 0;
+  stats->window_frames = 0;
+  stats->bus_errors = bus_errors;
+}
+
+uint32_t can_bus_stats_rate_mhz(const can_id_stats_t *entry) {
+  if (entry->frames < 2 || entry->interval_q == 0) {
+    return 0;
+  }
+  uint64_t rate_mhz = (1000000000ull << CAN_BUS_STATS_Q) / entry->interval_q;
+  return (rate_mhz < UINT32_MAX) ? (uint32_t) rate_mhz : UINT32_MAX;
+}
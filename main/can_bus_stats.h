@@ -0,0 +1,87 @@
+#ifndef CAN_BUS_STATS_H
+#define CAN_BUS_STATS_H
+
+/**
+ * Rolling per-identifier statistics of the received CAN traffic (frame rate, last-seen age and
+ * inter-arrival jitter) and an estimate of the bus load. Updating is constant time with no
+ * allocation: identifiers live in a fixed open addressing table and averages are fixed-point
+ * moving averages. Only depends on the C standard library, so the replay tool uses it as well.
+ *
+ * The load only counts frames passing the acceptance filter, plus an allowance for error frames,
+ * so it is a lower bound of the real bus load unless capture runs in promiscuous mode.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "can_frame_handler.h"
+
+/* Identifiers tracked at most (a power of two), frames of further identifiers are only counted */
+#define CAN_BUS_STATS_MAX_IDS 64
+
+/* Length of the window the bus load and total frame rate are measured over */
+#define CAN_BUS_STATS_WINDOW_US 1000000
+
+/* Fractional bits of the averaged intervals */
+#define CAN_BUS_STATS_Q 4
+
+typedef struct {
+  uint32_t identifier;
+  bool used;
+  bool extd;
+  uint32_t frames;      /* Frames received with this identifier */
+  int64_t last_us;      /* Reception time of the latest frame */
+  uint32_t interval_q;  /* Moving average of the inter-arrival time, us in Q4 */
+  uint32_t jitter_q;    /* Moving average of the deviation of the inter-arrival time from its average, us in Q4 */
+} can_id_stats_t;
+
+typedef struct {
+  can_id_stats_t ids[CAN_BUS_STATS_MAX_IDS];
+  uint32_t tracked_ids;      /* Identifiers in the table */
+  uint32_t untracked_frames; /* Frames of identifiers that did not fit into the table */
+  uint32_t bitrate;          /* Nominal bus bitrate the load refers to */
+  /* Window being measured */
+  int64_t window_start_us;
+  uint32_t window_bits;
+  uint32_t window_frames;
+  uint32_t bus_errors;       /* Driver bus error count at the last tick */
+  /* Last completed window */
+  uint32_t frames_per_s;
+  uint32_t errors_per_s;
+  uint16_t load_permille;
+  uint16_t peak_load_permille;
+} can_bus_stats_t;
+
+/**
+ * @brief Clears the statistics.
+ *
+ * @param stats   Statistics to initialize.
+ * @param bitrate Nominal bitrate of the bus, in bit/s.
+ */
+void can_bus_stats_init(can_bus_stats_t *stats, uint32_t bitrate);
+
+/**
+ * @brief Accounts a received frame, called for every frame taken from the receive queue.
+ */
+void can_bus_stats_record(can_bus_stats_t *stats, const can_frame_t *frame);
+
+/**
+ * @brief Closes the load window once it has elapsed, called after every burst of frames and
+ *        periodically while the bus is silent.
+ *
+ * @param now_us     Current time, in the time base of the frame timestamps.
+ * @param bus_errors Running bus error count of the driver, each error counts as an error frame.
+ */
+void can_bus_stats_tick(can_bus_stats_t *stats, int64_t now_us, uint32_t bus_errors);
+
+/**
+ * @brief Estimated number of bits a frame occupies on the bus, including interframe space and
+ *        an average allowance for stuff bits.
+ */
+uint32_t can_bus_stats_frame_bits(const can_frame_t *frame);
+
+/**
+ * @brief Average frame rate of an identifier in mHz, 0 until two frames were received.
+ */
+uint32_t can_bus_stats_rate_mhz(const can_id_stats_t *entry);
+
+#endif
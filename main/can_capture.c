@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "can_capture.h"
+
+#define RECORD_WORDS (sizeof(can_capture_record_t) / sizeof(uint32_t))
+
+/* Word view of a record, so it can be copied with word-sized atomic accesses */
+typedef union {
+  can_capture_record_t record;
+  uint32_t words[RECORD_WORDS];
+} record_words_t;
+
+static record_words_t ring[CAN_CAPTURE_RECORDS];
+
+/* Sequence number of the next record to write, the ring holds the CAN_CAPTURE_RECORDS before it */
+static uint32_t head = 0;
+
+void can_capture_record(const can_frame_t *frame) {
+  record_words_t entry = {0};
+  entry.record.timestamp_low = (uint32_t) frame->timestamp_us;
+  entry.record.timestamp_high = (uint16_t) (frame->timestamp_us >> 32);
+  entry.record.dlc = frame->dlc;
+  entry.record.flags = (frame->extd ? CAN_CAPTURE_FLAG_EXTD : 0) | (frame->rtr ? CAN_CAPTURE_FLAG_RTR : 0);
+  entry.record.identifier = frame->identifier;
+  memcpy(entry.record.data, frame->data, CAN_FRAME_MAX_DLC);
+
+  /* The previous head store must be visible before this slot is overwritten (readers check it afterwards) */
+  uint32_t sequence = __atomic_load_n(&head, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  record_words_t *slot = &ring[sequence & (CAN_CAPTURE_RECORDS - 1)];
+  for (size_t i = 0; i < RECORD_WORDS; i++) {
+    __atomic_store_n(&slot->words[i], entry.words[i], __ATOMIC_RELAXED);
+  }
+
+  __atomic_store_n(&head, sequence + 1, __ATOMIC_RELEASE);
+}
+
+void can_capture_cursor_init(can_capture_cursor_t *cursor) {
+  uint32_t written = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+  cursor->next = (written > CAN_CAPTURE_RECORDS) ? written - CAN_CAPTURE_RECORDS : 0;
+  cursor->dropped = 0;
+}
+
+size_t can_capture_read(can_capture_cursor_t *cursor, can_capture_record_t *records, size_t max_records) {
+  size_t copied = 0;
+  while (copied < max_records) {
+    uint32_t written = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    if (cursor->next == written) {
+      break;
+    }
+
+    /* Skip records that were overwritten since the cursor last moved */
+    if (written - cursor->next > CAN_CAPTURE_RECORDS) {
+      cursor->dropped += written - cursor->next - CAN_CAPTURE_RECORDS;
+      cursor->next = written - CAN_CAPTURE_RECORDS;
+    }
+
+    record_words_t copy;
+    const record_words_t *slot = &ring[cursor->next & (CAN_CAPTURE_RECORDS - 1)];
+    for (size_t i = 0; i < RECORD_WORDS; i++) {
+      copy.words[i] = __atomic_load_n(&slot->words[i], __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    /* The writer may have started reusing the slot while it was copied, in which case the copy is discarded */
+    written = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    if (written - cursor->next >= CAN_CAPTURE_RECORDS) {
+      cursor->dropped++;
+      cursor->next++;
+      continue;
+    }
+
+    records[copied++] = copy.record;
+    cursor->next++;
+  }
+  return copied;
+}
+
+size_t can_capture_format_candump(const can_capture_record_t *record, char *buffer, size_t size) {
+  uint64_t timestamp_us = ((uint64_t) record->timestamp_high << 32) | record->timestamp_low;
+  bool extd = record->flags & CAN_CAPTURE_FLAG_EXTD;
+
+  int length = snprintf(buffer, size, "(%llu.%06llu) can0 %0*lX#",
+                        (unsigned long long) (timestamp_us / 1000000), (unsigned long long) (timestamp_us % 1000000),
+                        extd ? 8 : 3, (unsigned long) record->identifier);
+  if (length < 0 || (size_t) length >= size) {
+    return 0;
+  }
+
+  if (record->flags & CAN_CAPTURE_FLAG_RTR) {
+    length += snprintf(buffer + length, size - length, "R\n");
+  } else {
+    uint8_t dlc = (record->dlc < CAN_FRAME_MAX_DLC) ? record->dlc : CAN_FRAME_MAX_DLC;
+    for (int i = 0; i < dlc && (size_t) length < size; i++) {
+      length += snprintf(buffer + length, size - length, "%02X", record->data[i]);
+    }
+    if ((size_t) length < size) {
+      length += snprintf(buffer + length, size - length, "\n");
+    }
+  }
+  return ((size_t) length < size) ? (size_t) length : 0;
+}
+
+uint32_t can_capture_total(void) {
+  return __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+}
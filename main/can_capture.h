@@ -0,0 +1,86 @@
+#ifndef CAN_CAPTURE_H
+#define CAN_CAPTURE_H
+
+/**
+ * RAM ring buffer of raw received CAN frames. The CAN task appends every frame it receives, any
+ * other task can stream the ring out concurrently through a cursor: recording never waits for
+ * readers, readers that fall behind by more than the ring's capacity skip the overwritten records.
+ * Only depends on the C standard library and GCC atomic builtins.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "can_frame_handler.h"
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+#ifndef CONFIG_CAN_CAPTURE_RECORDS_LOG2
+#define CONFIG_CAN_CAPTURE_RECORDS_LOG2 10
+#endif
+#define CAN_CAPTURE_RECORDS (1u << CONFIG_CAN_CAPTURE_RECORDS_LOG2)
+
+#define CAN_CAPTURE_FLAG_EXTD 0x01
+#define CAN_CAPTURE_FLAG_RTR  0x02
+
+/* Binary record, little endian, as stored in the ring and in binary downloads */
+typedef struct {
+  uint32_t timestamp_low;  /* Reception time (us), bits 0-31 */
+  uint16_t timestamp_high; /* Reception time (us), bits 32-47 */
+  uint8_t dlc;
+  uint8_t flags;           /* CAN_CAPTURE_FLAG_* */
+  uint32_t identifier;
+  uint8_t data[CAN_FRAME_MAX_DLC];
+} can_capture_record_t;
+
+_Static_assert(sizeof(can_capture_record_t) == 20, "CAN capture records must stay 20 bytes");
+
+/* Header of a binary download, followed by the records */
+#define CAN_CAPTURE_MAGIC 0x43504143 /* "CAPC" */
+#define CAN_CAPTURE_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t record_size;
+} can_capture_header_t;
+
+/* Read position of a reader */
+typedef struct {
+  uint32_t next;    /* Sequence number of the next record to read */
+  uint32_t dropped; /* Records overwritten before this reader got to them */
+} can_capture_cursor_t;
+
+/**
+ * @brief Appends a frame to the ring, overwriting the oldest record once full.
+ *
+ * Must only be called from a single task (the CAN task).
+ */
+void can_capture_record(const can_frame_t *frame);
+
+/**
+ * @brief Positions a cursor at the oldest record still in the ring.
+ */
+void can_capture_cursor_init(can_capture_cursor_t *cursor);
+
+/**
+ * @brief Copies up to max_records records from the cursor position and advances the cursor.
+ *
+ * @return Number of records copied, 0 once the reader has caught up with the writer.
+ */
+size_t can_capture_read(can_capture_cursor_t *cursor, can_capture_record_t *records, size_t max_records);
+
+/**
+ * @brief Formats a record as a `candump -l` line ("(seconds.micros) can0 ID#DATA\n").
+ *
+ * @return Length of the line (without the terminator), or 0 if the buffer is too small.
+ */
+size_t can_capture_format_candump(const can_capture_record_t *record, char *buffer, size_t size);
+
+/**
+ * @brief Returns the total number of frames recorded since boot.
+ */
+uint32_t can_capture_total(void);
+
+#endif
@@ -0,0 +1,191 @@
+#include <string.h>
+
+#include "can_filter.h"
+
+#define STANDARD_ID_BITS 11
+#define STANDARD_ID_MASK 0x7FFu
+
+/* Single filter layout: ID [31:21], RTR [20], data bytes 1 and 2 [19:0] */
+#define SINGLE_ID_SHIFT 21
+#define SINGLE_DONT_CARE_DATA 0x000FFFFFu
+
+/* Dual filter layout: filter 1 ID [31:21], RTR [20], data byte 1 [19:16] and [3:0]
+ *                     filter 2 ID [15:5],  RTR [4] */
+#define DUAL_ID1_SHIFT 21
+#define DUAL_ID2_SHIFT 5
+#define DUAL_DONT_CARE_DATA 0x000F000Fu
+
+#define CAN_STANDARD_IDS 2048
+#define MAX_IDS CAN_STANDARD_IDS
+
+/* A group of identifiers covered by one code/mask pair over the 11-bit ID */
+typedef struct {
+  uint32_t code;
+  uint32_t mask; /* 1 = don't care */
+} id_cover_t;
+
+static inline uint32_t cover_size(const id_cover_t *cover) {
+  return 1u << __builtin_popcount(cover->mask);
+}
+
+static inline id_cover_t cover_merge(const id_cover_t *a, const id_cover_t *b) {
+  uint32_t mask = a->mask | b->mask | (a->code ^ b->code);
+  return (id_cover_t) {a->code & ~mask, mask};
+}
+
+/* Number of identifiers accepted by either of two covers */
+static uint32_t union_size(const id_cover_t *a, const id_cover_t *b) {
+  uint32_t both = 0;
+  if (((a->code ^ b->code) & ~a->mask & ~b->mask) == 0) {
+    both = 1u << __builtin_popcount(a->mask & b->mask);
+  }
+  return cover_size(a) + cover_size(b) - both;
+}
+
+static id_cover_t cover_of(const uint32_t *ids, size_t count) {
+  id_cover_t cover = {ids[0] & STANDARD_ID_MASK, 0};
+  for (size_t i = 1; i < count; i++) {
+    id_cover_t single = {ids[i] & STANDARD_ID_MASK, 0};
+    cover = cover_merge(&cover, &single);
+  }
+  return cover;
+}
+
+/* Try every split of the IDs into two groups (the first ID always goes into group A) */
+static uint32_t best_split_exhaustive(const uint32_t *ids, size_t count, id_cover_t *best_a, id_cover_t *best_b) {
+  uint32_t best = UINT32_MAX;
+  for (uint32_t assignment = 0; assignment < (1u << (count - 1)); assignment++) {
+    id_cover_t a = {ids[0] & STANDARD_ID_MASK, 0};
+    id_cover_t b = {0, 0};
+    bool b_used = false;
+    for (size_t i = 1; i < count; i++) {
+      id_cover_t single = {ids[i] & STANDARD_ID_MASK, 0};
+      if (assignment & (1u << (i - 1))) {
+        b = b_used ? cover_merge(&b, &single) : single;
+        b_used = true;
+      } else {
+        a = cover_merge(&a, &single);
+      }
+    }
+    if (!b_used) {
+      b = a;
+    }
+
+    uint32_t size = union_size(&a, &b);
+    if (size < best) {
+      best = size;
+      *best_a = a;
+      *best_b = b;
+    }
+  }
+  return best;
+}
+
+/* Repeatedly merge the two groups whose merged cover grows the least, until two groups remain */
+static uint32_t best_split_greedy(const uint32_t *ids, size_t count, id_cover_t *best_a, id_cover_t *best_b) {
+  static id_cover_t groups[MAX_IDS];
+  size_t num_groups = count;
+  for (size_t i = 0; i < count; i++) {
+    groups[i] = (id_cover_t) {ids[i] & STANDARD_ID_MASK, 0};
+  }
+
+  while (num_groups > 2) {
+    size_t merge_i = 0, merge_j = 1;
+    uint32_t best_growth = UINT32_MAX;
+    for (size_t i = 0; i < num_groups; i++) {
+      for (size_t j = i + 1; j < num_groups; j++) {
+        id_cover_t merged = cover_merge(&groups[i], &groups[j]);
+        /* Measured against the union, since overlapping covers (duplicate IDs, or IDs already inside a group) share accepted IDs */
+        uint32_t growth = cover_size(&merged) - union_size(&groups[i], &groups[j]);
+        if (growth < best_growth) {
+          best_growth = growth;
+          merge_i = i;
+          merge_j = j;
+        }
+      }
+    }
+    groups[merge_i] = cover_merge(&groups[merge_i], &groups[merge_j]);
+    groups[merge_j] = groups[--num_groups];
+  }
+
+  *best_a = groups[0];
+  *best_b = groups[1];
+  return union_size(best_a, best_b);
+}
+
+void can_filter_synthesize(const uint32_t *ids, size_t count, can_filter_config_t *filter) {
+  if (count == 0) {
+    *filter = (can_filter_config_t) {0, 0xFFFFFFFFu, true};
+    return;
+  }
+
+  id_cover_t single = cover_of(ids, count);
+  uint32_t single_size = cover_size(&single);
+
+  id_cover_t a = single, b = single;
+  uint32_t dual_size = single_size;
+  if (count > 1) {
+    size_t limited = (count < MAX_IDS) ? count : MAX_IDS;
+    dual_size = (limited <= CAN_FILTER_EXHAUSTIVE_MAX_IDS)
+      ? best_split_exhaustive(ids, limited, &a, &b)
+      : best_split_greedy(ids, limited, &a, &b);
+  }
+
+  if (dual_size < single_size) {
+    filter->single_filter = false;
+    filter->acceptance_code = (a.code << DUAL_ID1_SHIFT) | (b.code << DUAL_ID2_SHIFT);
+    filter->acceptance_mask = (a.mask << DUAL_ID1_SHIFT) | (b.mask << DUAL_ID2_SHIFT) | DUAL_DONT_CARE_DATA;
+  } else {
+    filter->single_filter = true;
+    filter->acceptance_code = single.code << SINGLE_ID_SHIFT;
+    filter->acceptance_mask = (single.mask << SINGLE_ID_SHIFT) | SINGLE_DONT_CARE_DATA;
+  }
+}
+
+bool can_filter_accepts(const can_filter_config_t *filter, uint32_t id) {
+  id &= STANDARD_ID_MASK;
+
+  /* Data frames have RTR = 0, so the code's RTR bit must be 0 unless it is masked */
+  if (filter->single_filter) {
+    uint32_t frame = id << SINGLE_ID_SHIFT;
+    return ((frame ^ filter->acceptance_code) & ~filter->acceptance_mask & ~SINGLE_DONT_CARE_DATA) == 0;
+  }
+
+  uint32_t frame1 = id << DUAL_ID1_SHIFT;
+  uint32_t frame2 = id << DUAL_ID2_SHIFT;
+  bool filter1 = ((frame1 ^ filter->acceptance_code) & ~filter->acceptance_mask & 0xFFF00000u) == 0;
+  bool filter2 = ((frame2 ^ filter->acceptance_code) & ~filter->acceptance_mask & 0x0000FFF0u) == 0;
+  return filter1 || filter2;
+}
+
+uint32_t can_filter_accepted_id_count(const can_filter_config_t *filter) {
+  uint32_t accepted = 0;
+  for (uint32_t id = 0; id < CAN_STANDARD_IDS; id++) {
+    accepted += can_filter_accepts(filter, id);
+  }
+  return accepted;
+}
+
+void can_filter_evaluate(const can_filter_config_t *filter,
+                         const uint32_t *watched_ids, size_t watched,
+                         const uint32_t *log_ids, const uint32_t *log_counts, size_t log_entries,
+                         can_filter_report_t *report) {
+  memset(report, 0, sizeof(can_filter_report_t));
+  for (size_t i = 0; i < log_entries; i++) {
+    bool is_watched = false;
+    for (size_t j = 0; j < watched; j++) {
+      is_watched = is_watched || (watched_ids[j] == log_ids[i]);
+    }
+
+    report->total_frames += log_counts[i];
+    if (is_watched) {
+      report->watched_frames += log_counts[i];
+    }
+    if (can_filter_accepts(filter, log_ids[i])) {
+      report->accepted_frames += log_counts[i];
+      if (!is_watched) {
+        report->false_accepts += log_counts[i];
+      }
+    }
+  }
+}
@@ -0,0 +1,69 @@
+#ifndef CAN_FILTER_H
+#define CAN_FILTER_H
+
+/**
+ * Acceptance filter synthesis for the ESP32 TWAI controller (standard frames). This module only
+ * depends on the C standard library so that filters can also be evaluated off-target.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Same layout as twai_filter_config_t (mask bits set to 1 are "don't care") */
+typedef struct {
+  uint32_t acceptance_code;
+  uint32_t acceptance_mask;
+  bool single_filter;
+} can_filter_config_t;
+
+/* Result of replaying the identifiers of a recorded bus log through a filter */
+typedef struct {
+  uint32_t total_frames;    /* Frames in the log */
+  uint32_t watched_frames;  /* Frames with a watched identifier */
+  uint32_t accepted_frames; /* Frames the filter lets through to the RX queue */
+  uint32_t false_accepts;   /* Accepted frames with an identifier that is not watched */
+} can_filter_report_t;
+
+/**
+ * @brief Computes the filter configuration accepting the fewest identifiers besides the watched ones.
+ *
+ * Both the single filter layout (one code/mask over the 11-bit ID) and the dual filter layout
+ * (two independent code/mask pairs) are considered. For the dual layout the watched IDs are
+ * partitioned into two groups, exhaustively for up to CAN_FILTER_EXHAUSTIVE_MAX_IDS identifiers
+ * and by greedy agglomerative merging beyond that. Remote frames are always rejected.
+ *
+ * @param[in]  ids    Watched standard identifiers.
+ * @param[in]  count  Number of identifiers (0 accepts everything).
+ * @param[out] filter Synthesized filter.
+ */
+void can_filter_synthesize(const uint32_t *ids, size_t count, can_filter_config_t *filter);
+
+#define CAN_FILTER_EXHAUSTIVE_MAX_IDS 16
+
+/**
+ * @brief Returns true if a data frame with the given standard identifier passes the filter.
+ */
+bool can_filter_accepts(const can_filter_config_t *filter, uint32_t id);
+
+/**
+ * @brief Returns the number of standard identifiers (out of 2048) that pass the filter.
+ */
+uint32_t can_filter_accepted_id_count(const can_filter_config_t *filter);
+
+/**
+ * @brief Evaluates a filter against the identifier histogram of a recorded bus log.
+ *
+ * @param[in]  filter       Filter to evaluate.
+ * @param[in]  watched_ids  Watched identifiers.
+ * @param[in]  watched      Number of watched identifiers.
+ * @param[in]  log_ids      Distinct identifiers seen in the log.
+ * @param[in]  log_counts   Number of frames seen for each identifier in log_ids.
+ * @param[in]  log_entries  Number of entries in log_ids/log_counts.
+ * @param[out] report       Frame counts, the false-accept ratio is false_accepts / accepted_frames.
+ */
+void can_filter_evaluate(const can_filter_config_t *filter,
+                         const uint32_t *watched_ids, size_t watched,
+                         const uint32_t *log_ids, const uint32_t *log_counts, size_t log_entries,
+                         can_filter_report_t *report);
+
+#endif
@@ -0,0 +1,213 @@
+#include <string.h>
+
+#include "can_frame_handler.h"
+#include "deferred_log.h"
+#include "portable_log.h"
+
+static const char *TAG = "can_frame_handler";
+
+typedef struct {
+  can_signal_id_t signal;
+  can_light_event_t on_event;
+  can_light_event_t off_event;
+  uint32_t on_threshold;
+  uint32_t off_threshold;
+  int64_t debounce_us;
+} light_input_def_t;
+
+typedef struct {
+  uint8_t next_state;
+  uint8_t action;
+} light_transition_t;
+
+/* Host builds can replace every debounce time of the table, e.g. can_replay with -DCAN_LIGHT_DEBOUNCE_MS=0 */
+#ifdef CAN_LIGHT_DEBOUNCE_MS
+#define INPUT_DEBOUNCE_MS(debounce_ms) (CAN_LIGHT_DEBOUNCE_MS)
+#else
+#define INPUT_DEBOUNCE_MS(debounce_ms) (debounce_ms)
+#endif
+
+static const light_input_def_t input_defs[CAN_LIGHT_INPUT_COUNT] = {
+#define CAN_LIGHT_INPUT_DEF(signal, on_event, off_event, on_threshold, off_threshold, debounce_ms) \
+  [CAN_LIGHT_INPUT_##signal] = {CAN_SIGNAL_##signal, CAN_LIGHT_EVENT_##on_event, CAN_LIGHT_EVENT_##off_event, \
+                                on_threshold, off_threshold, INPUT_DEBOUNCE_MS(debounce_ms) * 1000LL},
+  CAN_LIGHT_INPUT_TABLE(CAN_LIGHT_INPUT_DEF)
+#undef CAN_LIGHT_INPUT_DEF
+};
+
+static const char *const state_names[CAN_LIGHT_STATE_COUNT] = {"off_noui", "off_ui", "on_ui", "on_noui"};
+
+/* Transition lookup table and the inputs carried by every watched message, built once from the tables */
+static light_transition_t transitions[CAN_LIGHT_STATE_COUNT][CAN_LIGHT_EVENT_COUNT];
+static uint32_t message_inputs[CAN_SIGNAL_COUNT];
+static uint32_t message_signals[CAN_SIGNAL_COUNT];
+static uint32_t message_filtered_signals[CAN_SIGNAL_COUNT];
+
+_Static_assert(CAN_SIGNAL_COUNT <= 32, "Signal masks are 32 bits wide");
+static bool tables_compiled = false;
+
+static void compile_tables(void) {
+  for (int state = 0; state < CAN_LIGHT_STATE_COUNT; state++) {
+    for (int event = 0; event < CAN_LIGHT_EVENT_COUNT; event++) {
+      transitions[state][event] = (light_transition_t) {state, CAN_LIGHT_ACTION_NONE};
+    }
+  }
+#define CAN_LIGHT_TRANSITION_DEF(state, event, next_state, action) \
+  transitions[CAN_LIGHT_STATE_##state][CAN_LIGHT_EVENT_##event] = \
+      (light_transition_t) {CAN_LIGHT_STATE_##next_state, CAN_LIGHT_ACTION_##action};
+  CAN_LIGHT_TRANSITION_TABLE(CAN_LIGHT_TRANSITION_DEF)
+#undef CAN_LIGHT_TRANSITION_DEF
+
+  for (int input = 0; input < CAN_LIGHT_INPUT_COUNT; input++) {
+    const can_message_def_t *message = can_signals_lookup(can_signals_get_def(input_defs[input].signal)->can_id);
+    message_inputs[message->index] |= 1u << input;
+  }
+
+  for (int signal = 0; signal < CAN_SIGNAL_COUNT; signal++) {
+    message_signals[can_signals_lookup(can_signals_get_def(signal)->can_id)->index] |= 1u << signal;
+  }
+
+#define CAN_SIGNAL_FILTER_MESSAGE(signal, filter, param) \
+  message_filtered_signals[can_signals_lookup(can_signals_get_def(CAN_SIGNAL_##signal)->can_id)->index] |= \
+      1u << CAN_SIGNAL_##signal;
+  CAN_SIGNAL_FILTER_TABLE(CAN_SIGNAL_FILTER_MESSAGE)
+#undef CAN_SIGNAL_FILTER_MESSAGE
+  tables_compiled = true;
+}
+
+/* Advance the state machine by one event and perform the action of the transition */
+static void dispatch_event(can_frame_handler_t *handler, can_light_event_t event, const can_frame_t *frame,
+                           int64_t origin_us) {
+  const can_light_actions_t *actions = &handler->actions;
+  const light_transition_t *transition = &transitions[handler->state][event];
+
+  if (transition->next_state != handler->state) {
+    ESP_LOGI(TAG, "Lights %s -> %s", state_names[handler->state], state_names[transition->next_state]);
+  }
+  handler->state = transition->next_state;
+
+  switch (transition->action) {
+    case CAN_LIGHT_ACTION_NONE:
+      break;
+    case CAN_LIGHT_ACTION_STARTUP_SEQUENCE:
+      /* The startup animation only plays from dark, e.g. not over colors set from the web interface */
+      if (actions->lights_off(actions->context)) {
+        actions->perform(CAN_LIGHT_ACTION_STARTUP_SEQUENCE, frame, origin_us, actions->context);
+      }
+      break;
+    default:
+      actions->perform(transition->action, frame, origin_us, actions->context);
+      break;
+  }
+}
+
+/* Debounce the inputs carried by the frame's message, firing the events of levels that held long enough */
+static void update_inputs(can_frame_handler_t *handler, uint32_t inputs, const can_frame_t *frame) {
+  while (inputs != 0) {
+    int input = __builtin_ctz(inputs);
+    inputs &= inputs - 1;
+
+    const light_input_def_t *def = &input_defs[input];
+    can_light_input_state_t *state = &handler->inputs[input];
+    uint32_t value = handler->signal_values[def->signal];
+
+    bool level = state->candidate;
+    if (value >= def->on_threshold) {
+      level = true;
+    } else if (value <= def->off_threshold) {
+      level = false;
+    }
+
+    if (level != state->candidate) {
+      state->candidate = level;
+      state->candidate_us = frame->timestamp_us;
+    }
+
+    if (state->candidate == state->level) {
+      handler->pending_inputs &= ~(1u << input);
+    } else if (frame->timestamp_us - state->candidate_us >= def->debounce_us) {
+      state->level = state->candidate;
+      handler->pending_inputs &= ~(1u << input);
+      /* The level started with its first frame, the latency measured from there includes the debounce time */
+      dispatch_event(handler, state->level ? def->on_event : def->off_event, frame, state->candidate_us);
+    } else {
+      handler->pending_inputs |= 1u << input;
+    }
+  }
+}
+
+/* Run the given signals through their filter chains, noting whether a filtered signal moved */
+static void filter_signals(can_frame_handler_t *handler, uint32_t signals, const can_frame_t *frame) {
+  while (signals != 0) {
+    int signal = __builtin_ctz(signals);
+    signals &= signals - 1;
+
+    int32_t value = signal_filter_chain_update(&handler->filters[signal], handler->signal_values[signal], frame->timestamp_us);
+    if (value != handler->filtered_values[signal] && handler->filters[signal].num_stages > 0) {
+      handler->filtered_changed = true;
+    }
+    handler->filtered_values[signal] = value;
+  }
+}
+
+void can_frame_handler_init(can_frame_handler_t *handler, const can_light_actions_t *actions) {
+  if (!tables_compiled) {
+    compile_tables();
+  }
+  memset(handler, 0, sizeof(can_frame_handler_t));
+  handler->actions = *actions;
+  handler->state = CAN_LIGHT_STATE_OFF_NOUI;
+
+#define CAN_SIGNAL_FILTER_STAGE(signal, filter, param) \
+  signal_filter_chain_add(&handler->filters[CAN_SIGNAL_##signal], SIGNAL_FILTER_##filter, param);
+  CAN_SIGNAL_FILTER_TABLE(CAN_SIGNAL_FILTER_STAGE)
+#undef CAN_SIGNAL_FILTER_STAGE
+}
+
+bool can_frame_handler_is_filtered(can_signal_id_t signal) {
+  return message_filtered_signals[can_signals_lookup(can_signals_get_def(signal)->can_id)->index] & (1u << signal);
+}
+
+const char *can_frame_handler_state_name(can_light_state_t state) {
+  return (state < CAN_LIGHT_STATE_COUNT) ? state_names[state] : "unknown";
+}
+
+bool can_frame_handler_process(can_frame_handler_t *handler, const can_frame_t *frame) {
+  handler->filtered_changed = false;
+
+  /* Constant time dispatch, regardless of how many identifiers are watched */
+  const can_message_def_t *message_def = (frame->extd || frame->rtr) ? NULL : can_signals_lookup(frame->identifier);
+  if (message_def == NULL) {
+    return false;
+  }
+
+  uint8_t dlc = (frame->dlc < CAN_FRAME_MAX_DLC) ? frame->dlc : CAN_FRAME_MAX_DLC;
+  uint8_t *previous_data = handler->previous_message_data[message_def->index];
+  if (memcmp(frame->data, previous_data, dlc) == 0) {
+    /* Unchanged data can still confirm a level that waits for its debounce time */
+    uint32_t pending = handler->pending_inputs & message_inputs[message_def->index];
+    if (pending != 0) {
+      update_inputs(handler, pending, frame);
+    }
+    /* Filters take every sample, whether it changed or not */
+    uint32_t filtered = message_filtered_signals[message_def->index];
+    if (filtered != 0) {
+      filter_signals(handler, filtered, frame);
+    }
+    return false;
+  }
+
+  can_signals_decode(message_def, frame->data, dlc, handler->signal_values);
+  filter_signals(handler, message_signals[message_def->index], frame);
+  update_inputs(handler, message_inputs[message_def->index], frame);
+
+  /* Formatted later by readers of the deferred log, the data bytes are packed in transmission order */
+  uint32_t data_high = ((uint32_t) frame->data[0] << 24) | ((uint32_t) frame->data[1] << 16) |
+                       ((uint32_t) frame->data[2] << 8) | frame->data[3];
+  uint32_t data_low = ((uint32_t) frame->data[4] << 24) | ((uint32_t) frame->data[5] << 16) |
+                      ((uint32_t) frame->data[6] << 8) | frame->data[7];
+  deferred_log_write(DEFERRED_LOG_CAN_FRAME, frame->timestamp_us, frame->identifier, dlc, data_high, data_low);
+
+  memcpy(previous_data, frame->data, dlc);
+  return true;
+}
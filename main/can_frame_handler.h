@@ -0,0 +1,166 @@
+#ifndef CAN_FRAME_HANDLER_H
+#define CAN_FRAME_HANDLER_H
+
+/**
+ * Driver independent handling of received CAN frames: change detection, signal decoding and the
+ * reaction of the lights to signal changes through a table driven state machine. Only depends on
+ * the C standard library, so the same logic runs in the TWAI sniffer task and in the Linux replay
+ * tool (tools/can_replay), which replays recorded traces through it.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "can_signals.h"
+#include "signal_filter.h"
+
+#define CAN_FRAME_MAX_DLC 8
+
+/* A received CAN frame, independent of the driver it came from */
+typedef struct {
+  int64_t timestamp_us; /* Reception time, in the receiver's time base (esp_timer on target) */
+  uint32_t identifier;
+  bool extd;
+  bool rtr;
+  uint8_t dlc;
+  uint8_t data[CAN_FRAME_MAX_DLC];
+} can_frame_t;
+
+/* What the lights should do in response to the decoded signals */
+typedef enum {
+  CAN_LIGHT_ACTION_FADE_ON,          /* Fade both lights to the current color */
+  CAN_LIGHT_ACTION_FADE_OFF,         /* Drop pending animations and fade both lights off */
+  CAN_LIGHT_ACTION_STARTUP_SEQUENCE, /* Sequential dashboard then door animation, skipped if the lights are not off */
+  CAN_LIGHT_ACTION_NONE,             /* Transition without action, never performed */
+} can_light_action_t;
+
+/**
+ * Signals driving the light state machine. A signal turns on once its raw value reaches the on
+ * threshold and off once it drops to the off threshold (values in between keep the current level,
+ * i.e. hysteresis). A new level must hold for the debounce time, as seen by a later frame of the
+ * same message, before its event fires, so single frame glitches are ignored. Events of a frame
+ * fire in table order.
+ */
+#define CAN_LIGHT_INPUT_TABLE(X) \
+  /* signal               on event     off event     on threshold  off threshold  debounce ms */ \
+  X(AMBIENT_LIGHT,        AMBIENT_ON,  AMBIENT_OFF,  1,            0,             20) \
+  X(DISPLAY_STANDARD_UI,  UI_ON,       UI_OFF,       1,            0,             20)
+
+/* Lights on or off, and whether the display shows the standard UI (the car is awake) */
+typedef enum {
+  CAN_LIGHT_STATE_OFF_NOUI,
+  CAN_LIGHT_STATE_OFF_UI,
+  CAN_LIGHT_STATE_ON_UI,
+  CAN_LIGHT_STATE_ON_NOUI,
+  CAN_LIGHT_STATE_COUNT
+} can_light_state_t;
+
+typedef enum {
+  CAN_LIGHT_EVENT_AMBIENT_ON,
+  CAN_LIGHT_EVENT_AMBIENT_OFF,
+  CAN_LIGHT_EVENT_UI_ON,
+  CAN_LIGHT_EVENT_UI_OFF,
+  CAN_LIGHT_EVENT_COUNT
+} can_light_event_t;
+
+/**
+ * States x events -> next state and action, compiled into a lookup table. Pairs not listed keep
+ * their state without action.
+ */
+#define CAN_LIGHT_TRANSITION_TABLE(X) \
+  /* state      event         next state  action */ \
+  X(OFF_NOUI,   UI_ON,        ON_UI,      STARTUP_SEQUENCE) \
+  X(OFF_NOUI,   AMBIENT_OFF,  OFF_NOUI,   FADE_OFF) \
+  X(OFF_UI,     AMBIENT_ON,   ON_UI,      FADE_ON) \
+  X(OFF_UI,     AMBIENT_OFF,  OFF_UI,     FADE_OFF) \
+  X(OFF_UI,     UI_OFF,       OFF_NOUI,   NONE) \
+  X(ON_UI,      AMBIENT_ON,   ON_UI,      FADE_ON) \
+  X(ON_UI,      AMBIENT_OFF,  OFF_UI,     FADE_OFF) \
+  X(ON_UI,      UI_OFF,       ON_NOUI,    NONE) \
+  X(ON_NOUI,    UI_ON,        ON_UI,      STARTUP_SEQUENCE) \
+  X(ON_NOUI,    AMBIENT_OFF,  OFF_NOUI,   FADE_OFF)
+
+/**
+ * Smoothing of decoded signals (see signal_filter.h), stages apply in table order per signal. The
+ * filters of a message run on every one of its frames, including frames with unchanged data, so
+ * averages keep converging and slew-rate limits keep advancing. For example:
+ *   X(VEHICLE_SPEED,  MEDIAN,  3)
+ *   X(VEHICLE_SPEED,  EMA,     2)
+ */
+#define CAN_SIGNAL_FILTER_TABLE(X) \
+  /* signal               filter       param */
+
+typedef enum {
+#define CAN_LIGHT_INPUT_ENUM(signal, on_event, off_event, on_threshold, off_threshold, debounce_ms) CAN_LIGHT_INPUT_##signal,
+  CAN_LIGHT_INPUT_TABLE(CAN_LIGHT_INPUT_ENUM)
+#undef CAN_LIGHT_INPUT_ENUM
+  CAN_LIGHT_INPUT_COUNT
+} can_light_input_t;
+
+/* Debounced level of a light state machine input */
+typedef struct {
+  bool level;            /* Level whose event fired last */
+  bool candidate;        /* Level seen in the latest frames */
+  int64_t candidate_us;  /* Reception time of the frame that first showed the candidate level */
+} can_light_input_state_t;
+
+/**
+ * Callbacks through which the frame handler observes and drives the lights. frame is the frame that
+ * triggered the action, origin_us the reception time of the first frame showing the level that
+ * fired it, i.e. including the debounce time (0 if the action was not caused by a frame).
+ */
+typedef struct {
+  void (*perform)(can_light_action_t action, const can_frame_t *frame, int64_t origin_us, void *context);
+  bool (*lights_off)(void *context);
+  void *context;
+} can_light_actions_t;
+
+typedef struct {
+  can_light_actions_t actions;
+
+  /* Raw frame data of the last change of every watched message, indexed by message index */
+  uint8_t previous_message_data[CAN_SIGNAL_COUNT][CAN_FRAME_MAX_DLC];
+
+  /* Decoded signal values */
+  uint32_t signal_values[CAN_SIGNAL_COUNT];
+
+  /* Filtered signal values (Q8, the raw value in Q8 for signals without filters) and their filters */
+  int32_t filtered_values[CAN_SIGNAL_COUNT];
+  signal_filter_chain_t filters[CAN_SIGNAL_COUNT];
+  bool filtered_changed; /* Whether the last processed frame moved a filtered value of a filtered signal */
+
+  /* Light state machine, and its inputs waiting for their debounce time (bit per can_light_input_t) */
+  can_light_state_t state;
+  can_light_input_state_t inputs[CAN_LIGHT_INPUT_COUNT];
+  uint32_t pending_inputs;
+} can_frame_handler_t;
+
+/**
+ * @brief Resets a frame handler, can_signals_init() must have been called before.
+ *
+ * @param[out] handler Handler to initialize.
+ * @param[in]  actions Callbacks invoked for light actions (copied).
+ */
+void can_frame_handler_init(can_frame_handler_t *handler, const can_light_actions_t *actions);
+
+/**
+ * @brief Processes a received frame.
+ *
+ * Remote frames, and frames with an unwatched identifier, are ignored. Frames with the same data
+ * as the last change of their message only confirm inputs waiting for their debounce time.
+ * Otherwise the frame's signals are decoded and the light state machine advanced, in constant time.
+ *
+ * @return true if the frame changed any watched message data.
+ */
+bool can_frame_handler_process(can_frame_handler_t *handler, const can_frame_t *frame);
+
+/**
+ * @brief Returns whether CAN_SIGNAL_FILTER_TABLE attaches filters to a signal.
+ */
+bool can_frame_handler_is_filtered(can_signal_id_t signal);
+
+/**
+ * @brief Returns the name of a light state machine state, for logs and traces.
+ */
+const char *can_frame_handler_state_name(can_light_state_t state);
+
+#endif
@@ -0,0 +1,146 @@
+#include <string.h>
+
+#include "can_signals.h"
+
+static const can_signal_def_t signal_defs[CAN_SIGNAL_COUNT] = {
+#define CAN_SIGNAL_DEF(name, id, start, length, big_endian, scale, offset) \
+  [CAN_SIGNAL_##name] = {#name, id, start, length, big_endian, scale, offset},
+  CAN_SIGNAL_TABLE(CAN_SIGNAL_DEF)
+#undef CAN_SIGNAL_DEF
+};
+
+static can_signal_decoder_t decoders[CAN_SIGNAL_COUNT];
+static can_message_def_t messages[CAN_SIGNAL_COUNT];
+static size_t message_count = 0;
+
+/* Message index + 1 for every standard identifier, 0 if the identifier is not watched */
+static uint8_t id_lookup[CAN_STANDARD_ID_COUNT];
+
+/* =========================
+ *   SPECIALIZED DECODERS
+ * ========================= */
+static uint32_t decode_flag(const can_signal_decoder_t *decoder, const uint8_t *data) {
+  return (data[decoder->byte_index] >> decoder->shift) & 1;
+}
+
+static uint32_t decode_byte(const can_signal_decoder_t *decoder, const uint8_t *data) {
+  return data[decoder->byte_index];
+}
+
+static uint32_t decode_little_endian(const can_signal_decoder_t *decoder, const uint8_t *data) {
+  uint64_t word = 0;
+  for (int i = decoder->min_dlc - 1; i >= 0; i--) {
+    word = (word << 8) | data[i];
+  }
+  return (word >> decoder->shift) & decoder->mask;
+}
+
+static uint32_t decode_big_endian(const can_signal_decoder_t *decoder, const uint8_t *data) {
+  uint64_t word = 0;
+  for (int i = 0; i < 8; i++) {
+    word = (word << 8) | ((i < decoder->min_dlc) ? data[i] : 0);
+  }
+  return (word >> decoder->shift) & decoder->mask;
+}
+
+/* Pick the cheapest decoder able to extract the signal */
+static void compile_decoder(const can_signal_def_t *def, can_signal_decoder_t *decoder) {
+  decoder->mask = (def->length >= 32) ? 0xFFFFFFFFu : ((1u << def->length) - 1);
+
+  if (!def->big_endian) {
+    decoder->byte_index = def->start_bit / 8;
+    decoder->shift = def->start_bit;
+    decoder->min_dlc = ((def->start_bit + def->length - 1) / 8) + 1;
+
+    if (def->length == 1) {
+      decoder->shift = def->start_bit % 8;
+      decoder->decode = decode_flag;
+    } else if (def->length == 8 && (def->start_bit % 8) == 0) {
+      decoder->decode = decode_byte;
+    } else {
+      decoder->decode = decode_little_endian;
+    }
+    return;
+  }
+
+  /* Motorola start bits use the DBC sawtooth numbering, convert the MSB to its position in a
+   * big-endian 64-bit load of the frame (bit 0 = LSB of byte 7) */
+  int msb_position = ((7 - (def->start_bit / 8)) * 8) + (def->start_bit % 8);
+  int lsb_position = msb_position - def->length + 1;
+  decoder->byte_index = def->start_bit / 8;
+  decoder->shift = lsb_position;
+  decoder->min_dlc = 8 - (lsb_position / 8);
+
+  if (def->length == 1) {
+    decoder->shift = def->start_bit % 8;
+    decoder->decode = decode_flag;
+  } else if (def->length == 8 && (def->start_bit % 8) == 7) {
+    decoder->decode = decode_byte;
+  } else {
+    decoder->decode = decode_big_endian;
+  }
+}
+
+void can_signals_init(void) {
+  memset(id_lookup, 0, sizeof(id_lookup));
+  message_count = 0;
+
+  for (int signal = 0; signal < CAN_SIGNAL_COUNT; signal++) {
+    const can_signal_def_t *def = &signal_defs[signal];
+    compile_decoder(def, &decoders[signal]);
+
+    if (def->can_id >= CAN_STANDARD_ID_COUNT) {
+      continue;
+    }
+
+    /* Group signals by message, creating the message on its first signal */
+    uint8_t slot = id_lookup[def->can_id];
+    if (slot == 0) {
+      messages[message_count] = (can_message_def_t) {
+        .can_id = def->can_id,
+        .index = message_count,
+        .num_signals = 0,
+      };
+      id_lookup[def->can_id] = ++message_count;
+      slot = message_count;
+    }
+    can_message_def_t *message = &messages[slot - 1];
+    message->signals[message->num_signals++] = signal;
+  }
+}
+
+const can_message_def_t* can_signals_lookup(uint32_t can_id) {
+  if (can_id >= CAN_STANDARD_ID_COUNT || id_lookup[can_id] == 0) {
+    return NULL;
+  }
+  return &messages[id_lookup[can_id] - 1];
+}
+
+void can_signals_decode(const can_message_def_t *message, const uint8_t *data, uint8_t dlc, uint32_t *values) {
+  for (int i = 0; i < message->num_signals; i++) {
+    const can_signal_decoder_t *decoder = &decoders[message->signals[i]];
+    if (dlc >= decoder->min_dlc) {
+      values[message->signals[i]] = decoder->decode(decoder, data);
+    }
+  }
+}
+
+const can_signal_def_t* can_signals_get_def(can_signal_id_t signal) {
+  return &signal_defs[signal];
+}
+
+float can_signals_physical(can_signal_id_t signal, uint32_t raw) {
+  return (raw * signal_defs[signal].scale) + signal_defs[signal].offset;
+}
+
+size_t can_signals_message_count(void) {
+  return message_count;
+}
+
+size_t can_signals_watched_ids(uint32_t *ids, size_t max_ids) {
+  size_t count = (message_count < max_ids) ? message_count : max_ids;
+  for (size_t i = 0; i < count; i++) {
+    ids[i] = messages[i].can_id;
+  }
+  return count;
+}
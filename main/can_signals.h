@@ -0,0 +1,118 @@
+#ifndef CAN_SIGNALS_H
+#define CAN_SIGNALS_H
+
+/**
+ * Compiled CAN signal database. This module only depends on the C standard library so that the
+ * decoding logic can run off-target as well.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DISPLAY_CAN_ID 0x3B3
+#define LIGHTS_CAN_ID 0x3F5
+
+/**
+ * Signal table, one entry per decoded vehicle signal (DBC conventions):
+ *  - start bit: LSB position for little-endian (Intel) signals, MSB position for big-endian (Motorola) signals
+ *  - length: 1 to 32 bits, unsigned
+ *  - physical value = raw * scale + offset
+ *
+ * Adding a signal only requires a new entry here, its enum value (CAN_SIGNAL_<name>), decoder and
+ * ID lookup are generated from the table.
+ */
+#define CAN_SIGNAL_TABLE(X) \
+  /* name                 CAN ID          start  length  big endian  scale  offset */ \
+  X(DISPLAY_STANDARD_UI,  DISPLAY_CAN_ID, 18,    1,      false,      1.0f,  0.0f) \
+  X(LEFT_TURN_SIGNAL,     LIGHTS_CAN_ID,  1,     1,      false,      1.0f,  0.0f) \
+  X(RIGHT_TURN_SIGNAL,    LIGHTS_CAN_ID,  3,     1,      false,      1.0f,  0.0f) \
+  X(AMBIENT_LIGHT,        LIGHTS_CAN_ID,  8,     8,      false,      1.0f,  0.0f)
+
+typedef enum {
+#define CAN_SIGNAL_ENUM(name, id, start, length, big_endian, scale, offset) CAN_SIGNAL_##name,
+  CAN_SIGNAL_TABLE(CAN_SIGNAL_ENUM)
+#undef CAN_SIGNAL_ENUM
+  CAN_SIGNAL_COUNT
+} can_signal_id_t;
+
+/* Only standard (11-bit) identifiers are watched */
+#define CAN_STANDARD_ID_COUNT 2048
+
+typedef struct {
+  const char *name;
+  uint32_t can_id;
+  uint8_t start_bit;
+  uint8_t length;
+  bool big_endian;
+  float scale;
+  float offset;
+} can_signal_def_t;
+
+/* Decoder specialized for one signal when the database is initialized */
+typedef struct can_signal_decoder {
+  uint32_t (*decode)(const struct can_signal_decoder *decoder, const uint8_t *data);
+  uint8_t byte_index; /* Byte holding the signal (single byte decoders) */
+  uint8_t shift;      /* Right shift of the signal's LSB */
+  uint8_t min_dlc;    /* Frames shorter than this do not carry the signal */
+  uint32_t mask;
+} can_signal_decoder_t;
+
+/* A watched CAN message and the signals it carries */
+typedef struct {
+  uint32_t can_id;
+  uint8_t index; /* Dense message index, 0 to can_signals_message_count() - 1 */
+  uint8_t num_signals;
+  uint8_t signals[CAN_SIGNAL_COUNT];
+} can_message_def_t;
+
+/**
+ * @brief Builds the ID lookup table and the per-signal decoders from CAN_SIGNAL_TABLE.
+ *
+ * Must be called once before any other function of this module.
+ */
+void can_signals_init(void);
+
+/**
+ * @brief Looks up the watched message with the given identifier in constant time.
+ *
+ * @return The message definition, or NULL if no signal is carried by this identifier.
+ */
+const can_message_def_t* can_signals_lookup(uint32_t can_id);
+
+/**
+ * @brief Decodes every signal of a message into a raw value array indexed by can_signal_id_t.
+ *
+ * Signals that do not fit in the frame's data length keep their previous value.
+ *
+ * @param[in]     message Message definition returned by can_signals_lookup.
+ * @param[in]     data    Frame data.
+ * @param[in]     dlc     Frame data length.
+ * @param[in,out] values  Raw signal values, CAN_SIGNAL_COUNT entries.
+ */
+void can_signals_decode(const can_message_def_t *message, const uint8_t *data, uint8_t dlc, uint32_t *values);
+
+/**
+ * @brief Returns the definition of a signal.
+ */
+const can_signal_def_t* can_signals_get_def(can_signal_id_t signal);
+
+/**
+ * @brief Converts a raw signal value to its physical value (raw * scale + offset).
+ */
+float can_signals_physical(can_signal_id_t signal, uint32_t raw);
+
+/**
+ * @brief Returns the number of distinct watched message identifiers.
+ */
+size_t can_signals_message_count(void);
+
+/**
+ * @brief Copies the distinct watched message identifiers.
+ *
+ * @param[out] ids     Destination array.
+ * @param[in]  max_ids Capacity of the destination array.
+ * @return Number of identifiers copied.
+ */
+size_t can_signals_watched_ids(uint32_t *ids, size_t max_ids);
+
+#endif
@@ -0,0 +1,69 @@
+#include "nvs.h"
+
+#include "color_calibration.h"
+
+#define CALIBRATION_NVS_NAMESPACE "calibration"
+
+static const char *TAG = "color_calibration";
+
+void calibration_set_identity(color_calibration_t *calibration) {
+  memset(calibration, 0, sizeof(color_calibration_t));
+  for (int i = 0; i < 3; i++) {
+    calibration->matrix[i][i] = CALIBRATION_UNITY;
+  }
+}
+
+/* NVS key of a zone's calibration blob */
+static void calibration_key(int zone, char *key, size_t key_size) {
+  snprintf(key, key_size, "zone%d", zone);
+}
+
+esp_err_t calibration_load(int zone, color_calibration_t *calibration) {
+  calibration_set_identity(calibration);
+
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(CALIBRATION_NVS_NAMESPACE, NVS_READONLY, &handle);
+  if (err != ESP_OK) {
+    /* The namespace does not exist until the first calibration is saved */
+    if (err != ESP_ERR_NVS_NOT_FOUND) {
+      ESP_LOGW(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
+    }
+    return err;
+  }
+
+  char key[16];
+  calibration_key(zone, key, sizeof(key));
+  color_calibration_t stored;
+  size_t size = sizeof(stored);
+  err = nvs_get_blob(handle, key, &stored, &size);
+  nvs_close(handle);
+
+  if (err == ESP_OK && size == sizeof(stored)) {
+    *calibration = stored;
+    ESP_LOGI(TAG, "Loaded calibration for zone %d", zone);
+    return ESP_OK;
+  }
+  return (err == ESP_OK) ? ESP_ERR_INVALID_SIZE : err;
+}
+
+esp_err_t calibration_save(int zone, const color_calibration_t *calibration) {
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(CALIBRATION_NVS_NAMESPACE, NVS_READWRITE, &handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
+    return err;
+  }
+
+  char key[16];
+  calibration_key(zone, key, sizeof(key));
+  err = nvs_set_blob(handle, key, calibration, sizeof(color_calibration_t));
+  if (err == ESP_OK) {
+    err = nvs_commit(handle);
+  }
+  nvs_close(handle);
+
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to save calibration for zone %d: %s", zone, esp_err_to_name(err));
+  }
+  return err;
+}
@@ -0,0 +1,33 @@
+#ifndef COLOR_CALIBRATION_H
+#define COLOR_CALIBRATION_H
+
+#include "main_common.h"
+
+/* Q8 fixed point value of a calibration gain of 1.0 */
+#define CALIBRATION_UNITY 256
+
+/**
+ * @brief Sets a calibration to the identity matrix (colors are output unchanged).
+ */
+void calibration_set_identity(color_calibration_t *calibration);
+
+/**
+ * @brief Loads the calibration of a zone from NVS.
+ *
+ * @param[in]  zone        Zone index (DASHBOARD_INDEX, DOOR_INDEX, ...).
+ * @param[out] calibration Loaded calibration, or the identity if none is stored.
+ * @return ESP_OK if a calibration was loaded, ESP_ERR_NVS_NOT_FOUND if the identity was used,
+ *         or another error code if NVS could not be read (the identity is used as well).
+ */
+esp_err_t calibration_load(int zone, color_calibration_t *calibration);
+
+/**
+ * @brief Stores the calibration of a zone in NVS.
+ *
+ * @param zone        Zone index (DASHBOARD_INDEX, DOOR_INDEX, ...).
+ * @param calibration Calibration to store.
+ * @return ESP_OK on success, or the NVS error code on failure.
+ */
+esp_err_t calibration_save(int zone, const color_calibration_t *calibration);
+
+#endif
@@ -0,0 +1,451 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "command_json.h"
+
+/* Deepest nesting followed inside skipped values */
+#define MAX_SKIP_DEPTH 16
+
+/* Longest number converted with strtod, only numbers with a fraction or exponent take that path */
+#define MAX_NUMBER_LENGTH 32
+
+typedef struct {
+  const char *pos;
+  const char *end;
+} scanner_t;
+
+static void skip_whitespace(scanner_t *scanner) {
+  while (scanner->pos < scanner->end &&
+         (*scanner->pos == ' ' || *scanner->pos == '\t' || *scanner->pos == '\n' || *scanner->pos == '\r')) {
+    scanner->pos++;
+  }
+}
+
+/* Consume a character following optional whitespace */
+static bool accept(scanner_t *scanner, char c) {
+  skip_whitespace(scanner);
+  if (scanner->pos < scanner->end && *scanner->pos == c) {
+    scanner->pos++;
+    return true;
+  }
+  return false;
+}
+
+/* The next character after optional whitespace, 0 at the end of the buffer */
+static char peek(scanner_t *scanner) {
+  skip_whitespace(scanner);
+  return (scanner->pos < scanner->end) ? *scanner->pos : 0;
+}
+
+static bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+/* Scan a string, returning its raw contents (escape sequences are not decoded) */
+static bool scan_string(scanner_t *scanner, const char **text, size_t *length) {
+  if (!accept(scanner, '"')) {
+    return false;
+  }
+  const char *start = scanner->pos;
+  while (scanner->pos < scanner->end) {
+    char c = *scanner->pos++;
+    if (c == '"') {
+      *text = start;
+      *length = scanner->pos - 1 - start;
+      return true;
+    }
+    if (c == '\\') {
+      if (scanner->pos == scanner->end) {
+        return false;
+      }
+      scanner->pos++;
+    } else if ((unsigned char) c < 0x20) {
+      return false;
+    }
+  }
+  return false;
+}
+
+static uint32_t clamp(double value, uint32_t max) {
+  if (!(value > 0.0)) {
+    return 0;
+  }
+  return (value >= max) ? max : (uint32_t) value;
+}
+
+/* Scan a number clamped to 0-max, integers are converted directly, fractions and exponents through strtod */
+static bool scan_number(scanner_t *scanner, uint32_t max, uint32_t *value) {
+  skip_whitespace(scanner);
+  const char *start = scanner->pos;
+  bool negative = false;
+  if (scanner->pos < scanner->end && *scanner->pos == '-') {
+    negative = true;
+    scanner->pos++;
+  }
+  if (scanner->pos == scanner->end || !is_digit(*scanner->pos)) {
+    return false;
+  }
+
+  /* Saturates well before overflowing, anything past max clamps anyway */
+  uint32_t integer = 0;
+  while (scanner->pos < scanner->end && is_digit(*scanner->pos)) {
+    if (integer <= max) {
+      integer = integer * 10 + (*scanner->pos - '0');
+    }
+    scanner->pos++;
+  }
+
+  bool integral = true;
+  if (scanner->pos < scanner->end && *scanner->pos == '.') {
+    integral = false;
+    scanner->pos++;
+    if (scanner->pos == scanner->end || !is_digit(*scanner->pos)) {
+      return false;
+    }
+    while (scanner->pos < scanner->end && is_digit(*scanner->pos)) {
+      scanner->pos++;
+    }
+  }
+  if (scanner->pos < scanner->end && (*scanner->pos == 'e' || *scanner->pos == 'E')) {
+    integral = false;
+    scanner->pos++;
+    if (scanner->pos < scanner->end && (*scanner->pos == '+' || *scanner->pos == '-')) {
+      scanner->pos++;
+    }
+    if (scanner->pos == scanner->end || !is_digit(*scanner->pos)) {
+      return false;
+    }
+    while (scanner->pos < scanner->end && is_digit(*scanner->pos)) {
+      scanner->pos++;
+    }
+  }
+
+  if (integral) {
+    *value = negative ? 0 : clamp(integer, max);
+    return true;
+  }
+
+  /* The buffer is not null terminated, so strtod gets a bounded copy */
+  char number[MAX_NUMBER_LENGTH + 1];
+  size_t length = scanner->pos - start;
+  if (length > MAX_NUMBER_LENGTH) {
+    return false;
+  }
+  memcpy(number, start, length);
+  number[length] = '\0';
+  *value = clamp(strtod(number, NULL), max);
+  return true;
+}
+
+static bool scan_literal(scanner_t *scanner, const char *literal) {
+  size_t length = strlen(literal);
+  if ((size_t) (scanner->end - scanner->pos) < length || memcmp(scanner->pos, literal, length) != 0) {
+    return false;
+  }
+  scanner->pos += length;
+  return true;
+}
+
+/* Skip over any value, following up to MAX_SKIP_DEPTH levels of arrays and objects */
+static bool skip_value(scanner_t *scanner, int depth) {
+  const char *text;
+  size_t length;
+  uint32_t number;
+  if (depth > MAX_SKIP_DEPTH) {
+    return false;
+  }
+
+  switch (peek(scanner)) {
+    case '"':
+      return scan_string(scanner, &text, &length);
+    case '{':
+      scanner->pos++;
+      if (accept(scanner, '}')) {
+        return true;
+      }
+      do {
+        if (!scan_string(scanner, &text, &length) || !accept(scanner, ':') || !skip_value(scanner, depth + 1)) {
+          return false;
+        }
+      } while (accept(scanner, ','));
+      return accept(scanner, '}');
+    case '[':
+      scanner->pos++;
+      if (accept(scanner, ']')) {
+        return true;
+      }
+      do {
+        if (!skip_value(scanner, depth + 1)) {
+          return false;
+        }
+      } while (accept(scanner, ','));
+      return accept(scanner, ']');
+    case 't':
+      return scan_literal(scanner, "true");
+    case 'f':
+      return scan_literal(scanner, "false");
+    case 'n':
+      return scan_literal(scanner, "null");
+    default:
+      return scan_number(scanner, UINT8_MAX, &number);
+  }
+}
+
+static bool key_is(const char *key, size_t length, const char *name) {
+  return strlen(name) == length && memcmp(key, name, length) == 0;
+}
+
+/* Keys of the objects, a key that occurs twice keeps its first value (as with cJSON_GetObjectItem) */
+typedef enum {
+  KEY_RED = 1 << 0,
+  KEY_GREEN = 1 << 1,
+  KEY_BLUE = 1 << 2,
+  KEY_POSITION = 1 << 3,
+  KEY_GRADIENT = 1 << 4,
+  KEY_ZONE = 1 << 5,
+  KEY_EFFECT = 1 << 6,
+  KEY_DURATION = 1 << 7,
+  KEY_PIXELS = 1 << 8,
+  KEY_ZONES = 1 << 9,
+} field_key_t;
+
+/* Store a numeric field the first time its key occurs, other types leave it unchanged */
+static bool parse_number_field(scanner_t *scanner, uint32_t max, uint32_t *field, unsigned *seen, field_key_t key) {
+  bool first = !(*seen & key);
+  *seen |= key;
+  char c = peek(scanner);
+  if (first && (c == '-' || is_digit(c))) {
+    return scan_number(scanner, max, field);
+  }
+  return skip_value(scanner, 1);
+}
+
+static bool parse_field(scanner_t *scanner, uint8_t *field, unsigned *seen, field_key_t key) {
+  uint32_t value = *field;
+  bool valid = parse_number_field(scanner, UINT8_MAX, &value, seen, key);
+  *field = value;
+  return valid;
+}
+
+static const char *const effect_names[] = {
+#define COMMAND_JSON_EFFECT_NAME(name, json_name) json_name,
+  COMMAND_JSON_EFFECT_TABLE(COMMAND_JSON_EFFECT_NAME)
+#undef COMMAND_JSON_EFFECT_NAME
+};
+
+static bool parse_effect(scanner_t *scanner, command_json_effect_t *effect) {
+  const char *name;
+  size_t length;
+  if (!scan_string(scanner, &name, &length)) {
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(effect_names) / sizeof(effect_names[0]); i++) {
+    if (key_is(name, length, effect_names[i])) {
+      *effect = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+/* Validate the pixel string, which is decoded later straight from the request buffer */
+static bool parse_pixels(scanner_t *scanner, command_json_zone_t *zone) {
+  const char *pixels;
+  size_t length;
+  if (!scan_string(scanner, &pixels, &length) || length % 6 != 0 || length / 6 > UINT16_MAX) {
+    return false;
+  }
+  for (size_t i = 0; i < length; i++) {
+    if (hex_value(pixels[i]) < 0) {
+      return false;
+    }
+  }
+  zone->pixels = pixels;
+  zone->num_pixels = length / 6;
+  return true;
+}
+
+static bool parse_object(scanner_t *scanner, command_json_request_t *request, command_json_stop_t *stop,
+                         command_json_zone_t *zone);
+
+/* Parse the gradient array, stops past the maximum are skipped and unsorted stops discard the gradient */
+static bool parse_gradient(scanner_t *scanner, command_json_request_t *request) {
+  if (peek(scanner) != '[') {
+    return skip_value(scanner, 1);
+  }
+  scanner->pos++;
+  if (accept(scanner, ']')) {
+    return true;
+  }
+
+  bool sorted = true;
+  do {
+    if (request->num_stops == COMMAND_JSON_MAX_STOPS) {
+      if (!skip_value(scanner, 1)) {
+        return false;
+      }
+      continue;
+    }
+    command_json_stop_t *stop = &request->stops[request->num_stops];
+    if (!parse_object(scanner, request, stop, NULL)) {
+      return false;
+    }
+    if (request->num_stops > 0 && stop->position < request->stops[request->num_stops - 1].position) {
+      sorted = false;
+    }
+    request->num_stops++;
+  } while (accept(scanner, ','));
+
+  if (!sorted) {
+    request->num_stops = 0;
+  }
+  return accept(scanner, ']');
+}
+
+/* Parse a request object (stop is NULL), one of its gradient stops, or a batch zone (zone is set, request is its color) */
+static bool parse_object(scanner_t *scanner, command_json_request_t *request, command_json_stop_t *stop,
+                         command_json_zone_t *zone) {
+  if (!accept(scanner, '{')) {
+    return false;
+  }
+  if (accept(scanner, '}')) {
+    return zone == NULL;
+  }
+
+  unsigned seen = 0;
+  do {
+    const char *key;
+    size_t length;
+    if (!scan_string(scanner, &key, &length) || !accept(scanner, ':')) {
+      return false;
+    }
+
+    bool valid;
+    uint32_t value;
+    if (key_is(key, length, "red")) {
+      valid = parse_field(scanner, stop ? &stop->red : &request->red, &seen, KEY_RED);
+    } else if (key_is(key, length, "green")) {
+      valid = parse_field(scanner, stop ? &stop->green : &request->green, &seen, KEY_GREEN);
+    } else if (key_is(key, length, "blue")) {
+      valid = parse_field(scanner, stop ? &stop->blue : &request->blue, &seen, KEY_BLUE);
+    } else if (stop != NULL && key_is(key, length, "position")) {
+      valid = parse_field(scanner, &stop->position, &seen, KEY_POSITION);
+    } else if (stop == NULL && !(seen & KEY_GRADIENT) && key_is(key, length, "gradient")) {
+      seen |= KEY_GRADIENT;
+      valid = parse_gradient(scanner, request);
+    } else if (zone != NULL && !(seen & KEY_ZONE) && key_is(key, length, "zone")) {
+      /* The zone index is required and must be a number */
+      seen |= KEY_ZONE;
+      valid = scan_number(scanner, UINT8_MAX, &value);
+      zone->zone = value;
+    } else if (zone != NULL && !(seen & KEY_EFFECT) && key_is(key, length, "effect")) {
+      seen |= KEY_EFFECT;
+      valid = parse_effect(scanner, &zone->effect);
+    } else if (zone != NULL && key_is(key, length, "duration_ms")) {
+      value = zone->duration_ms;
+      valid = parse_number_field(scanner, UINT16_MAX, &value, &seen, KEY_DURATION);
+      zone->duration_ms = value;
+    } else if (zone != NULL && !(seen & KEY_PIXELS) && key_is(key, length, "pixels")) {
+      seen |= KEY_PIXELS;
+      valid = parse_pixels(scanner, zone);
+    } else {
+      valid = skip_value(scanner, 1);
+    }
+    if (!valid) {
+      return false;
+    }
+  } while (accept(scanner, ','));
+  return accept(scanner, '}') && (zone == NULL || (seen & KEY_ZONE));
+}
+
+/* Parse the zones array, every zone must be valid and appear once */
+static bool parse_zones(scanner_t *scanner, command_json_batch_t *batch) {
+  if (!accept(scanner, '[')) {
+    return false;
+  }
+  if (accept(scanner, ']')) {
+    return true;
+  }
+
+  uint32_t listed[256 / 32] = {0};
+  do {
+    if (batch->num_zones == COMMAND_JSON_MAX_ZONES) {
+      return false;
+    }
+    command_json_zone_t *zone = &batch->zones[batch->num_zones];
+    if (!parse_object(scanner, &zone->color, NULL, zone)) {
+      return false;
+    }
+    if (listed[zone->zone / 32] & (1u << (zone->zone % 32))) {
+      return false;
+    }
+    listed[zone->zone / 32] |= 1u << (zone->zone % 32);
+    batch->num_zones++;
+  } while (accept(scanner, ','));
+  return accept(scanner, ']');
+}
+
+bool command_json_parse(const char *json, size_t length, command_json_request_t *request) {
+  memset(request, 0, sizeof(*request));
+  scanner_t scanner = {json, json + length};
+  if (!parse_object(&scanner, request, NULL, NULL)) {
+    return false;
+  }
+  skip_whitespace(&scanner);
+  return scanner.pos == scanner.end;
+}
+
+bool command_json_parse_batch(const char *json, size_t length, command_json_batch_t *batch) {
+  memset(batch, 0, sizeof(*batch));
+  scanner_t scanner = {json, json + length};
+  if (!accept(&scanner, '{')) {
+    return false;
+  }
+  if (!accept(&scanner, '}')) {
+    unsigned seen = 0;
+    do {
+      const char *key;
+      size_t key_length;
+      if (!scan_string(&scanner, &key, &key_length) || !accept(&scanner, ':')) {
+        return false;
+      }
+      bool valid;
+      if (!(seen & KEY_ZONES) && key_is(key, key_length, "zones")) {
+        seen |= KEY_ZONES;
+        valid = parse_zones(&scanner, batch);
+      } else {
+        valid = skip_value(&scanner, 1);
+      }
+      if (!valid) {
+        return false;
+      }
+    } while (accept(&scanner, ','));
+    if (!accept(&scanner, '}')) {
+      return false;
+    }
+  }
+  skip_whitespace(&scanner);
+  return scanner.pos == scanner.end;
+}
+
+command_json_color_t command_json_pixel(const command_json_zone_t *zone, uint16_t index) {
+  const char *hex = zone->pixels + 6 * index;
+  return (command_json_color_t) {
+    hex_value(hex[0]) << 4 | hex_value(hex[1]),
+    hex_value(hex[2]) << 4 | hex_value(hex[3]),
+    hex_value(hex[4]) << 4 | hex_value(hex[5]),
+  };
+}
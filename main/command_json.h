@@ -0,0 +1,97 @@
+#ifndef COMMAND_JSON_H
+#define COMMAND_JSON_H
+
+/**
+ * Zero-allocation parser for the body of POST /api: {"red": r, "green": g, "blue": b}, with an
+ * optional "gradient" array of {"position", "red", "green", "blue"} stops, and of POST /api/batch:
+ * {"zones": [...]} with one such object per zone, extended with "zone", "effect", "duration_ms"
+ * and "pixels". The request buffer is scanned once in place and the fields are stored straight
+ * into a request struct, other keys and their values are skipped. Keys are case sensitive,
+ * missing or non-numeric fields are 0, and numbers are truncated towards zero and clamped to
+ * 0-255 (0-65535 for durations). Only depends on the C standard library.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define COMMAND_JSON_MAX_STOPS 8
+#define COMMAND_JSON_MAX_ZONES 8
+
+/* Effects of a batch zone, by their "effect" names */
+#define COMMAND_JSON_EFFECT_TABLE(X) \
+  /* name                 JSON name             */ \
+  X(SET,                  "set")                /* Show the target at once (default) */ \
+  X(FADE,                 "fade")               /* Fade to the target over duration_ms */ \
+  X(SEQUENTIAL,           "sequential")         /* Fill LED by LED from the first one, duration_ms per step */ \
+  X(SEQUENTIAL_REVERSE,   "sequential_reverse") /* Fill LED by LED from the last one, duration_ms per step */
+
+typedef enum {
+#define COMMAND_JSON_EFFECT_ENUM(name, json_name) COMMAND_JSON_EFFECT_##name,
+  COMMAND_JSON_EFFECT_TABLE(COMMAND_JSON_EFFECT_ENUM)
+#undef COMMAND_JSON_EFFECT_ENUM
+} command_json_effect_t;
+
+typedef struct {
+  uint8_t position;
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+} command_json_stop_t;
+
+typedef struct {
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+  uint8_t num_stops; /* 0 without a gradient or if its stops are not sorted by position, stops past the maximum are ignored */
+  command_json_stop_t stops[COMMAND_JSON_MAX_STOPS];
+} command_json_request_t;
+
+typedef struct {
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+} command_json_color_t;
+
+/* Zone of a batch, the target is the pixel array if given, else the gradient, else the color */
+typedef struct {
+  uint8_t zone;
+  command_json_effect_t effect;
+  uint16_t duration_ms;         /* 0 for the effect's default */
+  command_json_request_t color; /* Color and gradient */
+  const char *pixels;           /* "pixels" hex string, RRGGBB per pixel, pointing into the request buffer */
+  uint16_t num_pixels;
+} command_json_zone_t;
+
+typedef struct {
+  uint8_t num_zones;
+  command_json_zone_t zones[COMMAND_JSON_MAX_ZONES];
+} command_json_batch_t;
+
+/**
+ * @brief Parses a request body.
+ *
+ * @param json   Request body, not necessarily null terminated.
+ * @param length Length of the body.
+ * @return false if the body is not a well-formed JSON object (or nests deeper than the parser follows).
+ */
+bool command_json_parse(const char *json, size_t length, command_json_request_t *request);
+
+/**
+ * @brief Parses a batch request body.
+ *
+ * Unlike single requests, a batch is rejected as a whole if any zone is malformed: a zone without
+ * "zone", listed twice or past COMMAND_JSON_MAX_ZONES, an unknown effect, or pixels that are not
+ * whole RRGGBB hex triplets.
+ *
+ * @param json   Request body, not necessarily null terminated. It must outlive the batch, whose pixels point into it.
+ * @param length Length of the body.
+ * @return false if the body is not a well-formed batch.
+ */
+bool command_json_parse_batch(const char *json, size_t length, command_json_batch_t *batch);
+
+/**
+ * @brief Decodes pixel index (below zone->num_pixels) of a zone's pixel array.
+ */
+command_json_color_t command_json_pixel(const command_json_zone_t *zone, uint16_t index);
+
+#endif
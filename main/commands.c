@@ -33,4 +33,70 @@ command_t* create_set_color_command(rgb_t color) {
   cmd->type = COMMAND_SET_COLOR;
   cmd->data.color = color;
   return cmd;
+}
+
+command_t* create_gradient_command(CommandType type, const gradient_stop_t *stops, uint8_t num_stops) {
+  if (num_stops == 0 || num_stops > MAX_GRADIENT_STOPS) {
+    return NULL;
+  }
+  for (int i = 1; i < num_stops; i++) {
+    if (stops[i].position < stops[i - 1].position) {
+      return NULL;
+    }
+  }
+
+  command_t *cmd = calloc(1, sizeof(command_t));
+  if (!cmd) {
+    return NULL;
+  }
+  cmd->type = type;
+  cmd->data.color = stops[0].color;
+  cmd->data.step.num_steps = DEFAULT_FADE_STEPS;
+  cmd->data.step.delay_ms = DEFAULT_FADE_DELAY_MS;
+  cmd->data.target.type = TARGET_GRADIENT;
+  cmd->data.target.num_stops = num_stops;
+  memcpy(cmd->data.target.stops, stops, num_stops * sizeof(gradient_stop_t));
+  return cmd;
+}
+
+command_t* create_pixels_command(CommandType type, const rgb_t *pixels, uint16_t num_pixels) {
+  if (num_pixels == 0) {
+    return NULL;
+  }
+
+  command_t *cmd = calloc(1, sizeof(command_t));
+  if (!cmd) {
+    return NULL;
+  }
+  cmd->data.target.pixels = malloc(num_pixels * sizeof(rgb_t));
+  if (!cmd->data.target.pixels) {
+    free(cmd);
+    return NULL;
+  }
+  memcpy(cmd->data.target.pixels, pixels, num_pixels * sizeof(rgb_t));
+  cmd->type = type;
+  cmd->data.color = pixels[0];
+  cmd->data.step.num_steps = DEFAULT_FADE_STEPS;
+  cmd->data.step.delay_ms = DEFAULT_FADE_DELAY_MS;
+  cmd->data.target.type = TARGET_PIXELS;
+  cmd->data.target.num_pixels = num_pixels;
+  return cmd;
+}
+
+command_t* create_set_calibration_command(const color_calibration_t *calibration) {
+  command_t *cmd = calloc(1, sizeof(command_t));
+  if (!cmd) {
+    return NULL;
+  }
+  cmd->type = COMMAND_SET_CALIBRATION;
+  cmd->data.calibration = *calibration;
+  return cmd;
+}
+
+void free_command(command_t *cmd) {
+  if (!cmd) {
+    return;
+  }
+  free(cmd->data.target.pixels);
+  free(cmd);
 }
\ No newline at end of file
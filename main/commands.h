@@ -45,4 +45,56 @@ command_t* create_default_sequential_command(rgb_t color, bool reverse);
  */
 command_t* create_set_color_command(rgb_t color);
 
+/**
+ * @brief Creates a set color or fade-to command targeting a gradient
+ *
+ * Allocates and initializes a new command_t structure whose per-pixel target is interpolated
+ * between the given stops. Fade-to commands use the default fade step parameters.
+ *
+ * @param type      COMMAND_SET_COLOR or COMMAND_FADE_TO.
+ * @param stops     Gradient stops, sorted by ascending position.
+ * @param num_stops Number of stops (1 to MAX_GRADIENT_STOPS).
+ * @return Pointer to the newly allocated command_t structure, or NULL if allocation fails or the stops are invalid.
+ *
+ * @note The allocated memory must be freed by the caller (using free_command) to avoid memory leaks.
+ */
+command_t* create_gradient_command(CommandType type, const gradient_stop_t *stops, uint8_t num_stops);
+
+/**
+ * @brief Creates a set color or fade-to command targeting a full pixel array
+ *
+ * Allocates and initializes a new command_t structure along with a copy of the given pixels.
+ * Fade-to commands use the default fade step parameters.
+ *
+ * @param type       COMMAND_SET_COLOR or COMMAND_FADE_TO.
+ * @param pixels     Pixel colors, starting from the first LED of the strip.
+ * @param num_pixels Number of pixels in the array.
+ * @return Pointer to the newly allocated command_t structure, or NULL if allocation fails.
+ *
+ * @note The allocated memory must be freed by the caller (using free_command) to avoid memory leaks.
+ */
+command_t* create_pixels_command(CommandType type, const rgb_t *pixels, uint16_t num_pixels);
+
+/**
+ * @brief Creates a set calibration command
+ *
+ * Allocates and initializes a new command_t structure that replaces the light's color calibration
+ * and re-renders the current frame with it.
+ *
+ * @param calibration Calibration to apply.
+ * @return Pointer to the newly allocated command_t structure, or NULL if allocation fails.
+ *
+ * @note The allocated memory must be freed by the caller (using free_command) to avoid memory leaks.
+ */
+command_t* create_set_calibration_command(const color_calibration_t *calibration);
+
+/**
+ * @brief Frees a command along with any pixel data it owns
+ *
+ * Chained commands are not freed, since they are normally handed off to another light's queue.
+ *
+ * @param cmd Command to free (NULL is allowed).
+ */
+void free_command(command_t *cmd);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "deferred_log.h"
+
+#define RECORD_WORDS (sizeof(deferred_log_record_t) / sizeof(uint32_t))
+
+/* Sequence word of a slot that is being written */
+#define SLOT_BUSY 0
+
+typedef struct {
+  char level;
+  const char *tag;
+  const char *format;
+} event_def_t;
+
+static const event_def_t event_defs[DEFERRED_LOG_EVENT_COUNT] = {
+#define DEFERRED_LOG_EVENT_DEF(name, level, tag, format) [DEFERRED_LOG_##name] = {level, tag, format},
+  DEFERRED_LOG_EVENT_TABLE(DEFERRED_LOG_EVENT_DEF)
+#undef DEFERRED_LOG_EVENT_DEF
+};
+
+/* Word view of a record, so it can be copied with word-sized atomic accesses */
+typedef union {
+  deferred_log_record_t record;
+  uint32_t words[RECORD_WORDS];
+} record_words_t;
+
+static record_words_t ring[DEFERRED_LOG_RECORDS];
+
+/* Sequence number of the next slot to claim, the ring holds the DEFERRED_LOG_RECORDS before it */
+static uint32_t head = 0;
+
+/* A complete record carries its sequence number plus one, so that SLOT_BUSY never matches */
+static inline uint32_t published(uint32_t sequence) {
+  return sequence + 1;
+}
+
+void deferred_log_write(deferred_log_event_t event, int64_t timestamp_us, uint32_t arg0, uint32_t arg1, uint32_t arg2,
+                        uint32_t arg3) {
+  uint32_t sequence = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+  record_words_t *slot = &ring[sequence & (DEFERRED_LOG_RECORDS - 1)];
+
+  /* Readers must see the slot busy before any of its new contents */
+  __atomic_store_n(&slot->record.sequence, SLOT_BUSY, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  __atomic_store_n(&slot->record.timestamp_us, (uint32_t) timestamp_us, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->record.event, (uint32_t) event, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->record.args[0], arg0, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->record.args[1], arg1, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->record.args[2], arg2, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->record.args[3], arg3, __ATOMIC_RELAXED);
+
+  __atomic_store_n(&slot->record.sequence, published(sequence), __ATOMIC_RELEASE);
+}
+
+void deferred_log_cursor_init(deferred_log_cursor_t *cursor) {
+  uint32_t written = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+  cursor->next = (written > DEFERRED_LOG_RECORDS) ? written - DEFERRED_LOG_RECORDS : 0;
+  cursor->dropped = 0;
+}
+
+size_t deferred_log_read(deferred_log_cursor_t *cursor, deferred_log_record_t *records, size_t max_records) {
+  size_t copied = 0;
+  while (copied < max_records) {
+    uint32_t claimed = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    if (cursor->next == claimed) {
+      break;
+    }
+
+    /* Skip records that were overwritten since the cursor last moved */
+    if (claimed - cursor->next > DEFERRED_LOG_RECORDS) {
+      cursor->dropped += claimed - cursor->next - DEFERRED_LOG_RECORDS;
+      cursor->next = claimed - DEFERRED_LOG_RECORDS;
+    }
+
+    const record_words_t *slot = &ring[cursor->next & (DEFERRED_LOG_RECORDS - 1)];
+    uint32_t sequence = __atomic_load_n(&slot->record.sequence, __ATOMIC_ACQUIRE);
+    if (sequence != published(cursor->next)) {
+      if (__atomic_load_n(&head, __ATOMIC_RELAXED) - cursor->next > DEFERRED_LOG_RECORDS) {
+        continue; /* Overwritten meanwhile, skipped above on the next iteration */
+      }
+      break; /* Claimed but still being written, read it next time */
+    }
+
+    record_words_t copy;
+    for (size_t i = 0; i < RECORD_WORDS; i++) {
+      copy.words[i] = __atomic_load_n(&slot->words[i], __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    /* A writer may have started reusing the slot while it was copied, in which case the copy is discarded */
+    if (__atomic_load_n(&slot->record.sequence, __ATOMIC_RELAXED) != sequence) {
+      cursor->dropped++;
+      cursor->next++;
+      continue;
+    }
+
+    records[copied++] = copy.record;
+    cursor->next++;
+  }
+  return copied;
+}
+
+size_t deferred_log_format(const deferred_log_record_t *record, char *buffer, size_t size) {
+  if (record->event >= DEFERRED_LOG_EVENT_COUNT) {
+    return 0;
+  }
+
+  const event_def_t *def = &event_defs[record->event];
+  int length = snprintf(buffer, size, "%c (%" PRIu32 ") %s: ", def->level, record->timestamp_us / 1000, def->tag);
+  if (length < 0 || (size_t) length >= size) {
+    return 0;
+  }
+  length += snprintf(buffer + length, size - length, def->format, record->args[0], record->args[1], record->args[2],
+                     record->args[3]);
+  if ((size_t) length + 1 >= size) {
+    return 0;
+  }
+  buffer[length++] = '\n';
+  buffer[length] = '\0';
+  return (size_t) length;
+}
+
+uint32_t deferred_log_total(void) {
+  return __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,90 @@
+#ifndef DEFERRED_LOG_H
+#define DEFERRED_LOG_H
+
+/**
+ * Deferred binary logging for hot paths. Instead of formatting a message and writing it to the
+ * UART, a hot path stores a compact record (event ID and four raw 32-bit arguments) in a lock-free
+ * RAM ring, and readers format the records later, e.g. the HTTP server for /api/log. Any task may
+ * write concurrently: a slot is claimed with one atomic increment and published through its
+ * sequence word, readers skip records that were overwritten while they copied them. Only depends
+ * on the C standard library and GCC atomic builtins.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+#ifndef CONFIG_DEFERRED_LOG_RECORDS_LOG2
+#define CONFIG_DEFERRED_LOG_RECORDS_LOG2 8
+#endif
+#define DEFERRED_LOG_RECORDS (1u << CONFIG_DEFERRED_LOG_RECORDS_LOG2)
+
+/**
+ * Event table, the event ID selects the tag, level and format the record is printed with. Formats
+ * take exactly four uint32_t arguments (unused trailing ones are ignored) and no strings.
+ */
+#define DEFERRED_LOG_EVENT_TABLE(X) \
+  /* name        level  tag                   format */ \
+  X(CAN_FRAME,   'D',   "can_frame_handler",  "CAN message 0x%03" PRIX32 " dlc %" PRIu32 " data %08" PRIX32 "%08" PRIX32) \
+  X(CAN_BATCH,   'D',   "can_sniffer",        "Drained %" PRIu32 " frames, largest burst %" PRIu32)
+
+typedef enum {
+#define DEFERRED_LOG_EVENT_ENUM(name, level, tag, format) DEFERRED_LOG_##name,
+  DEFERRED_LOG_EVENT_TABLE(DEFERRED_LOG_EVENT_ENUM)
+#undef DEFERRED_LOG_EVENT_ENUM
+  DEFERRED_LOG_EVENT_COUNT
+} deferred_log_event_t;
+
+#define DEFERRED_LOG_ARGS 4
+
+typedef struct {
+  uint32_t sequence;     /* Managed by the ring */
+  uint32_t timestamp_us; /* Low 32 bits of the event time (wraps after 71 minutes) */
+  uint32_t event;        /* deferred_log_event_t */
+  uint32_t args[DEFERRED_LOG_ARGS];
+} deferred_log_record_t;
+
+/* Read position of a reader */
+typedef struct {
+  uint32_t next;    /* Sequence number of the next record to read */
+  uint32_t dropped; /* Records overwritten before this reader got to them */
+} deferred_log_cursor_t;
+
+/**
+ * @brief Appends a record, overwriting the oldest one once the ring is full. Never blocks and may
+ *        be called from any task.
+ *
+ * @param event        Event ID, selects the format.
+ * @param timestamp_us Event time, e.g. the reception time of the frame being logged.
+ */
+void deferred_log_write(deferred_log_event_t event, int64_t timestamp_us, uint32_t arg0, uint32_t arg1, uint32_t arg2,
+                        uint32_t arg3);
+
+/**
+ * @brief Positions a cursor at the oldest record still in the ring.
+ */
+void deferred_log_cursor_init(deferred_log_cursor_t *cursor);
+
+/**
+ * @brief Copies up to max_records complete records from the cursor position and advances the cursor.
+ *
+ * @return Number of records copied, 0 once the reader has caught up with the writers.
+ */
+size_t deferred_log_read(deferred_log_cursor_t *cursor, deferred_log_record_t *records, size_t max_records);
+
+/**
+ * @brief Formats a record as an esp_log style line ("D (milliseconds) tag: message\n").
+ *
+ * @return Length of the line (without the terminator), or 0 if the buffer is too small.
+ */
+size_t deferred_log_format(const deferred_log_record_t *record, char *buffer, size_t size);
+
+/**
+ * @brief Returns the total number of records written since boot.
+ */
+uint32_t deferred_log_total(void);
+
+#endif
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "flight_log.h"
+
+#define SECTOR_MAGIC 0x474F4C46 /* "FLOG" */
+#define SECTOR_VERSION 1
+
+/* Records read from storage per call when walking the log */
+#define READ_BATCH 8
+
+typedef struct {
+  uint32_t magic;
+  uint32_t sequence;
+  uint16_t version;
+  uint16_t record_size;
+  uint32_t sequence_check; /* ~sequence, detects a header torn by a reset */
+} sector_header_t;
+
+_Static_assert(sizeof(sector_header_t) == FLIGHT_LOG_HEADER_SIZE, "Sector header size mismatch");
+
+static uint8_t crc8(const uint8_t *bytes, size_t length, uint8_t crc) {
+  for (size_t i = 0; i < length; i++) {
+    crc ^= bytes[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (uint8_t) ((crc << 1) ^ 0x07) : (uint8_t) (crc << 1);
+    }
+  }
+  return crc;
+}
+
+static uint8_t record_check(const flight_record_t *record) {
+  const uint8_t *bytes = (const uint8_t *) record;
+  size_t check_offset = offsetof(flight_record_t, check);
+  uint8_t crc = crc8(bytes, check_offset, 0);
+  return crc8(bytes + check_offset + 1, sizeof(flight_record_t) - check_offset - 1, crc);
+}
+
+static bool record_valid(const flight_record_t *record) {
+  flight_record_type_t type = flight_record_type(record);
+  return (type >= FLIGHT_RECORD_CAN_FRAME && type <= FLIGHT_RECORD_BOOT) &&
+         flight_record_length(record) <= FLIGHT_LOG_MAX_DATA &&
+         record->check == record_check(record);
+}
+
+static bool record_erased(const flight_record_t *record) {
+  const uint8_t *bytes = (const uint8_t *) record;
+  for (size_t i = 0; i < sizeof(flight_record_t); i++) {
+    if (bytes[i] != 0xFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static inline uint32_t sector_offset(uint32_t sector) {
+  return sector * FLIGHT_LOG_SECTOR_SIZE;
+}
+
+static inline uint32_t record_offset(uint32_t sector, uint32_t slot) {
+  return sector_offset(sector) + FLIGHT_LOG_HEADER_SIZE + slot * FLIGHT_LOG_RECORD_SIZE;
+}
+
+static bool read_header(const flight_log_t *log, uint32_t sector, uint32_t *sequence) {
+  sector_header_t header;
+  if (!log->storage.read(log->storage.context, sector_offset(sector), &header, sizeof(header))) {
+    return false;
+  }
+  *sequence = header.sequence;
+  return header.magic == SECTOR_MAGIC && header.version == SECTOR_VERSION &&
+         header.record_size == FLIGHT_LOG_RECORD_SIZE && header.sequence_check == ~header.sequence;
+}
+
+/* Erase a sector and claim it for the given sequence number */
+static bool start_sector(flight_log_t *log, uint32_t sector, uint32_t sequence) {
+  const sector_header_t header = {SECTOR_MAGIC, sequence, SECTOR_VERSION, FLIGHT_LOG_RECORD_SIZE, ~sequence};
+  if (!log->storage.erase_sector(log->storage.context, sector_offset(sector)) ||
+      !log->storage.write(log->storage.context, sector_offset(sector), &header, sizeof(header))) {
+    return false;
+  }
+  log->head_sector = sector;
+  log->head_sequence = sequence;
+  log->head_slot = 0;
+  return true;
+}
+
+bool flight_log_open(flight_log_t *log, const flight_log_storage_t *storage) {
+  log->storage = *storage;
+  log->sector_count = storage->size / FLIGHT_LOG_SECTOR_SIZE;
+  if (log->sector_count < 2) {
+    return false;
+  }
+
+  /* The head is the valid sector with the highest sequence number */
+  bool found = false;
+  for (uint32_t sector = 0; sector < log->sector_count; sector++) {
+    uint32_t sequence;
+    if (read_header(log, sector, &sequence) && (!found || (int32_t) (sequence - log->head_sequence) > 0)) {
+      found = true;
+      log->head_sector = sector;
+      log->head_sequence = sequence;
+    }
+  }
+  if (!found) {
+    return start_sector(log, 0, 1);
+  }
+
+  /* Records are written in slot order, so the first erased slot is the write position */
+  log->head_slot = FLIGHT_LOG_RECORDS_PER_SECTOR;
+  for (uint32_t slot = 0; slot < FLIGHT_LOG_RECORDS_PER_SECTOR; slot++) {
+    flight_record_t record;
+    if (!log->storage.read(log->storage.context, record_offset(log->head_sector, slot), &record, sizeof(record))) {
+      return false;
+    }
+    if (record_erased(&record)) {
+      log->head_slot = slot;
+      break;
+    }
+  }
+  return true;
+}
+
+bool flight_log_append(flight_log_t *log, const flight_record_t *records, size_t count) {
+  while (count > 0) {
+    if (log->head_slot == FLIGHT_LOG_RECORDS_PER_SECTOR &&
+        !start_sector(log, (log->head_sector + 1) % log->sector_count, log->head_sequence + 1)) {
+      return false;
+    }
+
+    size_t run = FLIGHT_LOG_RECORDS_PER_SECTOR - log->head_slot;
+    run = (count < run) ? count : run;
+    if (!log->storage.write(log->storage.context, record_offset(log->head_sector, log->head_slot),
+                            records, run * sizeof(flight_record_t))) {
+      return false;
+    }
+
+    log->head_slot += run;
+    records += run;
+    count -= run;
+  }
+  return true;
+}
+
+void flight_record_init(flight_record_t *record, flight_record_type_t type, int64_t timestamp_us,
+                        uint32_t identifier, const uint8_t *data, uint8_t length) {
+  length = (length < FLIGHT_LOG_MAX_DATA) ? length : FLIGHT_LOG_MAX_DATA;
+  memset(record, 0, sizeof(flight_record_t));
+  record->timestamp_low = (uint32_t) timestamp_us;
+  record->timestamp_high = (uint16_t) (timestamp_us >> 32);
+  record->type_length = (type << 4) | length;
+  record->identifier = identifier;
+  if (length > 0) {
+    memcpy(record->data, data, length);
+  }
+  record->check = record_check(record);
+}
+
+/* Sequence number of the oldest sector that still holds records */
+static uint32_t oldest_sequence(const flight_log_t *log) {
+  uint32_t retained = log->sector_count - 1;
+  return (log->head_sequence > retained) ? log->head_sequence - retained : 1;
+}
+
+void flight_log_cursor_init(const flight_log_t *log, flight_log_cursor_t *cursor) {
+  cursor->sequence = oldest_sequence(log);
+  cursor->slot = 0;
+}
+
+size_t flight_log_read(const flight_log_t *log, flight_log_cursor_t *cursor, flight_record_t *records, size_t max_records) {
+  size_t copied = 0;
+  while (copied < max_records && (int32_t) (cursor->sequence - log->head_sequence) <= 0) {
+    uint32_t end = (cursor->sequence == log->head_sequence) ? log->head_slot : FLIGHT_LOG_RECORDS_PER_SECTOR;
+    if (cursor->slot >= end) {
+      if (cursor->sequence == log->head_sequence) {
+        break;
+      }
+      cursor->sequence++;
+      cursor->slot = 0;
+      continue;
+    }
+
+    /* Sectors recycled since the cursor got there are gone, continue from the oldest retained one */
+    uint32_t oldest = oldest_sequence(log);
+    if ((int32_t) (cursor->sequence - oldest) < 0) {
+      cursor->sequence = oldest;
+      cursor->slot = 0;
+      continue;
+    }
+
+    uint32_t sector = (log->head_sector + log->sector_count - (log->head_sequence - cursor->sequence) % log->sector_count) % log->sector_count;
+    uint32_t sequence;
+    if (cursor->slot == 0 && (!read_header(log, sector, &sequence) || sequence != cursor->sequence)) {
+      cursor->slot = end;
+      continue;
+    }
+
+    flight_record_t batch[READ_BATCH];
+    size_t count = end - cursor->slot;
+    count = (count < READ_BATCH) ? count : READ_BATCH;
+    count = (count < max_records - copied) ? count : max_records - copied;
+    if (!log->storage.read(log->storage.context, record_offset(sector, cursor->slot), batch, count * sizeof(flight_record_t))) {
+      break;
+    }
+    cursor->slot += count;
+
+    for (size_t i = 0; i < count; i++) {
+      if (record_valid(&batch[i])) {
+        records[copied++] = batch[i];
+      }
+    }
+  }
+  return copied;
+}
+
+size_t flight_log_format_text(const flight_record_t *record, char *buffer, size_t size) {
+  int64_t timestamp_us = flight_record_timestamp(record);
+  int length = snprintf(buffer, size, "(%llu.%06llu) ",
+                        (unsigned long long) (timestamp_us / 1000000), (unsigned long long) (timestamp_us % 1000000));
+  if (length < 0 || (size_t) length >= size) {
+    return 0;
+  }
+
+  switch (flight_record_type(record)) {
+    case FLIGHT_RECORD_CAN_FRAME:
+      length += snprintf(buffer + length, size - length, "can0 %03lX#", (unsigned long) record->identifier);
+      for (int i = 0; i < flight_record_length(record) && (size_t) length < size; i++) {
+        length += snprintf(buffer + length, size - length, "%02X", record->data[i]);
+      }
+      break;
+    case FLIGHT_RECORD_LIGHT_STATE:
+      length += snprintf(buffer + length, size - length, "light%lu state %u", (unsigned long) record->identifier, record->data[0]);
+      break;
+    case FLIGHT_RECORD_BOOT:
+      length += snprintf(buffer + length, size - length, "boot reason %u", record->data[0]);
+      break;
+  }
+  if ((size_t) length < size) {
+    length += snprintf(buffer + length, size - length, "\n");
+  }
+  return ((size_t) length < size) ? (size_t) length : 0;
+}
@@ -0,0 +1,129 @@
+#ifndef FLIGHT_LOG_H
+#define FLIGHT_LOG_H
+
+/**
+ * Append-only circular event log for NOR flash. The storage is split into 4 KB sectors, each
+ * starting with a header holding a sequence number, followed by fixed size records. Sectors are
+ * filled and erased strictly in ring order (every sector wears equally), so after a reset the
+ * write position is recovered by finding the sector with the highest sequence number and the
+ * first erased record slot in it. Records carry a CRC-8, records torn by a reset during a write
+ * are skipped when reading.
+ *
+ * The storage is accessed through callbacks so that the same code runs on a flash partition and,
+ * for testing, on a file (tools/can_replay). Only depends on the C standard library.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define FLIGHT_LOG_SECTOR_SIZE 4096
+#define FLIGHT_LOG_HEADER_SIZE 16
+#define FLIGHT_LOG_RECORD_SIZE 20
+#define FLIGHT_LOG_RECORDS_PER_SECTOR ((FLIGHT_LOG_SECTOR_SIZE - FLIGHT_LOG_HEADER_SIZE) / FLIGHT_LOG_RECORD_SIZE)
+
+#define FLIGHT_LOG_MAX_DATA 8
+
+typedef enum {
+  FLIGHT_RECORD_CAN_FRAME = 1,   /* Watched CAN frame that changed a message, identifier is the CAN ID */
+  FLIGHT_RECORD_LIGHT_STATE = 2, /* Light state transition, identifier is the light index, data[0] the LightState */
+  FLIGHT_RECORD_BOOT = 3,        /* Device start, data[0] is the reset reason, timestamps restart from here */
+} flight_record_type_t;
+
+/* Record as stored in flash (little endian) */
+typedef struct {
+  uint32_t timestamp_low;  /* Event time (us since boot), bits 0-31 */
+  uint16_t timestamp_high; /* Event time (us since boot), bits 32-47 */
+  uint8_t type_length;     /* Record type (high nibble) and data length (low nibble) */
+  uint8_t check;           /* CRC-8 of the other 19 bytes */
+  uint32_t identifier;
+  uint8_t data[FLIGHT_LOG_MAX_DATA];
+} flight_record_t;
+
+_Static_assert(sizeof(flight_record_t) == FLIGHT_LOG_RECORD_SIZE, "Flight log records must stay 20 bytes");
+
+/* Storage callbacks, offsets are relative to the start of the log area */
+typedef struct {
+  bool (*read)(void *context, uint32_t offset, void *buffer, size_t length);
+  bool (*write)(void *context, uint32_t offset, const void *buffer, size_t length);
+  bool (*erase_sector)(void *context, uint32_t offset);
+  uint32_t size; /* Bytes, only whole sectors are used */
+  void *context;
+} flight_log_storage_t;
+
+typedef struct {
+  flight_log_storage_t storage;
+  uint32_t sector_count;
+  uint32_t head_sector;   /* Sector currently appended to */
+  uint32_t head_sequence; /* Sequence number of the head sector */
+  uint32_t head_slot;     /* Next free record slot in the head sector */
+} flight_log_t;
+
+/* Read position, from the oldest to the newest record */
+typedef struct {
+  uint32_t sequence; /* Sequence number of the sector being read */
+  uint32_t slot;     /* Next record slot in that sector */
+} flight_log_cursor_t;
+
+/**
+ * @brief Opens a log, recovering the write position from the storage contents.
+ *
+ * Storage without any valid sector (new or corrupted) is formatted.
+ *
+ * @return false if the storage is smaller than two sectors or cannot be accessed.
+ */
+bool flight_log_open(flight_log_t *log, const flight_log_storage_t *storage);
+
+/**
+ * @brief Appends records, writing each run of records that shares a sector with a single write.
+ *
+ * Once the head sector is full the next sector in ring order is erased, dropping its records.
+ */
+bool flight_log_append(flight_log_t *log, const flight_record_t *records, size_t count);
+
+/**
+ * @brief Fills in a record along with its check byte.
+ */
+void flight_record_init(flight_record_t *record, flight_record_type_t type, int64_t timestamp_us,
+                        uint32_t identifier, const uint8_t *data, uint8_t length);
+
+static inline flight_record_type_t flight_record_type(const flight_record_t *record) {
+  return (flight_record_type_t) (record->type_length >> 4);
+}
+
+static inline uint8_t flight_record_length(const flight_record_t *record) {
+  return record->type_length & 0x0F;
+}
+
+static inline int64_t flight_record_timestamp(const flight_record_t *record) {
+  return ((int64_t) record->timestamp_high << 32) | record->timestamp_low;
+}
+
+/**
+ * @brief Positions a cursor at the oldest record of the log.
+ */
+void flight_log_cursor_init(const flight_log_t *log, flight_log_cursor_t *cursor);
+
+/**
+ * @brief Copies up to max_records valid records from the cursor position and advances it.
+ *
+ * Sectors recycled since the cursor moved there are skipped.
+ *
+ * @return Number of records copied, 0 once the cursor reached the write position.
+ */
+size_t flight_log_read(const flight_log_t *log, flight_log_cursor_t *cursor, flight_record_t *records, size_t max_records);
+
+/**
+ * @brief Returns the number of records the log retains when full.
+ */
+static inline uint32_t flight_log_capacity(const flight_log_t *log) {
+  return (log->sector_count - 1) * FLIGHT_LOG_RECORDS_PER_SECTOR;
+}
+
+/**
+ * @brief Formats a record as a line of text, CAN frames use the `candump -l` format.
+ *
+ * @return Length of the line (without the terminator), or 0 if the buffer is too small.
+ */
+size_t flight_log_format_text(const flight_record_t *record, char *buffer, size_t size);
+
+#endif
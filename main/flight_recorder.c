@@ -0,0 +1,201 @@
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "flight_recorder.h"
+
+/* Events staged in RAM between flushes, and the batch that wakes the flush task (one 256 byte flash page) */
+#define STAGING_RECORDS 128
+#define FLUSH_BATCH_RECORDS (256 / FLIGHT_LOG_RECORD_SIZE)
+
+static const char *TAG = "flight_recorder";
+
+static const esp_partition_t *partition = NULL;
+static flight_log_t flight_log;
+static SemaphoreHandle_t flash_lock = NULL;
+static TaskHandle_t flush_task_handle = NULL;
+
+/* Staging ring, filled by any task under a spinlock and drained by the flush task */
+static portMUX_TYPE staging_lock = portMUX_INITIALIZER_UNLOCKED;
+static flight_record_t staging[STAGING_RECORDS];
+static uint32_t staging_head = 0;
+static uint32_t staging_tail = 0;
+
+static flight_recorder_metrics_t metrics;
+
+static bool partition_read(void *context, uint32_t offset, void *buffer, size_t length) {
+  return esp_partition_read(partition, offset, buffer, length) == ESP_OK;
+}
+
+static bool partition_write(void *context, uint32_t offset, const void *buffer, size_t length) {
+  return esp_partition_write(partition, offset, buffer, length) == ESP_OK;
+}
+
+static bool partition_erase_sector(void *context, uint32_t offset) {
+  return esp_partition_erase_range(partition, offset, FLIGHT_LOG_SECTOR_SIZE) == ESP_OK;
+}
+
+/* Stage a record without blocking, dropping it if the flush task has fallen behind */
+static void stage(const flight_record_t *record) {
+  if (flush_task_handle == NULL) {
+    return;
+  }
+
+  bool wake = false;
+  taskENTER_CRITICAL(&staging_lock);
+  metrics.logged++;
+  if (staging_head - staging_tail < STAGING_RECORDS) {
+    staging[staging_head % STAGING_RECORDS] = *record;
+    staging_head++;
+    wake = (staging_head - staging_tail) == FLUSH_BATCH_RECORDS;
+  } else {
+    metrics.dropped++;
+  }
+  taskEXIT_CRITICAL(&staging_lock);
+
+  if (wake) {
+    xTaskNotifyGive(flush_task_handle);
+  }
+}
+
+void flight_recorder_log_frame(const can_frame_t *frame) {
+  flight_record_t record;
+  flight_record_init(&record, FLIGHT_RECORD_CAN_FRAME, frame->timestamp_us, frame->identifier, frame->data, frame->dlc);
+  stage(&record);
+}
+
+void flight_recorder_log_light_state(int light_index, LightState state) {
+  flight_record_t record;
+  uint8_t data = state;
+  flight_record_init(&record, FLIGHT_RECORD_LIGHT_STATE, esp_timer_get_time(), light_index, &data, 1);
+  stage(&record);
+}
+
+void flight_recorder_flush(void) {
+  if (flash_lock == NULL) {
+    return;
+  }
+
+  xSemaphoreTake(flash_lock, portMAX_DELAY);
+  while (1) {
+    /* Copy out a contiguous run of staged records so flash is written without holding the spinlock */
+    flight_record_t batch[FLUSH_BATCH_RECORDS];
+    size_t count = 0;
+    taskENTER_CRITICAL(&staging_lock);
+    while (count < FLUSH_BATCH_RECORDS && staging_tail != staging_head) {
+      batch[count++] = staging[staging_tail % STAGING_RECORDS];
+      staging_tail++;
+    }
+    taskEXIT_CRITICAL(&staging_lock);
+    if (count == 0) {
+      break;
+    }
+
+    int64_t start = esp_timer_get_time();
+    bool written = flight_log_append(&flight_log, batch, count);
+    uint32_t duration_us = esp_timer_get_time() - start;
+    if (!written) {
+      ESP_LOGE(TAG, "Failed to write %u records", (unsigned) count);
+    }
+
+    taskENTER_CRITICAL(&staging_lock);
+    if (written) {
+      metrics.written += count;
+    } else {
+      metrics.write_errors++;
+    }
+    metrics.flushes++;
+    metrics.last_flush_us = duration_us;
+    taskEXIT_CRITICAL(&staging_lock);
+  }
+  xSemaphoreGive(flash_lock);
+}
+
+static void flush_task(void *arg) {
+  while (1) {
+    /* Wake up for a full page of records, or periodically to bound how much a reset can lose */
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_FLIGHT_RECORDER_FLUSH_MS));
+    flight_recorder_flush();
+  }
+}
+
+void flight_recorder_cursor_init(flight_log_cursor_t *cursor) {
+  if (flash_lock == NULL) {
+    *cursor = (flight_log_cursor_t) {0, 0};
+    return;
+  }
+
+  xSemaphoreTake(flash_lock, portMAX_DELAY);
+  flight_log_cursor_init(&flight_log, cursor);
+  xSemaphoreGive(flash_lock);
+}
+
+size_t flight_recorder_read(flight_log_cursor_t *cursor, flight_record_t *records, size_t max_records) {
+  if (flash_lock == NULL) {
+    return 0;
+  }
+
+  xSemaphoreTake(flash_lock, portMAX_DELAY);
+  size_t count = flight_log_read(&flight_log, cursor, records, max_records);
+  xSemaphoreGive(flash_lock);
+  return count;
+}
+
+void flight_recorder_get_metrics(flight_recorder_metrics_t *snapshot) {
+  taskENTER_CRITICAL(&staging_lock);
+  *snapshot = metrics;
+  taskEXIT_CRITICAL(&staging_lock);
+}
+
+esp_err_t flight_recorder_init(void) {
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, FLIGHT_RECORDER_PARTITION_SUBTYPE,
+                                       FLIGHT_RECORDER_PARTITION_LABEL);
+  if (partition == NULL) {
+    ESP_LOGW(TAG, "No \"%s\" partition, flight recorder disabled", FLIGHT_RECORDER_PARTITION_LABEL);
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  const flight_log_storage_t storage = {
+    .read = partition_read,
+    .write = partition_write,
+    .erase_sector = partition_erase_sector,
+    .size = partition->size,
+    .context = NULL,
+  };
+  if (!flight_log_open(&flight_log, &storage)) {
+    ESP_LOGE(TAG, "Failed to open flight log");
+    return ESP_FAIL;
+  }
+  metrics.capacity = flight_log_capacity(&flight_log);
+  ESP_LOGI(TAG, "Flight log recovered at sector %" PRIu32 " (sequence %" PRIu32 ") slot %" PRIu32 ", %" PRIu32 " events retained",
+           flight_log.head_sector, flight_log.head_sequence, flight_log.head_slot, metrics.capacity);
+
+  flash_lock = xSemaphoreCreateMutex();
+  if (flash_lock == NULL) {
+    ESP_LOGE(TAG, "Failed to create flash lock");
+    return ESP_FAIL;
+  }
+
+  BaseType_t task_result = xTaskCreatePinnedToCore(
+    flush_task,                             // Task function
+    "flight_recorder",                      // Name of the task
+    3072,                                   // Stack size
+    NULL,                                   // Task input parameter
+    CONFIG_FLIGHT_RECORDER_TASK_PRIORITY,   // Task priority
+    &flush_task_handle,                     // Task handle
+    CONFIG_FLIGHT_RECORDER_TASK_CORE        // Core to run the task on
+  );
+  if (task_result != pdPASS) {
+    ESP_LOGE(TAG, "Failed to create flight recorder task");
+    return ESP_FAIL;
+  }
+  metrics.enabled = true;
+
+  /* Mark where this boot's timestamps start */
+  flight_record_t boot;
+  uint8_t reason = esp_reset_reason();
+  flight_record_init(&boot, FLIGHT_RECORD_BOOT, esp_timer_get_time(), 0, &reason, 1);
+  stage(&boot);
+
+  return ESP_OK;
+}
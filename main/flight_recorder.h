@@ -0,0 +1,67 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include "main_common.h"
+#include "can_frame_handler.h"
+#include "flight_log.h"
+
+/* Label of the data partition holding the flight log (see partitions.csv) */
+#define FLIGHT_RECORDER_PARTITION_LABEL "canlog"
+#define FLIGHT_RECORDER_PARTITION_SUBTYPE 0x40
+
+typedef struct {
+  bool enabled;              /* False if the partition is missing or could not be opened */
+  uint32_t logged;           /* Events handed to the recorder since boot */
+  uint32_t dropped;          /* Events dropped because the staging buffer was full */
+  uint32_t written;          /* Events written to flash since boot */
+  uint32_t flushes;          /* Batched flash writes */
+  uint32_t write_errors;     /* Failed flash writes */
+  uint32_t capacity;         /* Events the partition retains */
+  uint32_t last_flush_us;    /* Duration of the last flush */
+} flight_recorder_metrics_t;
+
+/**
+ * @brief Opens the flight log partition, recovers its write position, logs a boot record and
+ *        starts the low priority flush task.
+ *
+ * Events are staged in RAM by the logging functions, which never block or touch flash, and are
+ * written in page sized batches by the flush task (or after CONFIG_FLIGHT_RECORDER_FLUSH_MS).
+ *
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if there is no flight log partition, ESP_FAIL if
+ *         the log or the flush task cannot be created.
+ */
+esp_err_t flight_recorder_init(void);
+
+/**
+ * @brief Logs a CAN frame that changed a watched message (callable from any task, never blocks).
+ */
+void flight_recorder_log_frame(const can_frame_t *frame);
+
+/**
+ * @brief Logs a light state transition (callable from any task, never blocks).
+ */
+void flight_recorder_log_light_state(int light_index, LightState state);
+
+/**
+ * @brief Writes every staged event to flash, blocking until done.
+ */
+void flight_recorder_flush(void);
+
+/**
+ * @brief Positions a cursor at the oldest logged event.
+ */
+void flight_recorder_cursor_init(flight_log_cursor_t *cursor);
+
+/**
+ * @brief Reads logged events from flash, serialized with the flush task.
+ *
+ * @return Number of records copied, 0 once every event was read.
+ */
+size_t flight_recorder_read(flight_log_cursor_t *cursor, flight_record_t *records, size_t max_records);
+
+/**
+ * @brief Copies a snapshot of the flight recorder metrics.
+ */
+void flight_recorder_get_metrics(flight_recorder_metrics_t *metrics);
+
+#endif
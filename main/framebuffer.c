@@ -0,0 +1,107 @@
+#include "framebuffer.h"
+
+#define SWAR_LANE_MASK 0x00FF00FFu
+
+uint32_t* framebuffer_alloc(int num_leds) {
+  return calloc(FRAMEBUFFER_WORDS(num_leds), sizeof(uint32_t));
+}
+
+void framebuffer_fill(uint32_t *frame, int num_leds, rgb_t color) {
+  for (int i = 0; i < num_leds; i++) {
+    framebuffer_set_pixel(frame, i, color);
+  }
+}
+
+/* Interpolate LEDs [start, end] from one stop color to the next using a 16.16 fixed point DDA */
+static void render_gradient_segment(uint32_t *frame, int start, int end, rgb_t from, rgb_t to) {
+  int span = end - start;
+  if (span <= 0) {
+    framebuffer_set_pixel(frame, start, to);
+    return;
+  }
+
+  int32_t red   = ((int32_t) from.red   << 16) + 0x8000;
+  int32_t green = ((int32_t) from.green << 16) + 0x8000;
+  int32_t blue  = ((int32_t) from.blue  << 16) + 0x8000;
+  int32_t red_step   = (((int32_t) to.red   - from.red)   << 16) / span;
+  int32_t green_step = (((int32_t) to.green - from.green) << 16) / span;
+  int32_t blue_step  = (((int32_t) to.blue  - from.blue)  << 16) / span;
+
+  for (int i = start; i <= end; i++) {
+    framebuffer_set_pixel(frame, i, (rgb_t) {red >> 16, green >> 16, blue >> 16});
+    red += red_step;
+    green += green_step;
+    blue += blue_step;
+  }
+}
+
+static void render_gradient(uint32_t *frame, int num_leds, const pixel_target_t *target) {
+  const gradient_stop_t *stops = target->stops;
+  int last = target->num_stops - 1;
+  int first_led = (stops[0].position * (num_leds - 1)) / 255;
+  int last_led = (stops[last].position * (num_leds - 1)) / 255;
+
+  for (int k = 0; k < last; k++) {
+    int start = (stops[k].position * (num_leds - 1)) / 255;
+    int end = (stops[k + 1].position * (num_leds - 1)) / 255;
+    render_gradient_segment(frame, start, end, stops[k].color, stops[k + 1].color);
+  }
+
+  /* LEDs outside of the first and last stop take the color of the nearest stop */
+  for (int i = 0; i < first_led; i++) {
+    framebuffer_set_pixel(frame, i, stops[0].color);
+  }
+  for (int i = last_led; i < num_leds; i++) {
+    framebuffer_set_pixel(frame, i, stops[last].color);
+  }
+}
+
+rgb_t framebuffer_render_target(uint32_t *frame, int num_leds, const command_t *command, channel_sums_t *sums) {
+  const pixel_target_t *target = &command->data.target;
+
+  if (target->type == TARGET_GRADIENT && target->num_stops > 0) {
+    render_gradient(frame, num_leds, target);
+  } else if (target->type == TARGET_PIXELS && target->pixels != NULL && target->num_pixels > 0) {
+    for (int i = 0; i < num_leds; i++) {
+      int source = (i < target->num_pixels) ? i : target->num_pixels - 1;
+      framebuffer_set_pixel(frame, i, target->pixels[source]);
+    }
+  } else {
+    /* Uniform target (or an empty gradient/pixel array), the sums follow directly from the color */
+    framebuffer_fill(frame, num_leds, command->data.color);
+    *sums = (channel_sums_t) {
+      command->data.color.red * num_leds,
+      command->data.color.green * num_leds,
+      command->data.color.blue * num_leds,
+    };
+    return command->data.color;
+  }
+
+  /* Sum the rendered target so callers still have a single representative color */
+  *sums = (channel_sums_t) {0, 0, 0};
+  for (int i = 0; i < num_leds; i++) {
+    rgb_t pixel = framebuffer_get_pixel(frame, i);
+    sums->red += pixel.red;
+    sums->green += pixel.green;
+    sums->blue += pixel.blue;
+  }
+  return (rgb_t) {sums->red / num_leds, sums->green / num_leds, sums->blue / num_leds};
+}
+
+void framebuffer_lerp(uint32_t *out, const uint32_t *from, const uint32_t *to, int num_leds, uint32_t t) {
+  const uint32_t inverse = 256 - t;
+  const int words = FRAMEBUFFER_WORDS(num_leds);
+
+  /**
+   * Each word is split into its even and odd bytes, giving two 16-bit lanes per 32-bit value.
+   * A lane holds at most 255 * 256, so the weighted sum of both inputs never carries into the
+   * neighbouring lane.
+   */
+  for (int i = 0; i < words; i++) {
+    uint32_t a = from[i];
+    uint32_t b = to[i];
+    uint32_t even = (((a & SWAR_LANE_MASK) * inverse + (b & SWAR_LANE_MASK) * t) >> 8) & SWAR_LANE_MASK;
+    uint32_t odd = (((a >> 8) & SWAR_LANE_MASK) * inverse + ((b >> 8) & SWAR_LANE_MASK) * t) & ~SWAR_LANE_MASK;
+    out[i] = even | odd;
+  }
+}
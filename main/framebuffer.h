@@ -0,0 +1,97 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "main_common.h"
+
+/**
+ * Framebuffers hold packed RGB bytes (R, G, B, R, G, B, ...) for every LED of a strip, padded
+ * to a whole number of 32-bit words so that interpolation can process four channels per word.
+ */
+#define FRAMEBUFFER_BYTES(num_leds) ((((num_leds) * 3) + 3) & ~3)
+#define FRAMEBUFFER_WORDS(num_leds) (FRAMEBUFFER_BYTES(num_leds) / 4)
+
+/* Per-channel sums over every LED of a framebuffer */
+typedef struct {
+  uint32_t red;
+  uint32_t green;
+  uint32_t blue;
+} channel_sums_t;
+
+/**
+ * @brief Allocates a zeroed (all LEDs off) framebuffer for the given number of LEDs.
+ *
+ * @param num_leds Number of LEDs in the strip.
+ * @return Pointer to the framebuffer, or NULL on allocation failure.
+ */
+uint32_t* framebuffer_alloc(int num_leds);
+
+/**
+ * @brief Returns the color of a single LED in the framebuffer.
+ */
+static inline rgb_t framebuffer_get_pixel(const uint32_t *frame, int index) {
+  const uint8_t *bytes = (const uint8_t *) frame + (index * 3);
+  return (rgb_t) {bytes[0], bytes[1], bytes[2]};
+}
+
+/**
+ * @brief Sets the color of a single LED in the framebuffer.
+ */
+static inline void framebuffer_set_pixel(uint32_t *frame, int index, rgb_t color) {
+  uint8_t *bytes = (uint8_t *) frame + (index * 3);
+  bytes[0] = color.red;
+  bytes[1] = color.green;
+  bytes[2] = color.blue;
+}
+
+/**
+ * @brief Sets every LED in the framebuffer to the same color.
+ */
+void framebuffer_fill(uint32_t *frame, int num_leds, rgb_t color);
+
+/**
+ * @brief Renders the per-pixel target of a command into a framebuffer.
+ *
+ * Uniform targets fill the strip with the command color, gradients are interpolated between
+ * their stops in 16.16 fixed point, and pixel arrays are copied (LEDs past the end of the array
+ * keep the last pixel color).
+ *
+ * @param[out] frame    Framebuffer to render into.
+ * @param[in]  num_leds Number of LEDs in the strip.
+ * @param[in]  command  Set color or fade-to command holding the target.
+ * @param[out] sums     Per-channel sums of the rendered target.
+ * @return Average color of the rendered target, used as the light's representative color.
+ */
+rgb_t framebuffer_render_target(uint32_t *frame, int num_leds, const command_t *command, channel_sums_t *sums);
+
+/**
+ * @brief Interpolates two framebuffers into a third one.
+ *
+ * Computes out = (from * (256 - t) + to * t) / 256 for every channel. Two channels are packed
+ * into each 32-bit multiply (SWAR), so a whole word (four channels) costs four multiplies
+ * and no per-channel branches.
+ *
+ * @param[out] out      Destination framebuffer (may be the same buffer as either input).
+ * @param[in]  from     Framebuffer at t = 0.
+ * @param[in]  to       Framebuffer at t = 256.
+ * @param[in]  num_leds Number of LEDs in the strip.
+ * @param[in]  t        Interpolation weight in the range [0, 256].
+ */
+void framebuffer_lerp(uint32_t *out, const uint32_t *from, const uint32_t *to, int num_leds, uint32_t t);
+
+/**
+ * @brief Interpolates the channel sums of two framebuffers.
+ *
+ * Since interpolation is linear, the sums of framebuffer_lerp(from, to, t) match the interpolated
+ * sums (within one unit per LED from per-channel rounding), so callers can track the sums of every
+ * fade step in constant time instead of walking the strip.
+ */
+static inline channel_sums_t channel_sums_lerp(const channel_sums_t *from, const channel_sums_t *to, uint32_t t) {
+  const uint64_t inverse = 256 - t;
+  return (channel_sums_t) {
+    (from->red * inverse + to->red * (uint64_t) t) >> 8,
+    (from->green * inverse + to->green * (uint64_t) t) >> 8,
+    (from->blue * inverse + to->blue * (uint64_t) t) >> 8,
+  };
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include <string.h>
+#include <stdlib.h>
 #include <math.h>
 #include "freertos/FreeRTOS.h"
 #include "esp_event.h"
@@ -8,10 +9,23 @@
 #include "esp_app_format.h"
 #include "esp_http_server.h"
 #include "esp_wifi.h"
+#include "esp_timer.h"
 
 #include "../libraries/cJson.h"
 #include "main_common.h"
 #include "commands.h"
+#include "power_limiter.h"
+#include "color_calibration.h"
+#include "latency_histogram.h"
+#include "can_frame_handler.h"
+#include "vehicle_state.h"
+#include "can_capture.h"
+#include "flight_recorder.h"
+#include "deferred_log.h"
+#include "light_protocol.h"
+#include "command_json.h"
+#include "json_arena.h"
+#include "binary_control.h"
 
 #define ESP_WIFI_SSID CONFIG_ESP_WIFI_SSID
 #define ESP_WIFI_PASS CONFIG_ESP_WIFI_PASSWORD
@@ -20,10 +34,39 @@
 
 #define OTA_DATA_BUFFER_SIZE 1024
 
+/* Largest WebSocket frame accepted on /ws, and the period at which state changes are pushed to WebSocket clients */
+#define WS_MAX_FRAME_LEN 128
+#define WS_PUSH_PERIOD_MS 50
+
+#define HTTP_SERVER_MAX_SOCKETS 7
+
+/* Deferred log records formatted per chunk of an /api/log download */
+#define LOG_DOWNLOAD_BATCH 16
+
+/* Longest strip, and the largest POST /api/batch body: a full pixel array per zone (6 hex digits per pixel) plus the rest of the JSON */
+#define BATCH_MAX_PIXELS ((CONFIG_DASHBOARD_MAX_LEDS > CONFIG_DOOR_MAX_LEDS) ? CONFIG_DASHBOARD_MAX_LEDS : CONFIG_DOOR_MAX_LEDS)
+#define BATCH_MAX_BODY_LEN (NUM_LIGHTS * (6 * BATCH_MAX_PIXELS + 512))
+
 static const char *TAG = "AP";
 
 static char ota_write_data[OTA_DATA_BUFFER_SIZE + 1] = {0};
 
+/* Set while an OTA image is received and flashed, read by the CAN sniffer before it sleeps */
+static bool ota_in_progress = false;
+
+static httpd_handle_t server_handle = NULL;
+
+/* cJSON arena of the requests, every handler runs in the server task so one arena serves them all */
+static json_arena_t server_arena;
+
+/* WebSocket state, only touched from the server task */
+static esp_timer_handle_t ws_push_timer = NULL;
+static uint8_t ws_last_state[LIGHT_PROTOCOL_STATE_HEADER_LENGTH + NUM_LIGHTS * LIGHT_PROTOCOL_ZONE_REPORT_LENGTH];
+static bool ws_push_all = false;
+static uint32_t ws_messages = 0;
+static uint32_t ws_invalid_messages = 0;
+static uint32_t ws_dropped_commands = 0;
+
 /* Our URI handler function to be called during root GET request */
 esp_err_t get_handler(httpd_req_t *req)
 {
@@ -40,22 +83,55 @@ esp_err_t get_handler(httpd_req_t *req)
       "  <h1>Tesla Ambient Lighting Control</h1>\n"
       "  <p>Choose Color: <input type=\"color\" id=\"color\" name=\"color\" value=\"#ffffff\"></p>\n"
       "  <button id=\"submitBtn\">Submit</button>\n"
+      "  <p id=\"status\"></p>\n"
       "  <script>\n"
+      "    const stateNames = ['on', 'transitioning', 'off'];\n"
+      "    let socket = null;\n"
+      "    \n"
+      "    // Persistent control channel, reconnecting whenever it drops\n"
+      "    function connect() {\n"
+      "      socket = new WebSocket('ws://' + location.host + '/ws');\n"
+      "      socket.binaryType = 'arraybuffer';\n"
+      "      socket.onclose = function() {\n"
+      "        socket = null;\n"
+      "        setTimeout(connect, 1000);\n"
+      "      };\n"
+      "      socket.onmessage = function(event) {\n"
+      "        const data = new Uint8Array(event.data);\n"
+      "        if (data[0] !== 0x80) {\n"
+      "          return;\n"
+      "        }\n"
+      "        let text = 'Brightness ' + Math.round((data[2] | (data[3] << 8)) * 100 / 256) + '%';\n"
+      "        for (let i = 0; i < data[1]; i++) {\n"
+      "          const report = data.subarray(4 + i * 4, 8 + i * 4);\n"
+      "          text += ' | Zone ' + i + ': ' + stateNames[report[0]] + ' rgb(' + report[1] + ', ' + report[2] + ', ' + report[3] + ')';\n"
+      "        }\n"
+      "        document.getElementById('status').textContent = text;\n"
+      "      };\n"
+      "    }\n"
+      "    connect();\n"
+      "    \n"
+      "    // Convert hex color to RGB\n"
+      "    function pickedColor() {\n"
+      "      const hex = document.getElementById('color').value.replace('#', '');\n"
+      "      return [0, 2, 4].map(function(i) { return parseInt(hex.substring(i, i + 2), 16); });\n"
+      "    }\n"
+      "    \n"
+      "    // Stream the color while the picker is dragged, as 5 byte set color messages for every zone\n"
+      "    document.getElementById('color').addEventListener('input', function() {\n"
+      "      if (socket && socket.readyState === WebSocket.OPEN) {\n"
+      "        socket.send(new Uint8Array([0x01, 0xff].concat(pickedColor())));\n"
+      "      }\n"
+      "    });\n"
+      "    \n"
       "    document.getElementById('submitBtn').addEventListener('click', function() {\n"
-      "      const color = document.getElementById('color').value;\n"
-      "      \n"
-      "      // Convert hex color to RGB\n"
-      "      const hex = color.replace('#', '');\n"
-      "      const red = parseInt(hex.substring(0, 2), 16);\n"
-      "      const green = parseInt(hex.substring(2, 4), 16);\n"
-      "      const blue = parseInt(hex.substring(4, 6), 16);\n"
-      "      \n"
+      "      const color = pickedColor();\n"
       "      fetch('/api', {\n"
       "        method: 'POST',\n"
       "        headers: {\n"
       "          'Content-Type': 'application/json'\n"
       "        },\n"
-      "        body: JSON.stringify({ red: red, green: green, blue: blue })\n"
+      "        body: JSON.stringify({ red: color[0], green: color[1], blue: color[2] })\n"
       "      })\n"
       "    });\n"
       "  </script>\n"
@@ -65,6 +141,35 @@ esp_err_t get_handler(httpd_req_t *req)
   return ESP_OK;
 }
 
+_Static_assert(COMMAND_JSON_MAX_STOPS == MAX_GRADIENT_STOPS, "Parsed gradients must fit gradient commands");
+
+/**
+ * Reply to a light command submission: 202 with the sequence number once accepted, 429 with a retry
+ * hint if a light is saturated, 500 if the command could not be allocated.
+ */
+static esp_err_t send_submit_response(httpd_req_t *req, esp_err_t err, uint32_t sequence)
+{
+  char resp[64];
+  if (err == ESP_ERR_TIMEOUT)
+  {
+    httpd_resp_set_status(req, "429 Too Many Requests");
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+    snprintf(resp, sizeof(resp), "{\"retry_after_ms\":%d}", LIGHT_SATURATED_MS);
+  }
+  else if (err != ESP_OK)
+  {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    return ESP_FAIL;
+  }
+  else
+  {
+    httpd_resp_set_status(req, "202 Accepted");
+    snprintf(resp, sizeof(resp), "{\"sequence\":%" PRIu32 "}", sequence);
+  }
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, resp);
+}
+
 /* Our URI handler function to be called during POST /api request */
 esp_err_t api_handler(httpd_req_t *req)
 {
@@ -73,7 +178,7 @@ esp_err_t api_handler(httpd_req_t *req)
    * as well be any binary data (needs type casting).
    * In case of string data, null termination will be absent, and
    * content length would give length of string */
-  char content[128];
+  char content[512];
 
   /* Truncate if content length larger than the buffer */
   size_t recv_size = fmin(req->content_len, sizeof(content));
@@ -94,40 +199,842 @@ esp_err_t api_handler(httpd_req_t *req)
     return ESP_FAIL;
   }
 
-  /* Send a simple response */
-  const char resp[] = "API request received";
-  httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+  /* Parse JSON data in place, with an optional gradient given as an array of {position, red, green, blue} stops */
+  ESP_LOGD(TAG, "Received data: %.*s", ret, content);
+  command_json_request_t request;
+  if (!command_json_parse(content, ret, &request))
+  {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+    return ESP_FAIL;
+  }
 
-  /* Parse JSON data */
-  ESP_LOGI(TAG, "Received data: %.*s", recv_size, content);
-  cJSON *json = cJSON_ParseWithLength(content, recv_size);
+  rgb_t color = {request.red, request.green, request.blue};
+  gradient_stop_t stops[MAX_GRADIENT_STOPS];
+  uint8_t num_stops = request.num_stops;
+  for (int i = 0; i < num_stops; i++)
+  {
+    const command_json_stop_t *stop = &request.stops[i];
+    stops[i] = (gradient_stop_t){stop->position, {stop->red, stop->green, stop->blue}};
+  }
 
-  uint8_t red = cJSON_GetNumberValue(cJSON_GetObjectItem(json, "red"));
-  uint8_t green = cJSON_GetNumberValue(cJSON_GetObjectItem(json, "green"));
-  uint8_t blue = cJSON_GetNumberValue(cJSON_GetObjectItem(json, "blue"));
-  rgb_t color = {red, green, blue};
+  /* Send a set color command to every light so that the color is changed immediately, replacing one they did not get to yet */
+  command_t *commands[NUM_LIGHTS] = {NULL};
+  esp_err_t err = ESP_OK;
+  for (int i = 0; i < NUM_LIGHTS; i++)
+  {
+    commands[i] = (num_stops > 0) ? create_gradient_command(COMMAND_SET_COLOR, stops, num_stops)
+                                  : create_set_color_command(color);
+    if (commands[i] == NULL)
+    {
+      err = ESP_ERR_NO_MEM;
+    }
+  }
+  if (err != ESP_OK)
+  {
+    for (int i = 0; i < NUM_LIGHTS; i++)
+    {
+      free_command(commands[i]);
+    }
+    return send_submit_response(req, err, 0);
+  }
 
-  /* Deallocate JSON data */
-  cJSON_Delete(json);
+  /* Submitted as a batch, so a saturated light refuses the request for both instead of one zone changing alone.
+   * The commands share a sequence number, which the lights report once applied (see /api/metrics) */
+  uint32_t sequence = 0;
+  err = lights_submit_batch(commands, &sequence);
 
-  /* Update current color of ambient lighting */
-  xSemaphoreTake(current_color_lock, portMAX_DELAY);
-  current_color = color;
-  xSemaphoreGive(current_color_lock);
+  /* Update current color of ambient lighting once the lights took it */
+  if (err == ESP_OK)
+  {
+    xSemaphoreTake(current_color_lock, portMAX_DELAY);
+    current_color = (num_stops > 0) ? stops[0].color : color;
+    xSemaphoreGive(current_color_lock);
+  }
+  return send_submit_response(req, err, sequence);
+}
 
-  /* Send a set color command to the LEDs so that the color is changed immediately */
-  ESP_LOGI(TAG, "Refreshing LED color");
-  command_t* door_command = create_set_color_command(color);
-  command_t* dashboard_command = create_set_color_command(color);
+/* Turn a zone of a batch into its light's command, NULL if it cannot be allocated */
+static command_t *create_batch_command(const command_json_zone_t *zone)
+{
+  static const CommandType command_types[] = {
+      [COMMAND_JSON_EFFECT_SET] = COMMAND_SET_COLOR,
+      [COMMAND_JSON_EFFECT_FADE] = COMMAND_FADE_TO,
+      [COMMAND_JSON_EFFECT_SEQUENTIAL] = COMMAND_SEQUENTIAL,
+      [COMMAND_JSON_EFFECT_SEQUENTIAL_REVERSE] = COMMAND_SEQUENTIAL,
+  };
+  CommandType type = command_types[zone->effect];
+  const command_json_request_t *color = &zone->color;
 
-  xQueueSend(lights[DASHBOARD_INDEX].command_queue, &dashboard_command, portMAX_DELAY);
-  xQueueSend(lights[DOOR_INDEX].command_queue, &door_command, portMAX_DELAY);
+  command_t *command;
+  if (zone->num_pixels > 0)
+  {
+    /* Decoded straight from the request body, pixels past the end of the strip are never shown */
+    static rgb_t pixels[BATCH_MAX_PIXELS];
+    uint16_t num_pixels = fmin(zone->num_pixels, lights[zone->zone].strip_config.max_leds);
+    for (int i = 0; i < num_pixels; i++)
+    {
+      command_json_color_t pixel = command_json_pixel(zone, i);
+      pixels[i] = (rgb_t){pixel.red, pixel.green, pixel.blue};
+    }
+    command = create_pixels_command(type, pixels, num_pixels);
+  }
+  else if (color->num_stops > 0)
+  {
+    gradient_stop_t stops[MAX_GRADIENT_STOPS];
+    for (int i = 0; i < color->num_stops; i++)
+    {
+      const command_json_stop_t *stop = &color->stops[i];
+      stops[i] = (gradient_stop_t){stop->position, {stop->red, stop->green, stop->blue}};
+    }
+    command = create_gradient_command(type, stops, color->num_stops);
+  }
+  else if (type == COMMAND_FADE_TO)
+  {
+    command = create_default_fade_to_command((rgb_t){color->red, color->green, color->blue});
+  }
+  else if (type == COMMAND_SEQUENTIAL)
+  {
+    command = create_default_sequential_command((rgb_t){color->red, color->green, color->blue}, false);
+  }
+  else
+  {
+    command = create_set_color_command((rgb_t){color->red, color->green, color->blue});
+  }
+  if (command == NULL)
+  {
+    return NULL;
+  }
+
+  /* The duration is the whole fade, or the delay of each step of a sequential fill */
+  if (type == COMMAND_SEQUENTIAL)
+  {
+    command->data.step.num_steps = DEFAULT_SEQUENTIAL_STEPS;
+    command->data.step.delay_ms = (zone->duration_ms != 0) ? zone->duration_ms : DEFAULT_SEQUENTIAL_DELAY_MS;
+    command->data.step.reverse = (zone->effect == COMMAND_JSON_EFFECT_SEQUENTIAL_REVERSE);
+  }
+  else if (type == COMMAND_FADE_TO && zone->duration_ms != 0)
+  {
+    command->data.step.delay_ms = zone->duration_ms / command->data.step.num_steps;
+  }
+  return command;
+}
 
+/* Our URI handler function to be called during POST /api/batch request, applies per-zone colors, effects and pixels as one transaction */
+esp_err_t batch_handler(httpd_req_t *req)
+{
+  /* Handlers run one at a time in the server task, the parsed pixels point into this buffer until the commands are created */
+  static char content[BATCH_MAX_BODY_LEN];
+  if (req->content_len > sizeof(content))
+  {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Batch too large");
+    return ESP_FAIL;
+  }
+  size_t received = 0;
+  while (received < req->content_len)
+  {
+    int ret = httpd_req_recv(req, content + received, req->content_len - received);
+    if (ret <= 0)
+    {
+      if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+      {
+        httpd_resp_send_408(req);
+      }
+      return ESP_FAIL;
+    }
+    received += ret;
+  }
+
+  /* The whole batch is validated before any command is created */
+  command_json_batch_t batch;
+  if (!command_json_parse_batch(content, received, &batch) || batch.num_zones == 0)
+  {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid batch");
+    return ESP_FAIL;
+  }
+  for (int i = 0; i < batch.num_zones; i++)
+  {
+    if (batch.zones[i].zone >= NUM_LIGHTS)
+    {
+      httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown zone");
+      return ESP_FAIL;
+    }
+  }
+
+  command_t *commands[NUM_LIGHTS] = {NULL};
+  esp_err_t err = ESP_OK;
+  for (int i = 0; i < batch.num_zones && err == ESP_OK; i++)
+  {
+    const command_json_zone_t *zone = &batch.zones[i];
+    commands[zone->zone] = create_batch_command(zone);
+    if (commands[zone->zone] == NULL)
+    {
+      err = ESP_ERR_NO_MEM;
+    }
+  }
+  if (err != ESP_OK)
+  {
+    for (int i = 0; i < NUM_LIGHTS; i++)
+    {
+      free_command(commands[i]);
+    }
+    return send_submit_response(req, err, 0);
+  }
+
+  /* Update current color of ambient lighting from the first zone of the batch, once the lights took it */
+  rgb_t color = commands[batch.zones[0].zone]->data.color;
+  uint32_t sequence = 0;
+  err = lights_submit_batch(commands, &sequence);
+  if (err == ESP_OK)
+  {
+    xSemaphoreTake(current_color_lock, portMAX_DELAY);
+    current_color = color;
+    xSemaphoreGive(current_color_lock);
+  }
+  return send_submit_response(req, err, sequence);
+}
+
+/* Our URI handler function to be called during POST /api/bin request, applies a binary light control packet */
+esp_err_t bin_handler(httpd_req_t *req)
+{
+  /* Handlers run one at a time in the server task. One byte more than the largest packet, so longer bodies are rejected */
+  static uint8_t packet[LIGHT_PROTOCOL_MAX_PACKET + 1];
+  size_t length = fmin(req->content_len, sizeof(packet));
+  size_t received = 0;
+  while (received < length)
+  {
+    int ret = httpd_req_recv(req, (char *)packet + received, length - received);
+    if (ret <= 0)
+    {
+      if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+      {
+        httpd_resp_send_408(req);
+      }
+      return ESP_FAIL;
+    }
+    received += ret;
+  }
+
+  /* The acknowledgement carries the outcome, the status tells plain HTTP clients whether to back off */
+  uint8_t ack[LIGHT_PROTOCOL_ACK_LENGTH];
+  size_t ack_length;
+  uint8_t dropped;
+  light_packet_status_t status = binary_control_apply_packet(packet, received, ack, &ack_length, &dropped);
+  if (status != LIGHT_PACKET_OK)
+  {
+    httpd_resp_set_status(req, "400 Bad Request");
+  }
+  else if (dropped != 0)
+  {
+    httpd_resp_set_status(req, "429 Too Many Requests");
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+  }
+  else
+  {
+    httpd_resp_set_status(req, "202 Accepted");
+  }
+  httpd_resp_set_type(req, "application/octet-stream");
+  return httpd_resp_send(req, (const char *)ack, ack_length);
+}
+
+/* Our URI handler function to be called for the /ws WebSocket, applies binary light control messages */
+esp_err_t ws_handler(httpd_req_t *req)
+{
+  if (req->method == HTTP_GET)
+  {
+    /* Handshake done, send the new client the current state and keep pushing changes */
+    ESP_LOGI(TAG, "WebSocket client connected");
+    ws_push_all = true;
+    if (!esp_timer_is_active(ws_push_timer))
+    {
+      esp_timer_start_periodic(ws_push_timer, WS_PUSH_PERIOD_MS * 1000);
+    }
+    return ESP_OK;
+  }
+
+  /* Read the frame length first, so oversized frames are rejected before anything is received */
+  uint8_t payload[WS_MAX_FRAME_LEN];
+  httpd_ws_frame_t frame = {0};
+  esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+  if (err != ESP_OK)
+  {
+    return err;
+  }
+  if (frame.len > sizeof(payload))
+  {
+    ESP_LOGW(TAG, "WebSocket frame of %u bytes too large", (unsigned)frame.len);
+    ws_invalid_messages++;
+    return ESP_FAIL;
+  }
+  frame.payload = payload;
+  err = httpd_ws_recv_frame(req, &frame, sizeof(payload));
+  if (err != ESP_OK)
+  {
+    return err;
+  }
+  if (frame.type != HTTPD_WS_TYPE_BINARY)
+  {
+    ws_invalid_messages++;
+    return ESP_OK;
+  }
+
+  /* One or more messages back to back */
+  size_t offset = 0;
+  while (offset < frame.len)
+  {
+    light_message_t message;
+    size_t length = light_protocol_decode(payload + offset, frame.len - offset, &message);
+    if (length == 0)
+    {
+      ws_invalid_messages++;
+      break;
+    }
+    ws_dropped_commands += binary_control_apply_message(&message, NULL);
+    ws_messages++;
+    offset += length;
+  }
   return ESP_OK;
 }
 
-/* Our URI handler function to be called during POST /uri request */
-esp_err_t ota_handler(httpd_req_t *req)
+/* Work item of the server task, sends the light states to every WebSocket client if they changed */
+static void ws_push_state(void *arg)
+{
+  light_zone_report_t zones[NUM_LIGHTS];
+  for (int i = 0; i < NUM_LIGHTS; i++)
+  {
+    /* The color is written by the light's task, a torn read only shows up in a single report */
+    rgb_t color = lights[i].current_led_color;
+    zones[i] = (light_zone_report_t){light_get_state(&lights[i]), color.red, color.green, color.blue};
+  }
+  uint8_t report[sizeof(ws_last_state)];
+  size_t length = light_protocol_encode_state(zones, NUM_LIGHTS, lights_get_master_brightness(), report, sizeof(report));
+
+  bool push_all = ws_push_all;
+  if (!push_all && memcmp(report, ws_last_state, length) == 0)
+  {
+    return;
+  }
+  memcpy(ws_last_state, report, length);
+  ws_push_all = false;
+
+  size_t num_fds = HTTP_SERVER_MAX_SOCKETS;
+  int fds[HTTP_SERVER_MAX_SOCKETS];
+  if (httpd_get_client_list(server_handle, &num_fds, fds) != ESP_OK)
+  {
+    return;
+  }
+
+  httpd_ws_frame_t frame = {
+      .final = true,
+      .type = HTTPD_WS_TYPE_BINARY,
+      .payload = report,
+      .len = length,
+  };
+  int clients = 0;
+  for (size_t i = 0; i < num_fds; i++)
+  {
+    if (httpd_ws_get_fd_info(server_handle, fds[i]) == HTTPD_WS_CLIENT_WEBSOCKET)
+    {
+      httpd_ws_send_frame_async(server_handle, fds[i], &frame);
+      clients++;
+    }
+  }
+
+  /* Nobody left to push to, the next handshake restarts the timer */
+  if (clients == 0 && !push_all)
+  {
+    esp_timer_stop(ws_push_timer);
+  }
+}
+
+static void ws_push_timer_callback(void *arg)
+{
+  httpd_queue_work(server_handle, ws_push_state, NULL);
+}
+
+/* Print a JSON response built in the server arena, then release the arena along with the tree and the printed text */
+static esp_err_t send_json_response(httpd_req_t *req, cJSON *json)
+{
+  char *resp = cJSON_PrintUnformatted(json);
+  if (resp == NULL)
+  {
+    json_arena_end();
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    return ESP_FAIL;
+  }
+
+  httpd_resp_set_type(req, "application/json");
+  esp_err_t err = httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+  json_arena_end();
+  return err;
+}
+
+/* Our URI handler function to be called during GET /api/metrics request */
+esp_err_t metrics_handler(httpd_req_t *req)
+{
+  power_limiter_metrics_t power;
+  power_limiter_get_metrics(&power);
+  can_sniffer_metrics_t can;
+  can_sniffer_get_metrics(&can);
+  latency_metrics_t latency;
+  latency_histogram_get_metrics(&latency);
+
+  json_arena_begin(&server_arena);
+  cJSON *json = cJSON_CreateObject();
+  cJSON *power_json = cJSON_AddObjectToObject(json, "power");
+  cJSON_AddNumberToObject(power_json, "budget_ma", power.budget_ma);
+  cJSON_AddNumberToObject(power_json, "estimated_ma", power.estimated_ma);
+  cJSON_AddNumberToObject(power_json, "limited_ma", power.limited_ma);
+  cJSON_AddNumberToObject(power_json, "scale", power.scale);
+  cJSON_AddNumberToObject(power_json, "limited_frames", power.limited_frames);
+
+  cJSON *can_json = cJSON_AddObjectToObject(json, "can");
+  cJSON_AddNumberToObject(can_json, "frames_received", can.frames_received);
+  cJSON_AddNumberToObject(can_json, "frames_changed", can.frames_changed);
+  cJSON_AddNumberToObject(can_json, "max_batch", can.max_batch);
+  cJSON_AddNumberToObject(can_json, "state", can.state);
+  cJSON_AddNumberToObject(can_json, "rx_pending", can.rx_pending);
+  cJSON_AddNumberToObject(can_json, "rx_missed", can.rx_missed);
+  cJSON_AddNumberToObject(can_json, "rx_overrun", can.rx_overrun);
+  cJSON_AddNumberToObject(can_json, "arb_lost", can.arb_lost);
+  cJSON_AddNumberToObject(can_json, "bus_errors", can.bus_errors);
+  cJSON_AddNumberToObject(can_json, "tx_error_counter", can.tx_error_counter);
+  cJSON_AddNumberToObject(can_json, "rx_error_counter", can.rx_error_counter);
+  cJSON_AddNumberToObject(can_json, "bus_off_events", can.bus_off_events);
+  cJSON_AddNumberToObject(can_json, "sleeps", can.sleeps);
+  cJSON_AddNumberToObject(can_json, "asleep_ms", can.asleep_ms);
+  cJSON_AddNumberToObject(can_json, "last_wake_restore_us", can.last_wake_restore_us);
+  cJSON_AddNumberToObject(can_json, "max_wake_restore_us", can.max_wake_restore_us);
+
+  cJSON *capture_json = cJSON_AddObjectToObject(json, "capture");
+  cJSON_AddNumberToObject(capture_json, "total", can_capture_total());
+  cJSON_AddNumberToObject(capture_json, "capacity", CAN_CAPTURE_RECORDS);
+  cJSON_AddBoolToObject(capture_json, "promiscuous", can_sniffer_is_promiscuous());
+
+  flight_recorder_metrics_t recorder;
+  flight_recorder_get_metrics(&recorder);
+  cJSON *recorder_json = cJSON_AddObjectToObject(json, "flight_recorder");
+  cJSON_AddBoolToObject(recorder_json, "enabled", recorder.enabled);
+  cJSON_AddNumberToObject(recorder_json, "logged", recorder.logged);
+  cJSON_AddNumberToObject(recorder_json, "dropped", recorder.dropped);
+  cJSON_AddNumberToObject(recorder_json, "written", recorder.written);
+  cJSON_AddNumberToObject(recorder_json, "flushes", recorder.flushes);
+  cJSON_AddNumberToObject(recorder_json, "write_errors", recorder.write_errors);
+  cJSON_AddNumberToObject(recorder_json, "capacity", recorder.capacity);
+  cJSON_AddNumberToObject(recorder_json, "last_flush_us", recorder.last_flush_us);
+
+  cJSON *queues_json = cJSON_AddArrayToObject(json, "light_queues");
+  for (int i = 0; i < NUM_LIGHTS; i++)
+  {
+    light_queue_metrics_t queue;
+    lights_get_queue_metrics(i, &queue);
+    cJSON *queue_json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(queue_json, "submitted", queue.submitted);
+    cJSON_AddNumberToObject(queue_json, "coalesced", queue.coalesced);
+    cJSON_AddNumberToObject(queue_json, "queue_full", queue.queue_full);
+    cJSON_AddNumberToObject(queue_json, "queue_depth", queue.queue_depth);
+    cJSON_AddNumberToObject(queue_json, "capacity", LIGHT_COMMAND_QUEUE_LEN);
+    cJSON_AddNumberToObject(queue_json, "applied_sequence", queue.applied_sequence);
+    cJSON_AddNumberToObject(queue_json, "max_wait_us", queue.max_wait_us);
+    cJSON_AddNumberToObject(queue_json, "mean_wait_us", queue.mean_wait_us);
+    cJSON_AddNumberToObject(queue_json, "batch_timeouts", queue.batch_timeouts);
+    cJSON_AddItemToArray(queues_json, queue_json);
+  }
+
+  cJSON *ws_json = cJSON_AddObjectToObject(json, "websocket");
+  cJSON_AddNumberToObject(ws_json, "messages", ws_messages);
+  cJSON_AddNumberToObject(ws_json, "invalid_messages", ws_invalid_messages);
+  cJSON_AddNumberToObject(ws_json, "dropped_commands", ws_dropped_commands);
+
+  binary_control_metrics_t binary;
+  binary_control_get_metrics(&binary);
+  cJSON *binary_json = cJSON_AddObjectToObject(json, "binary_control");
+  cJSON_AddNumberToObject(binary_json, "packets", binary.packets);
+  cJSON_AddNumberToObject(binary_json, "invalid_packets", binary.invalid_packets);
+  cJSON_AddNumberToObject(binary_json, "messages", binary.messages);
+  cJSON_AddNumberToObject(binary_json, "dropped_commands", binary.dropped_commands);
+  cJSON_AddNumberToObject(binary_json, "udp_packets", binary.udp_packets);
+  cJSON_AddNumberToObject(binary_json, "udp_errors", binary.udp_errors);
+
+  /* Usage up to this request, which is still building its response */
+  cJSON *arena_json = cJSON_AddObjectToObject(json, "json_arena");
+  cJSON_AddNumberToObject(arena_json, "size", server_arena.size);
+  cJSON_AddNumberToObject(arena_json, "requests", server_arena.requests);
+  cJSON_AddNumberToObject(arena_json, "high_water", server_arena.high_water);
+  cJSON_AddNumberToObject(arena_json, "spilled_requests", server_arena.spilled_requests);
+  cJSON_AddNumberToObject(arena_json, "max_spilled", server_arena.max_spilled);
+
+  cJSON *latency_json = cJSON_AddObjectToObject(json, "can_to_led_latency");
+  cJSON_AddNumberToObject(latency_json, "count", latency.count);
+  cJSON_AddNumberToObject(latency_json, "p50_us", latency.p50_us);
+  cJSON_AddNumberToObject(latency_json, "p99_us", latency.p99_us);
+  cJSON_AddNumberToObject(latency_json, "max_us", latency.max_us);
+  cJSON_AddNumberToObject(latency_json, "mean_us", latency.mean_us);
+  cJSON *buckets_json = cJSON_AddArrayToObject(latency_json, "buckets");
+  for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+  {
+    cJSON_AddItemToArray(buckets_json, cJSON_CreateNumber(latency.buckets[i]));
+  }
+
+  return send_json_response(req, json);
+}
+
+/* Our URI handler function to be called during GET /api/vehicle request */
+esp_err_t vehicle_handler(httpd_req_t *req)
+{
+  vehicle_state_t state;
+  vehicle_state_read(&state);
+
+  json_arena_begin(&server_arena);
+  cJSON *json = cJSON_CreateObject();
+  cJSON_AddNumberToObject(json, "version", state.version);
+  cJSON_AddNumberToObject(json, "age_ms", state.version ? (esp_timer_get_time() - state.updated_us) / 1000 : -1);
+  cJSON *signals_json = cJSON_AddObjectToObject(json, "signals");
+  for (int i = 0; i < CAN_SIGNAL_COUNT; i++)
+  {
+    cJSON_AddNumberToObject(signals_json, can_signals_get_def(i)->name, can_signals_physical(i, state.signals[i]));
+  }
+  cJSON *filtered_json = cJSON_AddObjectToObject(json, "filtered");
+  for (int i = 0; i < CAN_SIGNAL_COUNT; i++)
+  {
+    if (can_frame_handler_is_filtered(i))
+    {
+      cJSON_AddNumberToObject(filtered_json, can_signals_get_def(i)->name, vehicle_state_filtered_physical(&state, i));
+    }
+  }
+  cJSON_AddNumberToObject(json, "master_brightness", lights_get_master_brightness() / 256.0);
+  cJSON *lights_json = cJSON_AddArrayToObject(json, "lights");
+  for (int i = 0; i < NUM_LIGHTS; i++)
+  {
+    cJSON_AddItemToArray(lights_json, cJSON_CreateNumber(light_get_state(&lights[i])));
+  }
+
+  return send_json_response(req, json);
+}
+
+/* Our URI handler function to be called during GET /api/log request, formats the deferred log records of the hot paths */
+esp_err_t log_get_handler(httpd_req_t *req)
+{
+  /* A batch of records and their text, too large for the server task's stack */
+  typedef struct
+  {
+    deferred_log_record_t records[LOG_DOWNLOAD_BATCH];
+    char text[LOG_DOWNLOAD_BATCH * 96];
+  } log_download_t;
+  log_download_t *download = malloc(sizeof(log_download_t));
+  if (download == NULL)
+  {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    return ESP_FAIL;
+  }
+  httpd_resp_set_type(req, "text/plain");
+
+  /* Formatting happens here, in the server task, never in the tasks that logged the records */
+  deferred_log_cursor_t cursor;
+  deferred_log_cursor_init(&cursor);
+  size_t count;
+  while ((count = deferred_log_read(&cursor, download->records, LOG_DOWNLOAD_BATCH)) > 0)
+  {
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+      length += deferred_log_format(&download->records[i], download->text + length, sizeof(download->text) - length);
+    }
+
+    if (httpd_resp_send_chunk(req, download->text, length) != ESP_OK)
+    {
+      ESP_LOGW(TAG, "Log download aborted");
+      free(download);
+      return ESP_FAIL;
+    }
+  }
+  free(download);
+
+  if (cursor.dropped > 0)
+  {
+    ESP_LOGW(TAG, "Log download skipped %" PRIu32 " overwritten records", cursor.dropped);
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static int compare_id_stats(const void *a, const void *b)
+{
+  const can_id_stats_t *left = a;
+  const can_id_stats_t *right = b;
+  if (left->used != right->used)
+  {
+    return left->used ? -1 : 1;
+  }
+  if (left->identifier != right->identifier)
+  {
+    return (left->identifier < right->identifier) ? -1 : 1;
+  }
+  return left->extd - right->extd;
+}
+
+/* Our URI handler function to be called during GET /api/canstats request */
+esp_err_t canstats_handler(httpd_req_t *req)
+{
+  /* Too large for the server task's stack */
+  can_bus_stats_t *stats = malloc(sizeof(can_bus_stats_t));
+  if (stats == NULL)
+  {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    return ESP_FAIL;
+  }
+  can_sniffer_get_bus_stats(stats);
+  int64_t now_us = esp_timer_get_time();
+  qsort(stats->ids, CAN_BUS_STATS_MAX_IDS, sizeof(can_id_stats_t), compare_id_stats);
+
+  json_arena_begin(&server_arena);
+  cJSON *json = cJSON_CreateObject();
+  cJSON_AddNumberToObject(json, "bitrate", stats->bitrate);
+  cJSON_AddNumberToObject(json, "load_percent", stats->load_permille / 10.0);
+  cJSON_AddNumberToObject(json, "peak_load_percent", stats->peak_load_permille / 10.0);
+  cJSON_AddNumberToObject(json, "frames_per_s", stats->frames_per_s);
+  cJSON_AddNumberToObject(json, "errors_per_s", stats->errors_per_s);
+  cJSON_AddBoolToObject(json, "promiscuous", can_sniffer_is_promiscuous());
+  cJSON_AddNumberToObject(json, "untracked_frames", stats->untracked_frames);
+  cJSON *ids_json = cJSON_AddArrayToObject(json, "ids");
+  for (int i = 0; i < stats->tracked_ids; i++)
+  {
+    const can_id_stats_t *entry = &stats->ids[i];
+    cJSON *id_json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(id_json, "id", entry->identifier);
+    cJSON_AddBoolToObject(id_json, "extd", entry->extd);
+    cJSON_AddNumberToObject(id_json, "frames", entry->frames);
+    cJSON_AddNumberToObject(id_json, "rate_hz", can_bus_stats_rate_mhz(entry) / 1000.0);
+    cJSON_AddNumberToObject(id_json, "age_ms", (now_us - entry->last_us) / 1000);
+    cJSON_AddNumberToObject(id_json, "interval_ms", entry->interval_q / (1000.0 * (1 << CAN_BUS_STATS_Q)));
+    cJSON_AddNumberToObject(id_json, "jitter_ms", entry->jitter_q / (1000.0 * (1 << CAN_BUS_STATS_Q)));
+    cJSON_AddItemToArray(ids_json, id_json);
+  }
+  free(stats);
+
+  return send_json_response(req, json);
+}
+
+/* Our URI handler function to be called during GET /api/capture request, streams the capture ring as candump text or binary records */
+esp_err_t capture_get_handler(httpd_req_t *req)
+{
+  char query[32];
+  char format[8] = "candump";
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+  {
+    httpd_query_key_value(query, "format", format, sizeof(format));
+  }
+  bool binary = strcmp(format, "binary") == 0;
+
+  if (binary)
+  {
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"capture.bin\"");
+    const can_capture_header_t header = {CAN_CAPTURE_MAGIC, CAN_CAPTURE_VERSION, sizeof(can_capture_record_t)};
+    httpd_resp_send_chunk(req, (const char *)&header, sizeof(header));
+  }
+  else
+  {
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"capture.log\"");
+  }
+
+  /* Stream until the reader catches up with the CAN task, which keeps recording meanwhile */
+  can_capture_cursor_t cursor;
+  can_capture_cursor_init(&cursor);
+  can_capture_record_t records[16];
+  char text[sizeof(records) / sizeof(records[0]) * 48];
+  size_t count;
+  while ((count = can_capture_read(&cursor, records, sizeof(records) / sizeof(records[0]))) > 0)
+  {
+    const char *chunk = (const char *)records;
+    size_t length = count * sizeof(can_capture_record_t);
+    if (!binary)
+    {
+      length = 0;
+      for (size_t i = 0; i < count; i++)
+      {
+        length += can_capture_format_candump(&records[i], text + length, sizeof(text) - length);
+      }
+      chunk = text;
+    }
+
+    if (httpd_resp_send_chunk(req, chunk, length) != ESP_OK)
+    {
+      ESP_LOGW(TAG, "Capture download aborted");
+      return ESP_FAIL;
+    }
+  }
+
+  if (cursor.dropped > 0)
+  {
+    ESP_LOGW(TAG, "Capture download skipped %" PRIu32 " overwritten frames", cursor.dropped);
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/* Our URI handler function to be called during GET /api/flightlog request, streams the flash event log oldest first */
+esp_err_t flightlog_get_handler(httpd_req_t *req)
+{
+  char query[32];
+  char format[8] = "text";
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+  {
+    httpd_query_key_value(query, "format", format, sizeof(format));
+  }
+  bool binary = strcmp(format, "binary") == 0;
+
+  httpd_resp_set_type(req, binary ? "application/octet-stream" : "text/plain");
+  httpd_resp_set_hdr(req, "Content-Disposition", binary ? "attachment; filename=\"flightlog.bin\"" : "attachment; filename=\"flightlog.log\"");
+
+  /* Include the events still staged in RAM */
+  flight_recorder_flush();
+
+  flight_log_cursor_t cursor;
+  flight_recorder_cursor_init(&cursor);
+  flight_record_t records[16];
+  char text[sizeof(records) / sizeof(records[0]) * 48];
+  size_t count;
+  while ((count = flight_recorder_read(&cursor, records, sizeof(records) / sizeof(records[0]))) > 0)
+  {
+    const char *chunk = (const char *)records;
+    size_t length = count * sizeof(flight_record_t);
+    if (!binary)
+    {
+      length = 0;
+      for (size_t i = 0; i < count; i++)
+      {
+        length += flight_log_format_text(&records[i], text + length, sizeof(text) - length);
+      }
+      chunk = text;
+    }
+
+    if (httpd_resp_send_chunk(req, chunk, length) != ESP_OK)
+    {
+      ESP_LOGW(TAG, "Flight log download aborted");
+      return ESP_FAIL;
+    }
+  }
+
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/* Our URI handler function to be called during POST /api/capture request, switches promiscuous capture on or off */
+esp_err_t capture_post_handler(httpd_req_t *req)
+{
+  char content[64];
+  if (req->content_len >= sizeof(content))
+  {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Request too large");
+    return ESP_FAIL;
+  }
+
+  int ret = httpd_req_recv(req, content, req->content_len);
+  if (ret <= 0)
+  {
+    if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+    {
+      httpd_resp_send_408(req);
+    }
+    return ESP_FAIL;
+  }
+  content[ret] = '\0';
+
+  json_arena_begin(&server_arena);
+  cJSON *json = cJSON_Parse(content);
+  cJSON *promiscuous = cJSON_GetObjectItem(json, "promiscuous");
+  if (!cJSON_IsBool(promiscuous))
+  {
+    json_arena_end();
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected {\"promiscuous\": true|false}");
+    return ESP_FAIL;
+  }
+
+  can_sniffer_set_promiscuous(cJSON_IsTrue(promiscuous));
+  json_arena_end();
+
+  httpd_resp_sendstr(req, "OK");
+  return ESP_OK;
+}
+
+/* Our URI handler function to be called during POST /api/calibration request */
+esp_err_t calibration_handler(httpd_req_t *req)
+{
+  char content[256];
+  if (req->content_len >= sizeof(content))
+  {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Calibration too large");
+    return ESP_FAIL;
+  }
+
+  int ret = httpd_req_recv(req, content, req->content_len);
+  if (ret <= 0)
+  {
+    if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+    {
+      httpd_resp_send_408(req);
+    }
+    return ESP_FAIL;
+  }
+
+  /**
+   * Accepts either a full row-major matrix, {"zone": 0, "matrix": [rr, rg, rb, gr, gg, gb, br, bg, bb]},
+   * or per-channel gains, {"zone": 0, "gain": [r, g, b]}, with 1.0 leaving a channel unchanged.
+   */
+  json_arena_begin(&server_arena);
+  cJSON *json = cJSON_ParseWithLength(content, ret);
+  /* Range checked on the double, converting NaN or out of range values to int is undefined */
+  const cJSON *zone_json = cJSON_GetObjectItem(json, "zone");
+  double zone_value = cJSON_IsNumber(zone_json) ? zone_json->valuedouble : -1.0;
+  const cJSON *matrix = cJSON_GetObjectItem(json, "matrix");
+  const cJSON *gain = cJSON_GetObjectItem(json, "gain");
+
+  color_calibration_t calibration;
+  calibration_set_identity(&calibration);
+  bool valid = (zone_value >= 0.0 && zone_value < NUM_LIGHTS && zone_value == floor(zone_value));
+  int zone = valid ? (int)zone_value : 0;
+  if (valid && cJSON_GetArraySize(matrix) == 9)
+  {
+    for (int i = 0; i < 9; i++)
+    {
+      double value = cJSON_GetNumberValue(cJSON_GetArrayItem(matrix, i));
+      valid = valid && (value >= -4.0 && value <= 4.0);
+      calibration.matrix[i / 3][i % 3] = valid ? lround(value * CALIBRATION_UNITY) : 0;
+    }
+  }
+  else if (valid && cJSON_GetArraySize(gain) == 3)
+  {
+    for (int i = 0; i < 3; i++)
+    {
+      double value = cJSON_GetNumberValue(cJSON_GetArrayItem(gain, i));
+      valid = valid && (value >= 0.0 && value <= 4.0);
+      calibration.matrix[i][i] = valid ? lround(value * CALIBRATION_UNITY) : 0;
+    }
+  }
+  else
+  {
+    valid = false;
+  }
+  json_arena_end();
+
+  if (!valid)
+  {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected a zone and a 9 element matrix or 3 element gain within [-4, 4]");
+    return ESP_FAIL;
+  }
+
+  if (calibration_save(zone, &calibration) != ESP_OK)
+  {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to store calibration");
+    return ESP_FAIL;
+  }
+
+  /* Hand the calibration to the light so the new output is visible immediately, it is stored either way */
+  uint32_t sequence = 0;
+  esp_err_t err = lights_submit_command(zone, create_set_calibration_command(&calibration), &sequence);
+  return send_submit_response(req, err, sequence);
+}
+
+/* Receives and flashes an OTA image, called by ota_handler */
+static esp_err_t ota_upload(httpd_req_t *req)
 {
   esp_err_t err;
   /* update handle : set by esp_ota_begin(), must be freed via esp_ota_end() */
@@ -240,6 +1147,15 @@ esp_err_t ota_handler(httpd_req_t *req)
   return ESP_OK;
 }
 
+/* Our URI handler function to be called during POST /uri request */
+esp_err_t ota_handler(httpd_req_t *req)
+{
+  __atomic_store_n(&ota_in_progress, true, __ATOMIC_RELAXED);
+  esp_err_t err = ota_upload(req);
+  __atomic_store_n(&ota_in_progress, false, __ATOMIC_RELAXED);
+  return err;
+}
+
 /* URI handler structure for root GET */
 httpd_uri_t uri_get = {
     .uri = "/",
@@ -254,6 +1170,83 @@ httpd_uri_t uri_post = {
     .handler = api_handler,
     .user_ctx = NULL};
 
+/* URI handler structure for GET /api/metrics */
+httpd_uri_t metrics_get = {
+    .uri = "/api/metrics",
+    .method = HTTP_GET,
+    .handler = metrics_handler,
+    .user_ctx = NULL};
+
+/* URI handler structure for GET /api/vehicle */
+httpd_uri_t vehicle_get = {
+    .uri = "/api/vehicle",
+    .method = HTTP_GET,
+    .handler = vehicle_handler,
+    .user_ctx = NULL};
+
+/* URI handler structure for GET /api/log */
+httpd_uri_t log_get = {
+    .uri = "/api/log",
+    .method = HTTP_GET,
+    .handler = log_get_handler,
+    .user_ctx = NULL};
+
+/* URI handler structure for GET /api/canstats */
+httpd_uri_t canstats_get = {
+    .uri = "/api/canstats",
+    .method = HTTP_GET,
+    .handler = canstats_handler,
+    .user_ctx = NULL};
+
+/* URI handler structures for GET and POST /api/capture */
+httpd_uri_t capture_get = {
+    .uri = "/api/capture",
+    .method = HTTP_GET,
+    .handler = capture_get_handler,
+    .user_ctx = NULL};
+
+httpd_uri_t capture_post = {
+    .uri = "/api/capture",
+    .method = HTTP_POST,
+    .handler = capture_post_handler,
+    .user_ctx = NULL};
+
+/* URI handler structure for GET /api/flightlog */
+httpd_uri_t flightlog_get = {
+    .uri = "/api/flightlog",
+    .method = HTTP_GET,
+    .handler = flightlog_get_handler,
+    .user_ctx = NULL};
+
+/* URI handler structure for POST /api/calibration */
+httpd_uri_t calibration_post = {
+    .uri = "/api/calibration",
+    .method = HTTP_POST,
+    .handler = calibration_handler,
+    .user_ctx = NULL};
+
+/* URI handler structure for POST /api/batch */
+httpd_uri_t batch_post = {
+    .uri = "/api/batch",
+    .method = HTTP_POST,
+    .handler = batch_handler,
+    .user_ctx = NULL};
+
+/* URI handler structure for POST /api/bin */
+httpd_uri_t bin_post = {
+    .uri = "/api/bin",
+    .method = HTTP_POST,
+    .handler = bin_handler,
+    .user_ctx = NULL};
+
+/* URI handler structure for the /ws WebSocket */
+httpd_uri_t ws_uri = {
+    .uri = "/ws",
+    .method = HTTP_GET,
+    .handler = ws_handler,
+    .user_ctx = NULL,
+    .is_websocket = true};
+
 /* URI handler structure for POST /ota */
 httpd_uri_t ota_post = {
     .uri = "/ota",
@@ -269,6 +1262,32 @@ httpd_handle_t start_webserver(void)
   config.task_priority = CONFIG_HTTP_SERVER_TASK_PRIORITY;
   config.core_id = CONFIG_HTTP_SERVER_TASK_CORE;
   config.stack_size = 4096;
+  config.max_uri_handlers = 16;
+  config.max_open_sockets = HTTP_SERVER_MAX_SOCKETS;
+
+  /* Every cJSON tree of a request comes from the arena and is released with it */
+  if (server_arena.buffer == NULL)
+  {
+    size_t arena_size = CONFIG_JSON_ARENA_SIZE_KB * 1024;
+    void *arena_buffer = malloc(arena_size);
+    if (arena_buffer == NULL)
+    {
+      ESP_LOGE(TAG, "Failed to allocate JSON arena");
+      return NULL;
+    }
+    json_arena_init(&server_arena, arena_buffer, arena_size);
+    json_arena_install();
+  }
+
+  const esp_timer_create_args_t ws_push_timer_args = {
+      .callback = ws_push_timer_callback,
+      .name = "ws_push",
+  };
+  if (ws_push_timer == NULL && esp_timer_create(&ws_push_timer_args, &ws_push_timer) != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to create WebSocket push timer");
+    return NULL;
+  }
 
   /* Empty handle to esp_http_server */
   httpd_handle_t server = NULL;
@@ -276,10 +1295,23 @@ httpd_handle_t start_webserver(void)
   /* Start the httpd server */
   if (httpd_start(&server, &config) == ESP_OK)
   {
+    server_handle = server;
+
     /* Register URI handlers */
     httpd_register_uri_handler(server, &uri_get);
     httpd_register_uri_handler(server, &uri_post);
     httpd_register_uri_handler(server, &ota_post);
+    httpd_register_uri_handler(server, &metrics_get);
+    httpd_register_uri_handler(server, &calibration_post);
+    httpd_register_uri_handler(server, &vehicle_get);
+    httpd_register_uri_handler(server, &capture_get);
+    httpd_register_uri_handler(server, &capture_post);
+    httpd_register_uri_handler(server, &flightlog_get);
+    httpd_register_uri_handler(server, &canstats_get);
+    httpd_register_uri_handler(server, &log_get);
+    httpd_register_uri_handler(server, &ws_uri);
+    httpd_register_uri_handler(server, &bin_post);
+    httpd_register_uri_handler(server, &batch_post);
   }
   /* If server failed to start, handle will be NULL */
   return server;
@@ -331,23 +1363,40 @@ void wifi_init_softap(void)
            ESP_WIFI_SSID, ESP_WIFI_PASS, ESP_WIFI_CHANNEL);
 }
 
-esp_err_t start_http_server_task()
+esp_err_t wifi_ap_suspend(void)
+{
+  esp_err_t err = esp_wifi_stop();
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to stop WiFi: %s", esp_err_to_name(err));
+  }
+  return err;
+}
+
+bool http_server_is_busy(void)
 {
-  /* Initialize NVS */
-  esp_err_t ret = nvs_flash_init();
-  if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
+  if (__atomic_load_n(&ota_in_progress, __ATOMIC_RELAXED))
   {
-    ESP_ERROR_CHECK(nvs_flash_erase());
-    ret = nvs_flash_init();
+    return true;
   }
+  size_t num_fds = HTTP_SERVER_MAX_SOCKETS;
+  int fds[HTTP_SERVER_MAX_SOCKETS];
+  return server_handle != NULL && httpd_get_client_list(server_handle, &num_fds, fds) == ESP_OK && num_fds > 0;
+}
 
-  if (ret != ESP_OK)
+esp_err_t wifi_ap_resume(void)
+{
+  esp_err_t err = esp_wifi_start();
+  if (err != ESP_OK)
   {
-    ESP_LOGE(TAG, "Failed to initialize NVS");
-    return ret;
+    ESP_LOGE(TAG, "Failed to restart WiFi: %s", esp_err_to_name(err));
   }
+  return err;
+}
 
-  /* Initialize AP */
+esp_err_t start_http_server_task()
+{
+  /* Initialize AP (NVS is initialized by app_main) */
   ESP_LOGI(TAG, "Initializing AP mode...");
   wifi_init_softap();
 
@@ -358,5 +1407,11 @@ esp_err_t start_http_server_task()
     return ESP_FAIL;
   }
 
+  /* Same packets as /api/bin over UDP, for scripted control without HTTP overhead */
+  if (binary_control_start_udp() != ESP_OK)
+  {
+    return ESP_FAIL;
+  }
+
   return ESP_OK;
 }
\ No newline at end of file
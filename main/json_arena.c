@@ -0,0 +1,104 @@
+#include <stdlib.h>
+
+#include "json_arena.h"
+#include "../libraries/cJson.h"
+
+/* Allocations are aligned for the doubles in cJSON nodes */
+#define ARENA_ALIGNMENT 8
+
+/* Spill header, padded so the block behind it stays aligned */
+#define SPILL_HEADER_SIZE ((sizeof(json_arena_spill_t) + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1))
+
+/* Arena of the calling task, NULL outside of json_arena_begin/json_arena_end */
+static _Thread_local json_arena_t *current_arena = NULL;
+
+static void *arena_malloc(size_t size) {
+  json_arena_t *arena = current_arena;
+  if (arena == NULL) {
+    return malloc(size);
+  }
+
+  size_t aligned = (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+  if (aligned <= arena->size - arena->used) {
+    void *block = arena->buffer + arena->used;
+    arena->used += aligned;
+    return block;
+  }
+
+  json_arena_spill_t *spill = malloc(SPILL_HEADER_SIZE + size);
+  if (spill == NULL) {
+    return NULL;
+  }
+  spill->next = arena->spills;
+  arena->spills = spill;
+  arena->spilled += size;
+  return (uint8_t *) spill + SPILL_HEADER_SIZE;
+}
+
+static bool owned_by(const json_arena_t *arena, const void *pointer) {
+  const uint8_t *block = pointer;
+  if (block >= arena->buffer && block < arena->buffer + arena->size) {
+    return true;
+  }
+  for (const json_arena_spill_t *spill = arena->spills; spill != NULL; spill = spill->next) {
+    if (block == (const uint8_t *) spill + SPILL_HEADER_SIZE) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void arena_free(void *pointer) {
+  /* Blocks of the current request go away with it, blocks allocated outside of it are real heap blocks */
+  json_arena_t *arena = current_arena;
+  if (pointer == NULL || (arena != NULL && owned_by(arena, pointer))) {
+    return;
+  }
+  free(pointer);
+}
+
+void json_arena_init(json_arena_t *arena, void *buffer, size_t size) {
+  *arena = (json_arena_t) {
+    .buffer = buffer,
+    .size = size,
+  };
+}
+
+void json_arena_install(void) {
+  cJSON_Hooks hooks = {arena_malloc, arena_free};
+  cJSON_InitHooks(&hooks);
+}
+
+void json_arena_begin(json_arena_t *arena) {
+  arena->used = 0;
+  arena->spills = NULL;
+  arena->spilled = 0;
+  current_arena = arena;
+}
+
+void json_arena_end(void) {
+  json_arena_t *arena = current_arena;
+  if (arena == NULL) {
+    return;
+  }
+  current_arena = NULL;
+
+  arena->requests++;
+  if (arena->used > arena->high_water) {
+    arena->high_water = arena->used;
+  }
+  if (arena->spills != NULL) {
+    arena->spilled_requests++;
+    if (arena->spilled > arena->max_spilled) {
+      arena->max_spilled = arena->spilled;
+    }
+  }
+
+  while (arena->spills != NULL) {
+    json_arena_spill_t *next = arena->spills->next;
+    free(arena->spills);
+    arena->spills = next;
+  }
+  arena->used = 0;
+  arena->spilled = 0;
+}
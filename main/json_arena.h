@@ -0,0 +1,56 @@
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+/**
+ * Per-request bump allocator for cJSON. Once json_arena_install has replaced cJSON's allocation
+ * hooks, a task that begins an arena gets every cJSON node, string and print buffer carved out of
+ * it, and frees do nothing. Ending the arena releases the whole request in O(1), without walking
+ * the tree or fragmenting the heap. The current arena is thread local, so tasks using cJSON at the
+ * same time each need their own arena; tasks without one keep using the heap. Requests that do
+ * not fit spill over to the heap and the spilled blocks are released along with the arena. Only
+ * depends on the C standard library.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Heap block taken once the arena is full, released by json_arena_end */
+typedef struct json_arena_spill_t {
+  struct json_arena_spill_t *next;
+} json_arena_spill_t;
+
+typedef struct {
+  uint8_t *buffer;
+  size_t size;
+  size_t used;
+  json_arena_spill_t *spills;
+  size_t spilled;            /* Bytes spilled over to the heap by the current request */
+  /* Statistics over all requests */
+  uint32_t requests;
+  size_t high_water;         /* Most arena bytes used by a request */
+  uint32_t spilled_requests; /* Requests that did not fit the arena */
+  size_t max_spilled;        /* Most bytes a request spilled over to the heap */
+} json_arena_t;
+
+/**
+ * @brief Sets up an arena on a caller provided buffer.
+ */
+void json_arena_init(json_arena_t *arena, void *buffer, size_t size);
+
+/**
+ * @brief Installs the allocation hooks into cJSON, once before any arena is used.
+ */
+void json_arena_install(void);
+
+/**
+ * @brief Makes the arena the calling task's cJSON allocator until json_arena_end.
+ */
+void json_arena_begin(json_arena_t *arena);
+
+/**
+ * @brief Releases everything cJSON allocated since json_arena_begin, trees and printed strings
+ *        must not be used afterwards. The calling task goes back to the heap.
+ */
+void json_arena_end(void);
+
+#endif
@@ -0,0 +1,64 @@
+#include "latency_histogram.h"
+
+static portMUX_TYPE histogram_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+static uint32_t count = 0;
+static uint32_t max_us = 0;
+static uint64_t sum_us = 0;
+
+static inline int bucket_of(uint32_t latency_us) {
+  int bucket = (latency_us == 0) ? 0 : 32 - __builtin_clz(latency_us);
+  return (bucket < LATENCY_HISTOGRAM_BUCKETS) ? bucket : LATENCY_HISTOGRAM_BUCKETS - 1;
+}
+
+void latency_histogram_record(uint32_t latency_us) {
+  int bucket = bucket_of(latency_us);
+
+  taskENTER_CRITICAL(&histogram_lock);
+  buckets[bucket]++;
+  count++;
+  sum_us += latency_us;
+  if (latency_us > max_us) {
+    max_us = latency_us;
+  }
+  taskEXIT_CRITICAL(&histogram_lock);
+}
+
+/* Latency below which the given share (per mille) of the samples lies */
+static uint32_t percentile(const latency_metrics_t *metrics, uint32_t per_mille) {
+  uint64_t rank = ((uint64_t) metrics->count * per_mille + 999) / 1000;
+  uint64_t seen = 0;
+  for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+    if (seen + metrics->buckets[i] >= rank) {
+      uint32_t low = (i == 0) ? 0 : (1u << (i - 1));
+      uint32_t width = (i == 0) ? 1 : low;
+      uint32_t value = low + (uint32_t) (((rank - seen) * width) / metrics->buckets[i]);
+      return (value < metrics->max_us) ? value : metrics->max_us;
+    }
+    seen += metrics->buckets[i];
+  }
+  return metrics->max_us;
+}
+
+void latency_histogram_get_metrics(latency_metrics_t *metrics) {
+  taskENTER_CRITICAL(&histogram_lock);
+  memcpy(metrics->buckets, buckets, sizeof(buckets));
+  metrics->count = count;
+  metrics->max_us = max_us;
+  uint64_t sum = sum_us;
+  taskEXIT_CRITICAL(&histogram_lock);
+
+  metrics->mean_us = (metrics->count > 0) ? (uint32_t) (sum / metrics->count) : 0;
+  metrics->p50_us = (metrics->count > 0) ? percentile(metrics, 500) : 0;
+  metrics->p99_us = (metrics->count > 0) ? percentile(metrics, 990) : 0;
+}
+
+void latency_histogram_reset(void) {
+  taskENTER_CRITICAL(&histogram_lock);
+  memset(buckets, 0, sizeof(buckets));
+  count = 0;
+  max_us = 0;
+  sum_us = 0;
+  taskEXIT_CRITICAL(&histogram_lock);
+}
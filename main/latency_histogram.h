@@ -0,0 +1,39 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include "main_common.h"
+
+/* Number of power-of-two buckets, the last one collects every latency of 2^31 us and more */
+#define LATENCY_HISTOGRAM_BUCKETS 32
+
+typedef struct {
+  uint32_t count;   /* Number of recorded latencies */
+  uint32_t p50_us;  /* Median */
+  uint32_t p99_us;  /* 99th percentile */
+  uint32_t max_us;  /* Largest recorded latency */
+  uint32_t mean_us; /* Average latency */
+  uint32_t buckets[LATENCY_HISTOGRAM_BUCKETS]; /* Bucket n counts latencies in [2^(n-1), 2^n) us */
+} latency_metrics_t;
+
+/**
+ * @brief Records the CAN-to-LED latency of a command, i.e. the time from the reception of the CAN
+ *        frame that caused the command to the end of the first strip refresh that reflects it.
+ *
+ * @param latency_us Latency in microseconds.
+ */
+void latency_histogram_record(uint32_t latency_us);
+
+/**
+ * @brief Copies a snapshot of the histogram along with its percentiles.
+ *
+ * Percentiles are interpolated linearly within their bucket, so they are exact to within the
+ * bucket width (a factor of two).
+ */
+void latency_histogram_get_metrics(latency_metrics_t *metrics);
+
+/**
+ * @brief Clears the histogram.
+ */
+void latency_histogram_reset(void);
+
+#endif
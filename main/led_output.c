@@ -0,0 +1,254 @@
+#include "esp_heap_caps.h"
+
+#include "led_output.h"
+#include "framebuffer.h"
+
+/* APA102 frames: 32 zero bits to start, 32 bits per LED, and at least n / 2 extra clock edges to
+ * push the data through the chain. The end frame is sent as zeros, which SK9822 strips also need */
+#define APA102_START_FRAME_BYTES 4
+#define APA102_END_FRAME_BYTES(num_leds) (4 + (((num_leds) + 15) / 16))
+#define APA102_LED_HEADER 0xE0
+#define APA102_MAX_GLOBAL_BRIGHTNESS 31
+#define APA102_CLOCK_HZ (4 * 1000 * 1000)
+
+static const char *TAG = "led_output";
+
+#if CONFIG_LED_GAMMA_CORRECTION
+/* Gamma 2.2 correction table, maps perceptual 8-bit channel values to LED PWM duty */
+static const uint8_t gamma_table[256] = {
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,
+    1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+    3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+    6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+   12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+   20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+   30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+   42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+   56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+   73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+   91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+  113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+  137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+  163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+  192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+  223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255
+};
+#endif
+
+/* LED level of a calibrated channel value at full brightness */
+static inline uint8_t gamma_level(uint8_t value) {
+#if CONFIG_LED_GAMMA_CORRECTION
+  return gamma_table[value];
+#else
+  return value;
+#endif
+}
+
+static void build_lut(led_output_t *output, uint16_t scale) {
+  for (int i = 0; i < 256; i++) {
+    output->lut[i] = (gamma_level(i) * scale) >> 8;
+  }
+}
+
+static inline uint8_t clamp_channel(int32_t value) {
+  return (value < 0) ? 0 : ((value > 255) ? 255 : value);
+}
+
+/* Calibration matrix, clamped to the range of the output table */
+static inline rgb_t calibrate_pixel(const color_calibration_t *calibration, rgb_t pixel) {
+  const int16_t (*m)[3] = calibration->matrix;
+  int32_t red   = (m[0][0] * pixel.red + m[0][1] * pixel.green + m[0][2] * pixel.blue) >> 8;
+  int32_t green = (m[1][0] * pixel.red + m[1][1] * pixel.green + m[1][2] * pixel.blue) >> 8;
+  int32_t blue  = (m[2][0] * pixel.red + m[2][1] * pixel.green + m[2][2] * pixel.blue) >> 8;
+  return (rgb_t) {clamp_channel(red), clamp_channel(green), clamp_channel(blue)};
+}
+
+/* Calibration matrix followed by the fused gamma/brightness table, shared by every pixel format */
+static inline rgb_t transform_pixel(const led_output_t *output, const color_calibration_t *calibration, rgb_t pixel) {
+  rgb_t calibrated = calibrate_pixel(calibration, pixel);
+  return (rgb_t) {
+    output->lut[calibrated.red],
+    output->lut[calibrated.green],
+    output->lut[calibrated.blue],
+  };
+}
+
+rgb_t led_output_pixel_levels(const color_calibration_t *calibration, rgb_t pixel) {
+  rgb_t calibrated = calibrate_pixel(calibration, pixel);
+  return (rgb_t) {gamma_level(calibrated.red), gamma_level(calibrated.green), gamma_level(calibrated.blue)};
+}
+
+channel_sums_t led_output_frame_levels(const uint32_t *frame, int num_leds, const color_calibration_t *calibration) {
+  channel_sums_t sums = {0, 0, 0};
+  for (int i = 0; i < num_leds; i++) {
+    rgb_t levels = led_output_pixel_levels(calibration, framebuffer_get_pixel(frame, i));
+    sums.red += levels.red;
+    sums.green += levels.green;
+    sums.blue += levels.blue;
+  }
+  return sums;
+}
+
+/* =========================
+ *      WS2812 (GRB, RMT)
+ * ========================= */
+static inline void ws2812_pack(led_output_t *output, int index, rgb_t pixel) {
+  led_strip_set_pixel(output->led_strip, index, pixel.red, pixel.green, pixel.blue);
+}
+
+static void ws2812_write_frame(led_output_t *output, const uint32_t *frame, const color_calibration_t *calibration) {
+  for (int i = 0; i < output->num_leds; i++) {
+    ws2812_pack(output, i, transform_pixel(output, calibration, framebuffer_get_pixel(frame, i)));
+  }
+}
+
+static void ws2812_write_pixel(led_output_t *output, int index, rgb_t pixel, const color_calibration_t *calibration) {
+  ws2812_pack(output, index, transform_pixel(output, calibration, pixel));
+}
+
+static esp_err_t led_strip_output_refresh(led_output_t *output) {
+  return led_strip_refresh(output->led_strip);
+}
+
+static const led_output_ops_t ws2812_ops = {
+  .write_frame = ws2812_write_frame,
+  .write_pixel = ws2812_write_pixel,
+  .refresh = led_strip_output_refresh,
+};
+
+/* =========================
+ *    SK6812 (GRBW, RMT)
+ * ========================= */
+static inline void sk6812_rgbw_pack(led_output_t *output, int index, rgb_t pixel) {
+  /* Move the common part of the three channels to the white LED */
+  uint8_t white = pixel.red < pixel.green ? pixel.red : pixel.green;
+  white = white < pixel.blue ? white : pixel.blue;
+  led_strip_set_pixel_rgbw(output->led_strip, index, pixel.red - white, pixel.green - white, pixel.blue - white, white);
+}
+
+static void sk6812_rgbw_write_frame(led_output_t *output, const uint32_t *frame, const color_calibration_t *calibration) {
+  for (int i = 0; i < output->num_leds; i++) {
+    sk6812_rgbw_pack(output, i, transform_pixel(output, calibration, framebuffer_get_pixel(frame, i)));
+  }
+}
+
+static void sk6812_rgbw_write_pixel(led_output_t *output, int index, rgb_t pixel, const color_calibration_t *calibration) {
+  sk6812_rgbw_pack(output, index, transform_pixel(output, calibration, pixel));
+}
+
+static const led_output_ops_t sk6812_rgbw_ops = {
+  .write_frame = sk6812_rgbw_write_frame,
+  .write_pixel = sk6812_rgbw_write_pixel,
+  .refresh = led_strip_output_refresh,
+};
+
+/* =========================
+ *   APA102/SK9822 (SPI)
+ * ========================= */
+static inline void apa102_pack(led_output_t *output, int index, rgb_t pixel) {
+  uint8_t *led = output->spi_buffer + APA102_START_FRAME_BYTES + (index * 4);
+  led[0] = APA102_LED_HEADER | output->global_brightness;
+  led[1] = pixel.blue;
+  led[2] = pixel.green;
+  led[3] = pixel.red;
+}
+
+static void apa102_write_frame(led_output_t *output, const uint32_t *frame, const color_calibration_t *calibration) {
+  for (int i = 0; i < output->num_leds; i++) {
+    apa102_pack(output, i, transform_pixel(output, calibration, framebuffer_get_pixel(frame, i)));
+  }
+}
+
+static void apa102_write_pixel(led_output_t *output, int index, rgb_t pixel, const color_calibration_t *calibration) {
+  apa102_pack(output, index, transform_pixel(output, calibration, pixel));
+}
+
+static esp_err_t apa102_refresh(led_output_t *output) {
+  spi_transaction_t transaction = {
+    .length = output->spi_length * 8,
+    .tx_buffer = output->spi_buffer,
+  };
+  return spi_device_transmit(output->spi, &transaction);
+}
+
+static const led_output_ops_t apa102_ops = {
+  .write_frame = apa102_write_frame,
+  .write_pixel = apa102_write_pixel,
+  .refresh = apa102_refresh,
+};
+
+static esp_err_t apa102_init(led_output_t *output, const ambient_light_t *light, int zone) {
+  /* Each APA102 zone drives its own clock and data lines, so each one needs its own SPI bus */
+  spi_host_device_t host = (zone == 0) ? SPI2_HOST : SPI3_HOST;
+  output->spi_length = APA102_START_FRAME_BYTES + (output->num_leds * 4) + APA102_END_FRAME_BYTES(output->num_leds);
+  output->spi_buffer = heap_caps_calloc(1, output->spi_length, MALLOC_CAP_DMA);
+  if (output->spi_buffer == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  spi_bus_config_t bus_config = {
+    .mosi_io_num = light->strip_config.strip_gpio_num,
+    .miso_io_num = -1,
+    .sclk_io_num = light->clock_gpio_num,
+    .quadwp_io_num = -1,
+    .quadhd_io_num = -1,
+    .max_transfer_sz = output->spi_length,
+  };
+  ESP_RETURN_ON_ERROR(spi_bus_initialize(host, &bus_config, SPI_DMA_CH_AUTO), TAG, "Failed to initialize SPI bus");
+
+  spi_device_interface_config_t device_config = {
+    .mode = 0,
+    .clock_speed_hz = APA102_CLOCK_HZ,
+    .spics_io_num = -1,
+    .queue_size = 1,
+  };
+  ESP_RETURN_ON_ERROR(spi_bus_add_device(host, &device_config, &output->spi), TAG, "Failed to add SPI device");
+
+  /* Start with every LED off */
+  for (int i = 0; i < output->num_leds; i++) {
+    apa102_pack(output, i, COLOR_OFF);
+  }
+  return apa102_refresh(output);
+}
+
+esp_err_t led_output_init(led_output_t *output, const ambient_light_t *light, int zone) {
+  output->num_leds = light->strip_config.max_leds;
+  output->global_brightness = APA102_MAX_GLOBAL_BRIGHTNESS;
+  output->lut_scale = 256;
+  build_lut(output, output->lut_scale);
+
+  switch (light->led_type) {
+    case LED_TYPE_APA102:
+      output->ops = &apa102_ops;
+      return apa102_init(output, light, zone);
+    case LED_TYPE_SK6812_RGBW:
+      output->ops = &sk6812_rgbw_ops;
+      break;
+    case LED_TYPE_WS2812:
+    default:
+      output->ops = &ws2812_ops;
+      break;
+  }
+
+  ESP_RETURN_ON_ERROR(led_strip_new_rmt_device(&light->strip_config, &light->rmt_config, &output->led_strip),
+                      TAG, "Failed to create LED strip");
+  return led_strip_clear(output->led_strip);
+}
+
+void led_output_set_scale(led_output_t *output, uint16_t scale) {
+  if (scale == output->lut_scale) {
+    return;
+  }
+  output->lut_scale = scale;
+
+  if (output->ops == &apa102_ops) {
+    /* Smallest global brightness that still covers the scale, the table provides the remainder */
+    uint8_t global_brightness = ((scale * APA102_MAX_GLOBAL_BRIGHTNESS) + 255) >> 8;
+    if (global_brightness == 0) {
+      global_brightness = 1;
+    }
+    output->global_brightness = global_brightness;
+    scale = (scale * APA102_MAX_GLOBAL_BRIGHTNESS) / global_brightness;
+  }
+  build_lut(output, scale);
+}
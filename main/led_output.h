@@ -0,0 +1,62 @@
+#ifndef LED_OUTPUT_H
+#define LED_OUTPUT_H
+
+#include "main_common.h"
+#include "framebuffer.h"
+
+/**
+ * The output stage turns a light's framebuffer into LED data in a single pass per frame:
+ * calibration matrix, then one table fusing gamma correction and brightness, then the pixel
+ * format of the strip (GRB for WS2812, GRBW with white extraction for SK6812, and SPI frames
+ * with global brightness bits for APA102/SK9822).
+ */
+
+/**
+ * @brief Creates the LED device of a zone and selects its pixel format routines.
+ *
+ * @param[out] output   Output to initialize.
+ * @param[in]  light    Light whose strip configuration, LED type and clock GPIO are used.
+ * @param[in]  zone     Zone index, used to pick the SPI host of APA102 strips.
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if buffers cannot be allocated, or the driver error code.
+ */
+esp_err_t led_output_init(led_output_t *output, const ambient_light_t *light, int zone);
+
+/**
+ * @brief Sets the brightness scale (Q8, 256 = full) used by the following frames.
+ *
+ * The output table is only rebuilt when the scale changes. APA102 strips move as much of the
+ * scale as possible into their 5-bit global brightness, keeping more of the 8-bit range for color.
+ */
+void led_output_set_scale(led_output_t *output, uint16_t scale);
+
+/**
+ * @brief Returns the levels a pixel drives its LEDs at before the brightness scale: calibrated,
+ *        clamped and gamma corrected exactly as the output pass does.
+ */
+rgb_t led_output_pixel_levels(const color_calibration_t *calibration, rgb_t pixel);
+
+/**
+ * @brief Sums the levels (see led_output_pixel_levels) of every pixel of a framebuffer.
+ *
+ * The LED current follows these levels rather than the framebuffer values, which gamma
+ * correction maps well below their linear share (128 drives at 56 of 255).
+ */
+channel_sums_t led_output_frame_levels(const uint32_t *frame, int num_leds, const color_calibration_t *calibration);
+
+/**
+ * @brief Writes a whole framebuffer to the strip and refreshes it.
+ */
+static inline esp_err_t led_output_show_frame(led_output_t *output, const uint32_t *frame, const color_calibration_t *calibration) {
+  output->ops->write_frame(output, frame, calibration);
+  return output->ops->refresh(output);
+}
+
+/**
+ * @brief Writes a single pixel to the strip and refreshes it.
+ */
+static inline esp_err_t led_output_show_pixel(led_output_t *output, int index, rgb_t pixel, const color_calibration_t *calibration) {
+  output->ops->write_pixel(output, index, pixel, calibration);
+  return output->ops->refresh(output);
+}
+
+#endif
@@ -0,0 +1,172 @@
+#include <string.h>
+
+#include "light_protocol.h"
+
+/* Length of each message, 0 for unknown opcodes */
+static const uint8_t message_lengths[256] = {
+#define LIGHT_PROTOCOL_LENGTH_ENTRY(name, opcode, length) [opcode] = length,
+  LIGHT_PROTOCOL_MESSAGE_TABLE(LIGHT_PROTOCOL_LENGTH_ENTRY)
+#undef LIGHT_PROTOCOL_LENGTH_ENTRY
+};
+
+#define LIGHT_PROTOCOL_LENGTH_CHECK(name, opcode, length) \
+  _Static_assert(length <= LIGHT_PROTOCOL_MAX_MESSAGE_LENGTH, #name " messages must fit LIGHT_PROTOCOL_MAX_PACKET");
+LIGHT_PROTOCOL_MESSAGE_TABLE(LIGHT_PROTOCOL_LENGTH_CHECK)
+#undef LIGHT_PROTOCOL_LENGTH_CHECK
+
+size_t light_protocol_decode(const uint8_t *data, size_t length, light_message_t *message) {
+  if (length == 0) {
+    return 0;
+  }
+  size_t message_length = message_lengths[data[0]];
+  if (message_length == 0 || length < message_length) {
+    return 0;
+  }
+
+  memset(message, 0, sizeof(*message));
+  message->opcode = data[0];
+  message->zone_mask = data[1];
+  message->red = data[2];
+  message->green = data[3];
+  message->blue = data[4];
+  switch (message->opcode) {
+    case LIGHT_MESSAGE_SET_COLOR:
+      break;
+    case LIGHT_MESSAGE_FADE_TO:
+      message->duration_ms = data[5] | (data[6] << 8);
+      break;
+    case LIGHT_MESSAGE_SEQUENTIAL:
+      message->flags = data[5];
+      break;
+    case LIGHT_MESSAGE_EFFECT:
+      if (data[5] >= LIGHT_EFFECT_COUNT) {
+        return 0;
+      }
+      message->effect = data[5];
+      message->duration_ms = data[6] | (data[7] << 8);
+      break;
+  }
+  return message_length;
+}
+
+light_packet_status_t light_protocol_parse_packet(const uint8_t *data, size_t length, light_packet_t *packet) {
+  if (length < LIGHT_PROTOCOL_HEADER_LENGTH) {
+    return LIGHT_PACKET_TRUNCATED;
+  }
+  if (data[0] != LIGHT_PROTOCOL_MAGIC_0 || data[1] != LIGHT_PROTOCOL_MAGIC_1) {
+    return LIGHT_PACKET_BAD_MAGIC;
+  }
+  if (data[2] != LIGHT_PROTOCOL_VERSION) {
+    return LIGHT_PACKET_BAD_VERSION;
+  }
+
+  /* Walk the messages once so a bad one rejects the whole packet before anything is applied */
+  const uint8_t *messages = data + LIGHT_PROTOCOL_HEADER_LENGTH;
+  size_t remaining = length - LIGHT_PROTOCOL_HEADER_LENGTH;
+  size_t offset = 0;
+  for (int i = 0; i < data[3]; i++) {
+    if (offset == remaining) {
+      return LIGHT_PACKET_TRUNCATED;
+    }
+    size_t message_length = message_lengths[messages[offset]];
+    if (message_length == 0) {
+      return LIGHT_PACKET_BAD_MESSAGE;
+    }
+    if (remaining - offset < message_length) {
+      return LIGHT_PACKET_TRUNCATED;
+    }
+    light_message_t message;
+    if (light_protocol_decode(messages + offset, remaining - offset, &message) == 0) {
+      return LIGHT_PACKET_BAD_MESSAGE;
+    }
+    offset += message_length;
+  }
+  if (offset != remaining) {
+    return LIGHT_PACKET_TRAILING;
+  }
+
+  packet->num_messages = data[3];
+  packet->messages = messages;
+  packet->length = remaining;
+  return LIGHT_PACKET_OK;
+}
+
+size_t light_protocol_encode_header(uint8_t num_messages, uint8_t *buffer, size_t size) {
+  if (size < LIGHT_PROTOCOL_HEADER_LENGTH) {
+    return 0;
+  }
+  buffer[0] = LIGHT_PROTOCOL_MAGIC_0;
+  buffer[1] = LIGHT_PROTOCOL_MAGIC_1;
+  buffer[2] = LIGHT_PROTOCOL_VERSION;
+  buffer[3] = num_messages;
+  return LIGHT_PROTOCOL_HEADER_LENGTH;
+}
+
+size_t light_protocol_encode(const light_message_t *message, uint8_t *buffer, size_t size) {
+  size_t message_length = message_lengths[message->opcode & 0xFF];
+  if (message_length == 0 || size < message_length) {
+    return 0;
+  }
+
+  buffer[0] = message->opcode;
+  buffer[1] = message->zone_mask;
+  buffer[2] = message->red;
+  buffer[3] = message->green;
+  buffer[4] = message->blue;
+  switch (message->opcode) {
+    case LIGHT_MESSAGE_SET_COLOR:
+      break;
+    case LIGHT_MESSAGE_FADE_TO:
+      buffer[5] = message->duration_ms & 0xFF;
+      buffer[6] = message->duration_ms >> 8;
+      break;
+    case LIGHT_MESSAGE_SEQUENTIAL:
+      buffer[5] = message->flags;
+      break;
+    case LIGHT_MESSAGE_EFFECT:
+      buffer[5] = message->effect;
+      buffer[6] = message->duration_ms & 0xFF;
+      buffer[7] = message->duration_ms >> 8;
+      break;
+  }
+  return message_length;
+}
+
+size_t light_protocol_encode_ack(light_packet_status_t status, uint8_t accepted, uint8_t dropped, uint32_t sequence,
+                                 uint8_t *buffer, size_t size) {
+  if (size < LIGHT_PROTOCOL_ACK_LENGTH) {
+    return 0;
+  }
+  buffer[0] = LIGHT_PROTOCOL_MAGIC_0;
+  buffer[1] = LIGHT_PROTOCOL_MAGIC_1;
+  buffer[2] = LIGHT_PROTOCOL_VERSION;
+  buffer[3] = LIGHT_PROTOCOL_ACK;
+  buffer[4] = status;
+  buffer[5] = accepted;
+  buffer[6] = dropped;
+  for (int i = 0; i < 4; i++) {
+    buffer[7 + i] = (sequence >> (8 * i)) & 0xFF;
+  }
+  return LIGHT_PROTOCOL_ACK_LENGTH;
+}
+
+size_t light_protocol_encode_state(const light_zone_report_t *zones, uint8_t num_zones, uint16_t master_brightness,
+                                   uint8_t *buffer, size_t size) {
+  size_t length = LIGHT_PROTOCOL_STATE_HEADER_LENGTH + num_zones * LIGHT_PROTOCOL_ZONE_REPORT_LENGTH;
+  if (size < length) {
+    return 0;
+  }
+
+  buffer[0] = LIGHT_PROTOCOL_STATE;
+  buffer[1] = num_zones;
+  buffer[2] = master_brightness & 0xFF;
+  buffer[3] = master_brightness >> 8;
+  uint8_t *report = buffer + LIGHT_PROTOCOL_STATE_HEADER_LENGTH;
+  for (int i = 0; i < num_zones; i++, report += LIGHT_PROTOCOL_ZONE_REPORT_LENGTH) {
+    report[0] = zones[i].state;
+    report[1] = zones[i].red;
+    report[2] = zones[i].green;
+    report[3] = zones[i].blue;
+  }
+  return length;
+}
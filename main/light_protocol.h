@@ -0,0 +1,161 @@
+#ifndef LIGHT_PROTOCOL_H
+#define LIGHT_PROTOCOL_H
+
+/**
+ * Compact binary light control messages. A message is an opcode byte, a zone mask (bit n selects
+ * light n) and a fixed length payload that depends on the opcode, so a color change costs 5 bytes
+ * instead of an HTTP request. The WebSocket control channel carries messages back to back in each
+ * frame. /api/bin and UDP carry versioned packets: a header with the message count followed by
+ * the messages, answered by an acknowledgement. State reports go the other way. Multi-byte fields
+ * are little endian. Decoding reads the received buffer in place, bounds checked against its
+ * length. Only depends on the C standard library.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Message table, the length includes the opcode and zone mask (at most LIGHT_PROTOCOL_MAX_MESSAGE_LENGTH) */
+#define LIGHT_PROTOCOL_MESSAGE_TABLE(X) \
+  /* name        opcode  length  payload */ \
+  X(SET_COLOR,   0x01,   5)      /* red, green, blue */ \
+  X(FADE_TO,     0x02,   7)      /* red, green, blue, duration in ms (uint16, 0 for the default) */ \
+  X(SEQUENTIAL,  0x03,   6)      /* red, green, blue, flags (LIGHT_PROTOCOL_FLAG_*) */ \
+  X(EFFECT,      0x04,   8)      /* red, green, blue, effect ID (light_effect_t), step delay in ms (uint16, 0 for the default) */
+
+/* Effect table of EFFECT messages */
+#define LIGHT_PROTOCOL_EFFECT_TABLE(X) \
+  /* name                 ID    */ \
+  X(SEQUENTIAL,           0)    /* Fill LED by LED from the first one */ \
+  X(SEQUENTIAL_REVERSE,   1)    /* Fill LED by LED from the last one */ \
+  X(STARTUP,              2)    /* Fill the selected zones one after the other in zone order, as when the car wakes up */
+
+typedef enum {
+#define LIGHT_PROTOCOL_OPCODE_ENUM(name, opcode, length) LIGHT_MESSAGE_##name = opcode,
+  LIGHT_PROTOCOL_MESSAGE_TABLE(LIGHT_PROTOCOL_OPCODE_ENUM)
+#undef LIGHT_PROTOCOL_OPCODE_ENUM
+} light_message_opcode_t;
+
+typedef enum {
+#define LIGHT_PROTOCOL_EFFECT_ENUM(name, id) LIGHT_EFFECT_##name = id,
+  LIGHT_PROTOCOL_EFFECT_TABLE(LIGHT_PROTOCOL_EFFECT_ENUM)
+#undef LIGHT_PROTOCOL_EFFECT_ENUM
+  LIGHT_EFFECT_COUNT
+} light_effect_t;
+
+/* Sequential fill starting from the last LED */
+#define LIGHT_PROTOCOL_FLAG_REVERSE 0x01
+
+/**
+ * State report, sent by the device: opcode, number of zones, master brightness (uint16, Q8),
+ * followed by a LIGHT_PROTOCOL_ZONE_REPORT_LENGTH byte report per zone (LightState, red, green, blue).
+ */
+#define LIGHT_PROTOCOL_STATE 0x80
+#define LIGHT_PROTOCOL_STATE_HEADER_LENGTH 4
+#define LIGHT_PROTOCOL_ZONE_REPORT_LENGTH 4
+
+/**
+ * Packet header of /api/bin and UDP: magic "LC", version, message count, followed by exactly that
+ * many messages. Packets are validated as a whole before any message is applied.
+ */
+#define LIGHT_PROTOCOL_MAGIC_0 'L'
+#define LIGHT_PROTOCOL_MAGIC_1 'C'
+#define LIGHT_PROTOCOL_VERSION 1
+#define LIGHT_PROTOCOL_HEADER_LENGTH 4
+#define LIGHT_PROTOCOL_MAX_MESSAGE_LENGTH 8
+#define LIGHT_PROTOCOL_MAX_PACKET (LIGHT_PROTOCOL_HEADER_LENGTH + 255 * LIGHT_PROTOCOL_MAX_MESSAGE_LENGTH)
+
+/**
+ * Acknowledgement of a packet: magic, version, LIGHT_PROTOCOL_ACK, status (light_packet_status_t),
+ * messages applied, commands dropped because a light was saturated, sequence number (uint32) the
+ * lights report once the packet's commands are applied (see /api/metrics).
+ */
+#define LIGHT_PROTOCOL_ACK 0x81
+#define LIGHT_PROTOCOL_ACK_LENGTH 11
+
+typedef enum {
+  LIGHT_PACKET_OK,
+  LIGHT_PACKET_TRUNCATED,   /* Shorter than its header or its messages */
+  LIGHT_PACKET_BAD_MAGIC,
+  LIGHT_PACKET_BAD_VERSION,
+  LIGHT_PACKET_BAD_MESSAGE, /* Unknown opcode or effect */
+  LIGHT_PACKET_TRAILING,    /* Bytes after the last message */
+} light_packet_status_t;
+
+/* Decoded message, fields not carried by the opcode are zero */
+typedef struct {
+  light_message_opcode_t opcode;
+  uint8_t zone_mask;
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+  uint8_t flags;
+  uint8_t effect;       /* light_effect_t */
+  uint16_t duration_ms; /* Fade duration, or step delay of an effect */
+} light_message_t;
+
+/* Validated packet, the messages still point into the received buffer */
+typedef struct {
+  uint8_t num_messages;
+  const uint8_t *messages;
+  size_t length; /* Length of the messages */
+} light_packet_t;
+
+typedef struct {
+  uint8_t state; /* LightState */
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+} light_zone_report_t;
+
+/**
+ * @brief Decodes the message at the start of a buffer.
+ *
+ * @param data   Received bytes.
+ * @param length Number of received bytes.
+ * @return Length of the decoded message, or 0 if the opcode is unknown or the message is truncated.
+ */
+size_t light_protocol_decode(const uint8_t *data, size_t length, light_message_t *message);
+
+/**
+ * @brief Validates a packet and every message in it, without copying.
+ *
+ * @param data   Received packet.
+ * @param length Length of the packet.
+ * @param packet Set to the packet's messages, decode them with light_protocol_decode.
+ */
+light_packet_status_t light_protocol_parse_packet(const uint8_t *data, size_t length, light_packet_t *packet);
+
+/**
+ * @brief Encodes a packet header for num_messages messages.
+ *
+ * @return LIGHT_PROTOCOL_HEADER_LENGTH, or 0 if the buffer is too small.
+ */
+size_t light_protocol_encode_header(uint8_t num_messages, uint8_t *buffer, size_t size);
+
+/**
+ * @brief Encodes a message, the counterpart of light_protocol_decode.
+ *
+ * @return Length of the message, or 0 if the opcode is unknown or the buffer is too small.
+ */
+size_t light_protocol_encode(const light_message_t *message, uint8_t *buffer, size_t size);
+
+/**
+ * @brief Encodes the acknowledgement of a packet.
+ *
+ * @return LIGHT_PROTOCOL_ACK_LENGTH, or 0 if the buffer is too small.
+ */
+size_t light_protocol_encode_ack(light_packet_status_t status, uint8_t accepted, uint8_t dropped, uint32_t sequence,
+                                 uint8_t *buffer, size_t size);
+
+/**
+ * @brief Encodes a state report.
+ *
+ * @param zones             Report of each zone.
+ * @param num_zones         Number of zones.
+ * @param master_brightness Master brightness, Q8.
+ * @return Length of the report, or 0 if the buffer is too small.
+ */
+size_t light_protocol_encode_state(const light_zone_report_t *zones, uint8_t num_zones, uint16_t master_brightness,
+                                   uint8_t *buffer, size_t size);
+
+#endif
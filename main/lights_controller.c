@@ -1,153 +1,499 @@
+#include <stdlib.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include "freertos/idf_additions.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
 
 #include "led_strip.h"
 
 #include "main_common.h"
+#include "commands.h"
+#include "framebuffer.h"
+#include "power_limiter.h"
+#include "color_calibration.h"
+#include "led_output.h"
+#include "latency_histogram.h"
+#include "flight_recorder.h"
 
 static const char *TAG = "light_controller";
 
-void lights_task(void *arg) {
-  ambient_light_t *light = (ambient_light_t *) arg;
-  led_strip_config_t strip_config = light->strip_config;
-  led_strip_rmt_config_t rmt_config = light->rmt_config;
+/* Written by the CAN task, read by every light task when it renders */
+static uint16_t master_brightness = POWER_LIMITER_FULL_SCALE;
+
+/* Submission state of a light, the counters are written by the submitting tasks and the wait times by the light's task */
+typedef struct {
+  command_t *pending;        /* Coalesced command waiting for the light task, exchanged atomically */
+  uint32_t pending_since_ms; /* When the pending slot was last filled while empty */
+  uint32_t submitted;
+  uint32_t coalesced;
+  uint32_t queue_full;
+  uint32_t applied_sequence;
+  uint32_t max_wait_us;
+  uint32_t taken;            /* Commands taken by the light task */
+  uint64_t total_wait_us;
+  uint32_t batch_timeouts;
+} submission_t;
+
+/* Frame sync of a batch, each light sets its bit once its first frame is rendered and shows it once every member bit is set */
+typedef struct light_batch_t {
+  EventGroupHandle_t frame_sync;
+  EventBits_t members;
+  uint32_t references; /* Member commands not synced or discarded yet, the last one frees the batch */
+} light_batch_t;
+
+static submission_t submissions[NUM_LIGHTS];
+
+/* Last sequence number handed out */
+static uint32_t last_sequence = 0;
+
+/* Rendering state that accompanies a light's framebuffer inside its task */
+typedef struct {
+  ambient_light_t *light;
+  int light_index;
+  channel_sums_t frame_levels; /* Output level sums of light->frame (see led_output_frame_levels), kept up to date incrementally */
+  uint16_t shown_scale;        /* Output scale (brightness and power limit) the strip was last refreshed with */
+  int64_t pending_origin_us;   /* CAN reception time of the command being rendered, until its first refresh */
+} renderer_t;
+
+/* Record the CAN-to-LED latency once the first refresh reflecting a CAN triggered command is out */
+static void record_latency(renderer_t *renderer) {
+  if (renderer->pending_origin_us != 0) {
+    latency_histogram_record(esp_timer_get_time() - renderer->pending_origin_us);
+    renderer->pending_origin_us = 0;
+  }
+}
 
-  /* Initialize the LED strip */
-  led_strip_handle_t led_strip;
-  ESP_ERROR_CHECK(led_strip_new_rmt_device(&strip_config, &rmt_config, &led_strip));
-  led_strip_clear(led_strip);
+void lights_set_master_brightness(uint16_t scale) {
+  __atomic_store_n(&master_brightness, scale, __ATOMIC_RELAXED);
+}
 
-  command_t* command;
-  while (1) {
-    /* Wait for a command from the queue */
-    if (xQueueReceive(light->command_queue, &command, portMAX_DELAY)) {
-      switch (command->type) {
-        case COMMAND_SET_COLOR:
-          if (command->data.color.red == 0 &&
-              command->data.color.green == 0 &&
-              command->data.color.blue == 0) {
-            /* If the target color is black, turn off the lights */
-            light->state = LIGHT_OFF;
-          } else {
-            /* Otherwise, set the state to LIGHT_ON */
-            light->state = LIGHT_ON;
-          }
+uint16_t lights_get_master_brightness(void) {
+  return __atomic_load_n(&master_brightness, __ATOMIC_RELAXED);
+}
 
-          for (int i = 0 ; i < strip_config.max_leds ; i++) {
-              led_strip_set_pixel(led_strip, i,
-                command->data.color.red,
-                command->data.color.green,
-                command->data.color.blue);
-          }
-          led_strip_refresh(led_strip);
-          light->current_led_color = command->data.color;
-
-          break;
-        case COMMAND_SEQUENTIAL:
-          light->state = LIGHT_TRANSITIONING;
-
-          /* Reset LED strip before sequential animation */
-          led_strip_clear(led_strip);
-          led_strip_refresh(led_strip);
-
-          rgb_t temp_color = {0, 0, 0};
-
-          /* Increment each LED brightness by number_steps until reaching current_color, then move to next LED */
-          if (command->data.step.reverse) {
-            /* Reverse order: start from the last LED and move to the first */
-            for (int led_index = strip_config.max_leds - 1; led_index >= 0; led_index--) {
-              for (int step = 0; step < command->data.step.num_steps; step++) {
-                temp_color.red = (command->data.color.red * (step + 1)) / command->data.step.num_steps;
-                temp_color.green = (command->data.color.green * (step + 1)) / command->data.step.num_steps;
-                temp_color.blue = (command->data.color.blue * (step + 1)) / command->data.step.num_steps;
-
-                led_strip_set_pixel(led_strip, led_index, temp_color.red, temp_color.green, temp_color.blue);
-                led_strip_refresh(led_strip);
-                vTaskDelay(pdMS_TO_TICKS(command->data.step.delay_ms));
-              }
-            }
-          } else {
-            /* Normal order: start from the first LED and move to the last */
-            for (int led_index = 0; led_index < strip_config.max_leds; led_index++) {
-              for (int step = 0; step < command->data.step.num_steps; step++) {
-                temp_color.red = (command->data.color.red * (step + 1)) / command->data.step.num_steps;
-                temp_color.green = (command->data.color.green * (step + 1)) / command->data.step.num_steps;
-                temp_color.blue = (command->data.color.blue * (step + 1)) / command->data.step.num_steps;
-
-                led_strip_set_pixel(led_strip, led_index, temp_color.red, temp_color.green, temp_color.blue);
-                led_strip_refresh(led_strip);
-                vTaskDelay(pdMS_TO_TICKS(command->data.step.delay_ms));
-              }
-            }
-          }
+/* The master brightness, unless the power limiter only allows less (the limit is the largest scale that fits the budget) */
+static inline uint16_t limit_scale(uint16_t power_scale) {
+  uint16_t brightness = lights_get_master_brightness();
+  return (brightness < power_scale) ? brightness : power_scale;
+}
 
-          /* For good measure, set the entire strip to the new color */
-          for (int i = 0; i < strip_config.max_leds; i++) {
-            led_strip_set_pixel(led_strip, i, 
-              command->data.color.red, 
-              command->data.color.green, 
-              command->data.color.blue);
-          }
-          led_strip_refresh(led_strip);
+static uint32_t now_ms(void) {
+  return (uint32_t) (esp_timer_get_time() / 1000);
+}
+
+uint32_t lights_reserve_sequence(void) {
+  uint32_t sequence;
+  do {
+    sequence = __atomic_add_fetch(&last_sequence, 1, __ATOMIC_RELAXED);
+  } while (sequence == 0);
+  return sequence;
+}
+
+/* Stamp a command that is about to be submitted */
+static void prepare_submission(command_t *command, uint32_t *sequence) {
+  command->submitted_us = esp_timer_get_time();
+  if (command->sequence == 0) {
+    command->sequence = lights_reserve_sequence();
+  }
+  if (sequence != NULL) {
+    *sequence = command->sequence;
+  }
+}
+
+static void release_batch(light_batch_t *batch) {
+  if (__atomic_sub_fetch(&batch->references, 1, __ATOMIC_ACQ_REL) == 0) {
+    vEventGroupDelete(batch->frame_sync);
+    free(batch);
+  }
+}
+
+/* A batched command that will never be shown, the rest of its batch must not wait for it */
+static void leave_batch(int light_index, command_t *command) {
+  light_batch_t *batch = command->batch;
+  if (batch == NULL) {
+    return;
+  }
+  command->batch = NULL;
+  xEventGroupSetBits(batch->frame_sync, 1 << light_index);
+  release_batch(batch);
+}
+
+static void discard_command(int light_index, command_t *command) {
+  leave_batch(light_index, command);
+  if (command->chained_command != NULL) {
+    free_command(command->chained_command);
+  }
+  free_command(command);
+}
+
+/* A coalesced command the light has not taken for too long, it is busy with a long animation */
+static bool is_saturated(const submission_t *submission, uint32_t now) {
+  return __atomic_load_n(&submission->pending, __ATOMIC_ACQUIRE) != NULL &&
+         now - __atomic_load_n(&submission->pending_since_ms, __ATOMIC_RELAXED) > LIGHT_SATURATED_MS;
+}
+
+esp_err_t lights_submit_command(int light_index, command_t *command, uint32_t *sequence) {
+  if (command == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+  submission_t *submission = &submissions[light_index];
+  prepare_submission(command, sequence);
+  if (xQueueSend(lights[light_index].command_queue, &command, 0) != pdTRUE) {
+    __atomic_add_fetch(&submission->queue_full, 1, __ATOMIC_RELAXED);
+    discard_command(light_index, command);
+    return ESP_ERR_TIMEOUT;
+  }
+  __atomic_add_fetch(&submission->submitted, 1, __ATOMIC_RELAXED);
+  return ESP_OK;
+}
+
+esp_err_t lights_submit_latest(int light_index, command_t *command, uint32_t *sequence) {
+  if (command == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+  submission_t *submission = &submissions[light_index];
+
+  /* A light busy with a long animation keeps its pending command, tell the caller to back off instead */
+  uint32_t now = now_ms();
+  if (is_saturated(submission, now)) {
+    __atomic_add_fetch(&submission->queue_full, 1, __ATOMIC_RELAXED);
+    discard_command(light_index, command);
+    return ESP_ERR_TIMEOUT;
+  }
+
+  prepare_submission(command, sequence);
+  command_t *replaced = __atomic_exchange_n(&submission->pending, command, __ATOMIC_ACQ_REL);
+  __atomic_add_fetch(&submission->submitted, 1, __ATOMIC_RELAXED);
+  if (replaced != NULL) {
+    /* Never started, the light task takes the newer one instead */
+    __atomic_add_fetch(&submission->coalesced, 1, __ATOMIC_RELAXED);
+    discard_command(light_index, replaced);
+  } else {
+    /* Wake the light task with an empty entry at this point of the queue, if the queue is full it takes the command once idle */
+    __atomic_store_n(&submission->pending_since_ms, now, __ATOMIC_RELAXED);
+    command_t *wakeup = NULL;
+    xQueueSend(lights[light_index].command_queue, &wakeup, 0);
+  }
+  return ESP_OK;
+}
+
+void lights_flush_commands(int light_index) {
+  command_t *command;
+  while (xQueueReceive(lights[light_index].command_queue, &command, 0) == pdTRUE) {
+    if (command != NULL) {
+      discard_command(light_index, command);
+    }
+  }
+  command = __atomic_exchange_n(&submissions[light_index].pending, NULL, __ATOMIC_ACQ_REL);
+  if (command != NULL) {
+    discard_command(light_index, command);
+  }
+}
+
+esp_err_t lights_submit_batch(command_t *commands[NUM_LIGHTS], uint32_t *sequence) {
+  EventBits_t members = 0;
+  uint32_t num_members = 0;
+  for (int i = 0; i < NUM_LIGHTS; i++) {
+    if (commands[i] != NULL) {
+      members |= 1 << i;
+      num_members++;
+    }
+  }
+  if (num_members == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  /* Showing only part of the batch is what it exists to avoid, so a saturated light refuses all of it */
+  esp_err_t err = ESP_OK;
+  uint32_t now = now_ms();
+  for (int i = 0; i < NUM_LIGHTS; i++) {
+    if (commands[i] != NULL && is_saturated(&submissions[i], now)) {
+      __atomic_add_fetch(&submissions[i].queue_full, 1, __ATOMIC_RELAXED);
+      err = ESP_ERR_TIMEOUT;
+    }
+  }
+
+  light_batch_t *batch = NULL;
+  if (err == ESP_OK && num_members > 1) {
+    batch = malloc(sizeof(light_batch_t));
+    if (batch == NULL || (batch->frame_sync = xEventGroupCreate()) == NULL) {
+      free(batch);
+      err = ESP_ERR_NO_MEM;
+    }
+  }
+  if (err != ESP_OK) {
+    for (int i = 0; i < NUM_LIGHTS; i++) {
+      if (commands[i] != NULL) {
+        discard_command(i, commands[i]);
+      }
+    }
+    return err;
+  }
+
+  if (batch != NULL) {
+    batch->members = members;
+    batch->references = num_members;
+  }
+  uint32_t batch_sequence = lights_reserve_sequence();
+  for (int i = 0; i < NUM_LIGHTS; i++) {
+    if (commands[i] != NULL) {
+      commands[i]->sequence = batch_sequence;
+      commands[i]->batch = batch;
+    }
+  }
+
+  /* A light whose command is refused after all leaves the batch, so the others do not wait for it */
+  for (int i = 0; i < NUM_LIGHTS; i++) {
+    if (commands[i] != NULL) {
+      esp_err_t submit_err = lights_submit_latest(i, commands[i], NULL);
+      if (err == ESP_OK) {
+        err = submit_err;
+      }
+    }
+  }
+  if (sequence != NULL) {
+    *sequence = batch_sequence;
+  }
+  return err;
+}
 
-          light->state = LIGHT_ON;
-          light->current_led_color = command->data.color;
+void lights_get_queue_metrics(int light_index, light_queue_metrics_t *metrics) {
+  const submission_t *submission = &submissions[light_index];
+  uint32_t taken = submission->taken;
+  metrics->submitted = __atomic_load_n(&submission->submitted, __ATOMIC_RELAXED);
+  metrics->coalesced = __atomic_load_n(&submission->coalesced, __ATOMIC_RELAXED);
+  metrics->queue_full = __atomic_load_n(&submission->queue_full, __ATOMIC_RELAXED);
+  metrics->queue_depth = uxQueueMessagesWaiting(lights[light_index].command_queue);
+  metrics->applied_sequence = __atomic_load_n(&submission->applied_sequence, __ATOMIC_ACQUIRE);
+  metrics->max_wait_us = submission->max_wait_us;
+  metrics->mean_wait_us = (taken > 0) ? submission->total_wait_us / taken : 0;
+  metrics->batch_timeouts = submission->batch_timeouts;
+}
 
-          break;
-        case COMMAND_FADE_TO:
-          light->state = LIGHT_TRANSITIONING;
+/* Take the next command for a light: queued commands in order, the coalesced one where its wakeup entry was queued or once idle */
+static command_t *take_command(renderer_t *renderer) {
+  ambient_light_t *light = renderer->light;
+  submission_t *submission = &submissions[renderer->light_index];
 
-          /* Compute per-channel delta from the current LED color to the target */
-          int red_delta   = (int)command->data.color.red   - (int)light->current_led_color.red;
-          int green_delta = (int)command->data.color.green - (int)light->current_led_color.green;
-          int blue_delta  = (int)command->data.color.blue  - (int)light->current_led_color.blue;
+  command_t *command = NULL;
+  if (xQueueReceive(light->command_queue, &command, pdMS_TO_TICKS(IDLE_FRAME_PERIOD_MS)) != pdTRUE || command == NULL) {
+    command = __atomic_exchange_n(&submission->pending, NULL, __ATOMIC_ACQ_REL);
+    if (command == NULL) {
+      return NULL;
+    }
+  }
+
+  if (command->submitted_us != 0) {
+    uint32_t wait_us = esp_timer_get_time() - command->submitted_us;
+    if (wait_us > submission->max_wait_us) {
+      submission->max_wait_us = wait_us;
+    }
+    submission->total_wait_us += wait_us;
+    submission->taken++;
+  }
+  return command;
+}
+
+/* Before showing the first frame of a batched command, wait until every light of the batch has rendered its own */
+static void wait_for_batch(renderer_t *renderer, command_t *command) {
+  light_batch_t *batch = command->batch;
+  if (batch == NULL) {
+    return;
+  }
+  command->batch = NULL;
+  EventBits_t bits = xEventGroupSync(batch->frame_sync, 1 << renderer->light_index, batch->members,
+                                     pdMS_TO_TICKS(LIGHT_SATURATED_MS));
+  if ((bits & batch->members) != batch->members) {
+    submissions[renderer->light_index].batch_timeouts++;
+  }
+  release_batch(batch);
+}
+
+/* Estimate the current of the frame's output levels and return the output scale for it */
+static uint16_t update_power_scale(renderer_t *renderer) {
+  return limit_scale(power_limiter_update(renderer->light_index, &renderer->frame_levels,
+                                          renderer->light->strip_config.max_leds));
+}
+
+/* Push the light's framebuffer out to the LED strip in a single calibrated, gamma corrected and scaled pass */
+static void show_frame(renderer_t *renderer) {
+  ambient_light_t *light = renderer->light;
+  uint16_t scale = update_power_scale(renderer);
+  led_output_set_scale(&light->output, scale);
+  led_output_show_frame(&light->output, light->frame, &light->calibration);
+  renderer->shown_scale = scale;
+  record_latency(renderer);
+}
+
+/* Update a single LED, only walking the whole strip if the output scale changed */
+static void show_pixel(renderer_t *renderer, int index, rgb_t color) {
+  ambient_light_t *light = renderer->light;
+  rgb_t previous = led_output_pixel_levels(&light->calibration, framebuffer_get_pixel(light->frame, index));
+  rgb_t levels = led_output_pixel_levels(&light->calibration, color);
+  renderer->frame_levels.red += levels.red - previous.red;
+  renderer->frame_levels.green += levels.green - previous.green;
+  renderer->frame_levels.blue += levels.blue - previous.blue;
+  framebuffer_set_pixel(light->frame, index, color);
+
+  uint16_t scale = update_power_scale(renderer);
+  if (scale != renderer->shown_scale) {
+    show_frame(renderer);
+    return;
+  }
+  led_output_show_pixel(&light->output, index, color, &light->calibration);
+  record_latency(renderer);
+}
+
+/* Publish a light's state, recording transitions in the flight recorder */
+static void set_state(ambient_light_t *light, LightState state) {
+  if (light_get_state(light) != state) {
+    flight_recorder_log_light_state(light - lights, state);
+  }
+  light_set_state(light, state);
+}
+
+static bool is_color_off(rgb_t color) {
+  return color.red == 0 && color.green == 0 && color.blue == 0;
+}
+
+void lights_task(void *arg) {
+  ambient_light_t *light = (ambient_light_t *) arg;
+  const int num_leds = light->strip_config.max_leds;
+  const int frame_words = FRAMEBUFFER_WORDS(num_leds);
+
+  renderer_t renderer = {
+    .light = light,
+    .light_index = light - lights,
+    .frame_levels = {0, 0, 0},
+    .shown_scale = POWER_LIMITER_FULL_SCALE,
+    .pending_origin_us = 0,
+  };
+
+  command_t* command;
+  while (1) {
+    /* Wait for a command, re-rendering the current frame if the brightness or power limit moved meanwhile */
+    command = take_command(&renderer);
+    if (command == NULL) {
+      if (limit_scale(power_limiter_get_scale()) != renderer.shown_scale) {
+        show_frame(&renderer);
+      }
+      continue;
+    }
+
+    renderer.pending_origin_us = command->origin_us;
+
+    rgb_t target_color;
+    channel_sums_t target_sums;
+    channel_sums_t target_levels;
+    switch (command->type) {
+      case COMMAND_SET_COLOR:
+        target_color = framebuffer_render_target(light->frame, num_leds, command, &target_sums);
+        renderer.frame_levels = led_output_frame_levels(light->frame, num_leds, &light->calibration);
+        wait_for_batch(&renderer, command);
+
+        /* If the target color is black, turn off the lights, otherwise set the state to LIGHT_ON */
+        set_state(light, is_color_off(target_color) ? LIGHT_OFF : LIGHT_ON);
+
+        show_frame(&renderer);
+        light->current_led_color = target_color;
+
+        break;
+      case COMMAND_SEQUENTIAL:
+        target_color = framebuffer_render_target(light->fade_to, num_leds, command, &target_sums);
+        target_levels = led_output_frame_levels(light->fade_to, num_leds, &light->calibration);
+        wait_for_batch(&renderer, command);
+        set_state(light, LIGHT_TRANSITIONING);
+
+        /* Reset LED strip before sequential animation, the latency is recorded at the first pixel as this refresh
+         * usually changes nothing visible (the startup sequence only plays from dark) */
+        memset(light->frame, 0, frame_words * sizeof(uint32_t));
+        renderer.frame_levels = (channel_sums_t) {0, 0, 0};
+        int64_t origin_us = renderer.pending_origin_us;
+        renderer.pending_origin_us = 0;
+        show_frame(&renderer);
+        renderer.pending_origin_us = origin_us;
+
+        /* Increment each LED brightness by number_steps until reaching its target, then move to next LED */
+        for (int n = 0; n < num_leds; n++) {
+          /* Reverse order starts from the last LED and moves to the first */
+          int led_index = command->data.step.reverse ? (num_leds - 1 - n) : n;
+          rgb_t led_target = framebuffer_get_pixel(light->fade_to, led_index);
 
-          /* Fade each LED from current color to the target color in steps */
           for (int step = 0; step < command->data.step.num_steps; step++) {
             rgb_t temp_color;
-            temp_color.red   = (uint8_t)(light->current_led_color.red   + (red_delta   * (step + 1)) / command->data.step.num_steps);
-            temp_color.green = (uint8_t)(light->current_led_color.green + (green_delta * (step + 1)) / command->data.step.num_steps);
-            temp_color.blue  = (uint8_t)(light->current_led_color.blue  + (blue_delta  * (step + 1)) / command->data.step.num_steps);
-
-            for (int i = 0; i < strip_config.max_leds; i++) {
-              led_strip_set_pixel(led_strip, i, temp_color.red, temp_color.green, temp_color.blue);
-            }
+            temp_color.red = (led_target.red * (step + 1)) / command->data.step.num_steps;
+            temp_color.green = (led_target.green * (step + 1)) / command->data.step.num_steps;
+            temp_color.blue = (led_target.blue * (step + 1)) / command->data.step.num_steps;
 
-            led_strip_refresh(led_strip);
+            show_pixel(&renderer, led_index, temp_color);
             vTaskDelay(pdMS_TO_TICKS(command->data.step.delay_ms));
           }
+        }
 
-          /* For good measure, set the entire strip to the target color */
-          for (int i = 0; i < strip_config.max_leds; i++) {
-            led_strip_set_pixel(led_strip, i, command->data.color.red, command->data.color.green, command->data.color.blue);
-          }
-          led_strip_refresh(led_strip);
-          light->current_led_color = command->data.color;
-
-          if (command->data.color.red == 0 &&
-              command->data.color.green == 0 &&
-              command->data.color.blue == 0) {
-            light->state = LIGHT_OFF;
-          } else {
-            light->state = LIGHT_ON;
-          }
+        /* For good measure, set the entire strip to the target */
+        memcpy(light->frame, light->fade_to, frame_words * sizeof(uint32_t));
+        renderer.frame_levels = target_levels;
+        show_frame(&renderer);
+
+        set_state(light, LIGHT_ON);
+        light->current_led_color = target_color;
+
+        break;
+      case COMMAND_FADE_TO:
+        /* Fade every LED from its current color to its own target, interpolating the whole strip at once */
+        memcpy(light->fade_from, light->frame, frame_words * sizeof(uint32_t));
+        channel_sums_t from_levels = renderer.frame_levels;
+        target_color = framebuffer_render_target(light->fade_to, num_leds, command, &target_sums);
+        target_levels = led_output_frame_levels(light->fade_to, num_leds, &light->calibration);
+        wait_for_batch(&renderer, command);
+        set_state(light, LIGHT_TRANSITIONING);
+
+        for (int step = 0; step < command->data.step.num_steps; step++) {
+          uint32_t t = ((step + 1) * 256) / command->data.step.num_steps;
+          framebuffer_lerp(light->frame, light->fade_from, light->fade_to, num_leds, t);
+          /* Gamma correction is convex, so the interpolated levels err on the high side of the blended frame's */
+          renderer.frame_levels = channel_sums_lerp(&from_levels, &target_levels, t);
+
+          show_frame(&renderer);
+          vTaskDelay(pdMS_TO_TICKS(command->data.step.delay_ms));
+        }
 
-          break;
-      }
+        /* For good measure, set the entire strip to the target */
+        memcpy(light->frame, light->fade_to, frame_words * sizeof(uint32_t));
+        renderer.frame_levels = target_levels;
+        show_frame(&renderer);
+        light->current_led_color = target_color;
 
-      /* Check if there is a valid chained command */
-      if (command->chained_command != NULL) {
-        if (xQueueSend(command->chained_command_queue, &command->chained_command, 0) != pdTRUE) {
-          ESP_LOGE(TAG, "Failed to send chained command to queue, dropping");
-          free(command->chained_command);
-        }
+        set_state(light, is_color_off(target_color) ? LIGHT_OFF : LIGHT_ON);
+
+        break;
+      case COMMAND_SET_CALIBRATION:
+        /* Apply the new calibration to the frame currently shown */
+        light->calibration = command->data.calibration;
+        renderer.frame_levels = led_output_frame_levels(light->frame, num_leds, &light->calibration);
+        wait_for_batch(&renderer, command);
+        show_frame(&renderer);
+
+        break;
+    }
+
+    /* Check if there is a valid chained command */
+    if (command->chained_command != NULL) {
+      if (xQueueSend(command->chained_command_queue, &command->chained_command, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to send chained command to queue, dropping");
+        free_command(command->chained_command);
       }
+    }
 
-      /* Deallocate command memory */
-      free(command);
-      command = NULL;
+    if (command->sequence != 0) {
+      __atomic_store_n(&submissions[renderer.light_index].applied_sequence, command->sequence, __ATOMIC_RELEASE);
     }
+
+    /* Deallocate command memory */
+    leave_batch(renderer.light_index, command);
+    free_command(command);
+    command = NULL;
   }
 
   /* Delete the task if it exits the loop */
@@ -159,22 +505,33 @@ void lights_task(void *arg) {
 /**
  * @brief Initializes the ambient light controller and its resources.
  *
- * This function sets up the configuration for the LED strip and RMT (Remote Control) peripheral,
- * creates a command queue for handling lighting commands, initializes the LED strip to an "off" state,
- * and starts the FreeRTOS task responsible for controlling the lights.
+ * This function sets up the configuration for the LED strip and its output peripheral (RMT for WS2812
+ * and SK6812, SPI for APA102), creates a command queue for handling lighting commands, initializes the
+ * LED strip to an "off" state, and starts the FreeRTOS task responsible for controlling the lights.
  *
- * @param[in,out] light      Pointer to the ambient_light_t structure to initialize.
- * @param[in]     gpio_num   GPIO pin number connected to the LED strip.
- * @param[in]     max_leds   Maximum number of LEDs in the strip.
+ * @param[in,out] light          Pointer to the ambient_light_t structure to initialize.
+ * @param[in]     led_type       Type of LED strip, which selects the pixel format.
+ * @param[in]     gpio_num       GPIO pin number connected to the LED strip (data line).
+ * @param[in]     clock_gpio_num GPIO pin number connected to the clock line (APA102 only).
+ * @param[in]     max_leds       Maximum number of LEDs in the strip.
  *
- * @return ESP_OK on success, or ESP_FAIL if initialization fails (e.g., queue or task creation fails).
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the framebuffers cannot be allocated, the driver error
+ *         code if the LED output cannot be created, or ESP_FAIL if initialization fails (e.g., queue or
+ *         task creation fails).
  */
-esp_err_t init_ambient_light(ambient_light_t *light, const int gpio_num, const int max_leds) {
+esp_err_t init_ambient_light(ambient_light_t *light, const LedType led_type, const int gpio_num, const int clock_gpio_num, const int max_leds) {
   /* Initialize the LED strip configuration */
+  light->led_type = led_type;
+  light->clock_gpio_num = clock_gpio_num; // Clock GPIO pin (APA102 only)
   light->strip_config.strip_gpio_num = gpio_num; // GPIO pin for the LED strip
   light->strip_config.max_leds = max_leds; // Number of LEDs in the strip
-  light->strip_config.led_model = LED_MODEL_WS2812; // LED strip model
-  light->strip_config.color_component_format = LED_STRIP_COLOR_COMPONENT_FMT_GRB; // Color format
+  if (led_type == LED_TYPE_SK6812_RGBW) {
+    light->strip_config.led_model = LED_MODEL_SK6812; // LED strip model
+    light->strip_config.color_component_format = LED_STRIP_COLOR_COMPONENT_FMT_GRBW; // Color format
+  } else {
+    light->strip_config.led_model = LED_MODEL_WS2812; // LED strip model
+    light->strip_config.color_component_format = LED_STRIP_COLOR_COMPONENT_FMT_GRB; // Color format
+  }
   light->strip_config.flags.invert_out = false; // Do not invert output signal
 
   /* Initialize the RMT configuration */
@@ -183,8 +540,17 @@ esp_err_t init_ambient_light(ambient_light_t *light, const int gpio_num, const i
   light->rmt_config.mem_block_symbols = 64; // Memory size of each RMT channel
   light->rmt_config.flags.with_dma = false; // Disable DMA feature
 
+  /* Allocate the framebuffers used for per-pixel rendering and fades */
+  light->frame = framebuffer_alloc(max_leds);
+  light->fade_from = framebuffer_alloc(max_leds);
+  light->fade_to = framebuffer_alloc(max_leds);
+  if (light->frame == NULL || light->fade_from == NULL || light->fade_to == NULL) {
+    ESP_LOGE(TAG, "Failed to allocate framebuffers");
+    return ESP_ERR_NO_MEM;
+  }
+
   /* Create a command queue for handling commands */
-  light->command_queue = xQueueCreate(10, sizeof(command_t*));
+  light->command_queue = xQueueCreate(LIGHT_COMMAND_QUEUE_LEN, sizeof(command_t*));
   
   if (light->command_queue == NULL) {
     ESP_LOGE(TAG, "Failed to create command queue");
@@ -192,11 +558,14 @@ esp_err_t init_ambient_light(ambient_light_t *light, const int gpio_num, const i
   }
 
   /* Initialize the LED strip */
-  led_strip_handle_t led_strip;
-  ESP_ERROR_CHECK(led_strip_new_rmt_device(&light->strip_config, &light->rmt_config, &led_strip));
-  led_strip_clear(led_strip);
-  light->state = LIGHT_OFF;
+  esp_err_t err = led_output_init(&light->output, light, light - lights);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to initialize LED output: %s", esp_err_to_name(err));
+    return err;
+  }
+  light_set_state(light, LIGHT_OFF);
   light->current_led_color = COLOR_OFF;
+  calibration_load(light - lights, &light->calibration);
 
   /* Start the lights_task using FreeRTOS */
   BaseType_t task_result = xTaskCreatePinnedToCore(
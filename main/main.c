@@ -1,7 +1,18 @@
+#include "nvs_flash.h"
+
 #include "main_common.h"
+#include "flight_recorder.h"
 
 static const char* TAG = "main";
 
+/* Clock GPIOs are only configured (and used) for APA102 strips */
+#ifndef CONFIG_DASHBOARD_CLOCK_GPIO
+#define CONFIG_DASHBOARD_CLOCK_GPIO -1
+#endif
+#ifndef CONFIG_DOOR_CLOCK_GPIO
+#define CONFIG_DOOR_CLOCK_GPIO -1
+#endif
+
 ambient_light_t lights[NUM_LIGHTS];
 
 SemaphoreHandle_t current_color_lock = NULL;
@@ -17,9 +28,20 @@ void app_main(void)
   }
   xSemaphoreGive(current_color_lock); // Initialize the semaphore to be available
 
+  /* Initialize NVS, the light controllers read their calibration from it */
+  esp_err_t ret = nvs_flash_init();
+  if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+    ESP_ERROR_CHECK(nvs_flash_erase());
+    ret = nvs_flash_init();
+  }
+  ESP_ERROR_CHECK(ret);
+
+  /* Start the flight recorder first, so it sees the light state transitions of this boot (optional, needs the canlog partition) */
+  flight_recorder_init();
+
   ESP_LOGI(TAG, "Starting light tasks...");
-  init_ambient_light(&lights[DASHBOARD_INDEX], CONFIG_DASHBOARD_GPIO, CONFIG_DASHBOARD_MAX_LEDS);
-  init_ambient_light(&lights[DOOR_INDEX], CONFIG_DOOR_GPIO, CONFIG_DOOR_MAX_LEDS);
+  init_ambient_light(&lights[DASHBOARD_INDEX], CONFIG_DASHBOARD_LED_TYPE, CONFIG_DASHBOARD_GPIO, CONFIG_DASHBOARD_CLOCK_GPIO, CONFIG_DASHBOARD_MAX_LEDS);
+  init_ambient_light(&lights[DOOR_INDEX], CONFIG_DOOR_LED_TYPE, CONFIG_DOOR_GPIO, CONFIG_DOOR_CLOCK_GPIO, CONFIG_DOOR_MAX_LEDS);
 
   ESP_LOGI(TAG, "Starting HTTP and CAN sniffer...");
   ESP_ERROR_CHECK(start_can_sniffer_task());
@@ -6,6 +6,7 @@
 #include "driver/gpio.h"
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
+#include "driver/spi_master.h"
 #include "esp_check.h"
 #include "esp_log.h"
 #include "sdkconfig.h"
@@ -16,6 +17,10 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "can_bus_stats.h"
+
+#define MAX_GRADIENT_STOPS 8
+
 /* =========================
  *        ENUMERATIONS
  * ========================= */
@@ -23,8 +28,22 @@ typedef enum {
   COMMAND_SET_COLOR,
   COMMAND_SEQUENTIAL,
   COMMAND_FADE_TO,
+  COMMAND_SET_CALIBRATION,
 } CommandType;
 
+/* LED strip types, values match the *_LED_TYPE Kconfig options */
+typedef enum {
+  LED_TYPE_WS2812 = 0,
+  LED_TYPE_SK6812_RGBW = 1,
+  LED_TYPE_APA102 = 2,
+} LedType;
+
+typedef enum {
+  TARGET_UNIFORM,
+  TARGET_GRADIENT,
+  TARGET_PIXELS,
+} TargetType;
+
 typedef enum {
   LIGHT_ON,
   LIGHT_TRANSITIONING,
@@ -34,12 +53,68 @@ typedef enum {
 /* =========================
  *         STRUCTS
  * ========================= */
+/* Receive statistics of the CAN sniffer, together with the TWAI driver's error counters */
+typedef struct {
+  uint32_t frames_received;  /* Frames taken from the RX queue */
+  uint32_t frames_changed;   /* Watched frames whose data changed and were decoded */
+  uint32_t max_batch;        /* Most frames drained from the RX queue in a single wakeup */
+  uint32_t state;            /* twai_state_t */
+  uint32_t rx_pending;       /* Frames waiting in the RX queue */
+  uint32_t rx_missed;        /* Frames lost because the RX queue was full */
+  uint32_t rx_overrun;       /* Frames lost because the hardware RX FIFO overran */
+  uint32_t arb_lost;         /* Arbitration losses */
+  uint32_t bus_errors;       /* Bus errors */
+  uint32_t tx_error_counter; /* Transmit error counter (TEC) */
+  uint32_t rx_error_counter; /* Receive error counter (REC) */
+  uint32_t bus_off_events;   /* Bus-off conditions entered, each followed by an asynchronous recovery */
+  uint32_t sleeps;           /* Light sleeps entered because the bus was silent */
+  uint32_t asleep_ms;        /* Total time spent in those light sleeps */
+  uint32_t last_wake_restore_us; /* Time from the last wakeup until frames were received and the lights restored */
+  uint32_t max_wake_restore_us;  /* Longest of those times */
+} can_sniffer_metrics_t;
+
+/* Command submission statistics of a light */
+typedef struct {
+  uint32_t submitted;        /* Commands accepted, queued or coalesced */
+  uint32_t coalesced;        /* Coalesced commands replaced by a newer one before the light took them */
+  uint32_t queue_full;       /* Commands rejected because the light's queue was full or its pending command stale */
+  uint32_t queue_depth;      /* Commands waiting in the queue */
+  uint32_t applied_sequence; /* Sequence number of the last submitted command the light finished */
+  uint32_t max_wait_us;      /* Longest time a command waited before the light took it */
+  uint32_t mean_wait_us;     /* Mean of those times */
+  uint32_t batch_timeouts;   /* Batched commands shown without the rest of their batch, which did not catch up in time */
+} light_queue_metrics_t;
+
 typedef struct {
   uint8_t red;
   uint8_t green;
   uint8_t blue;
 } rgb_t;
 
+/* Color stop of a gradient, position 0 maps to the first LED and 255 to the last LED */
+typedef struct {
+  uint8_t position;
+  rgb_t color;
+} gradient_stop_t;
+
+/**
+ * Per-pixel target of a set color or fade-to command. TARGET_UNIFORM uses the command color
+ * for every LED, TARGET_GRADIENT interpolates between the stops (sorted by position), and
+ * TARGET_PIXELS copies the pixel array (owned by the command, released by free_command).
+ */
+typedef struct {
+  TargetType type;
+  uint8_t num_stops;
+  gradient_stop_t stops[MAX_GRADIENT_STOPS];
+  rgb_t *pixels;
+  uint16_t num_pixels;
+} pixel_target_t;
+
+/* Color calibration of a zone, a 3x3 matrix in Q8 fixed point (256 = 1.0) applied to RGB at output time */
+typedef struct {
+  int16_t matrix[3][3];
+} color_calibration_t;
+
 typedef struct {
   uint8_t num_steps;
   uint32_t delay_ms;
@@ -51,17 +126,55 @@ typedef struct command_t {
   struct {
     rgb_t color;
     sequential_step_t step;
+    pixel_target_t target;
+    color_calibration_t calibration;
   } data;
   QueueHandle_t chained_command_queue;
   struct command_t* chained_command;
+  int64_t origin_us; /* esp_timer time at which the CAN frame causing this command was received, 0 if not CAN triggered */
+  int64_t submitted_us; /* esp_timer time at which the command was submitted to its light, set by the lights_submit_* functions */
+  uint32_t sequence;    /* Submission sequence number, shared by the commands of a multi-light request (0 until submitted) */
+  struct light_batch_t* batch; /* Set by lights_submit_batch, the lights of a batch show their first frame together */
 } command_t;
 
+struct led_output_t;
+
+/**
+ * Pixel format specific routines of an LED output, selected once when the zone is configured so
+ * that the per-pixel loops contain no format branches (see led_output.h).
+ */
+typedef struct {
+  void (*write_frame)(struct led_output_t *output, const uint32_t *frame, const color_calibration_t *calibration);
+  void (*write_pixel)(struct led_output_t *output, int index, rgb_t pixel, const color_calibration_t *calibration);
+  esp_err_t (*refresh)(struct led_output_t *output);
+} led_output_ops_t;
+
+typedef struct led_output_t {
+  const led_output_ops_t *ops;
+  int num_leds;
+  led_strip_handle_t led_strip; /* WS2812 and SK6812 (RMT) */
+  spi_device_handle_t spi;      /* APA102 and SK9822 (SPI) */
+  uint8_t *spi_buffer;
+  size_t spi_length;
+  uint8_t global_brightness;    /* APA102 5-bit global brightness field */
+  uint16_t lut_scale;           /* Brightness scale the output table was built for */
+  uint8_t lut[256];             /* Gamma correction and brightness scale fused into one table */
+} led_output_t;
+
 typedef struct {
   led_strip_config_t strip_config;
   led_strip_rmt_config_t rmt_config;
+  LedType led_type;
+  int clock_gpio_num;
+  led_output_t output;
   QueueHandle_t command_queue;
   LightState state;
   rgb_t current_led_color;
+  color_calibration_t calibration;
+  /* Packed RGB framebuffers, padded to a whole number of 32-bit words (see framebuffer.h) */
+  uint32_t *frame;
+  uint32_t *fade_from;
+  uint32_t *fade_to;
 } ambient_light_t;
 
 /* =========================
@@ -77,34 +190,21 @@ typedef struct {
 #define DEFAULT_SEQUENTIAL_STEPS 2
 #define DEFAULT_SEQUENTIAL_DELAY_MS 20
 
+/* Length of each light's command queue */
+#define LIGHT_COMMAND_QUEUE_LEN 10
+
+/* A coalesced command still not taken after this long means the light is saturated, submissions are refused meanwhile */
+#define LIGHT_SATURATED_MS 1000
+
+/* Period at which an idle light task re-checks its output parameters (master brightness, power limiter scale) */
+#define IDLE_FRAME_PERIOD_MS 20
+
 #define START_COLOR (rgb_t) {100, 100, 100}
 #define COLOR_OFF (rgb_t) {0, 0, 0}
 
-#define DISPLAY_CAN_ID 0x3B3
-#define DISPLAY_STATUS_BYTE_INDEX 2
-#define DISPLAY_POWER_MASK 0x04
-#define DISPLAY_STANDARD_UI_MASK 0x04
-
-#define LIGHTS_CAN_ID 0x3F5
-#define TS_BYTE_INDEX 0
-#define LEFT_TS_MASK 0x02
-#define RIGHT_TS_MASK 0x08
-#define AMBIENT_LIGHT_BYTE_INDEX 1
-
-/* Hardware filter: accept only 0x3B3 (DISPLAY_CAN_ID) and 0x3F5 (LIGHTS_CAN_ID).
- * XOR of the two IDs gives the bits that differ (0x046). The acceptance code holds
- * the common bits of both IDs, and the mask marks differing ID bits + all non-ID
- * bits as "don't care" (1 = don't care in ESP32 TWAI filter). */
-#define TWAI_FILTER_ID_XOR   (DISPLAY_CAN_ID ^ LIGHTS_CAN_ID)
-#define TWAI_ACCEPTANCE_CODE ((uint32_t)(DISPLAY_CAN_ID & ~TWAI_FILTER_ID_XOR) << 21)
-#define TWAI_ACCEPTANCE_MASK (((uint32_t)TWAI_FILTER_ID_XOR << 21) | 0x001FFFFF)
-
 #define LIGHT_CONTROLLER_TASK_PRIORITY 5
 #define WEB_SERVER_TASK_PRIORITY 10
 
-#define RISING_CHANGE(current, previous, bit_mask) (((current) & (bit_mask)) && !((previous) & (bit_mask)))
-#define FALLING_CHANGE(current, previous, bit_mask) (!((current) & (bit_mask)) && ((previous) & (bit_mask)))
-
 /* =========================================================
  *                  SHARED GLOBAL MEMBERS
  * ========================================================= */
@@ -120,7 +220,63 @@ extern rgb_t current_color;
  *                      FUNCTIONS
  * ========================================================= */
 esp_err_t start_can_sniffer_task();
+void can_sniffer_get_metrics(can_sniffer_metrics_t *metrics);
+/* Opens (or restores) the acceptance filter for capture sessions, applied by the sniffer task within a second */
+void can_sniffer_set_promiscuous(bool promiscuous);
+bool can_sniffer_is_promiscuous(void);
+/* Copies the per-identifier statistics and bus load of the received traffic (about 2 KB) */
+void can_sniffer_get_bus_stats(can_bus_stats_t *stats);
 esp_err_t start_http_server_task();
-esp_err_t init_ambient_light(ambient_light_t *light, const int gpio_num, const int max_leds);
+/* Stop and restart the WiFi access point around light sleep, the HTTP server itself keeps running */
+esp_err_t wifi_ap_suspend(void);
+esp_err_t wifi_ap_resume(void);
+/* Whether the HTTP server has connected clients (open pages, WebSocket sessions) or an OTA update is in progress */
+bool http_server_is_busy(void);
+esp_err_t init_ambient_light(ambient_light_t *light, const LedType led_type, const int gpio_num, const int clock_gpio_num, const int max_leds);
+
+/**
+ * Master brightness (Q8, 256 = full) of every light, applied at output time on top of the colors
+ * and below the power limiter's limit. Full unless set, no CAN signal drives it yet.
+ */
+void lights_set_master_brightness(uint16_t scale);
+uint16_t lights_get_master_brightness(void);
+
+/**
+ * Non-blocking command submission, safe from any task. lights_submit_command queues a command behind
+ * the ones already waiting. lights_submit_latest coalesces: the command takes the light's latest-wins
+ * slot, replacing a command still waiting there, so only use it for commands whose result does not
+ * depend on the ones before (set color, fade-to).
+ *
+ * Both take ownership of the command, which must not be touched afterwards. A command without a
+ * sequence number gets the next one, stored in *sequence (if not NULL) before the command is handed
+ * over. Returns ESP_OK once accepted, ESP_ERR_NO_MEM for a NULL command, or ESP_ERR_TIMEOUT if the
+ * light is saturated (the command is freed).
+ */
+esp_err_t lights_submit_command(int light_index, command_t *command, uint32_t *sequence);
+esp_err_t lights_submit_latest(int light_index, command_t *command, uint32_t *sequence);
+/* Hands out the next sequence number up front, for requests that stamp their commands before submitting them */
+uint32_t lights_reserve_sequence(void);
+/**
+ * Submits one command per light (NULL for lights not in the batch) as a single transaction: each
+ * light renders its command's first frame, then waits for the others before showing it, so no
+ * partial state of the batch is visible. A light that does not catch up within LIGHT_SATURATED_MS
+ * (busy with a queued animation) is not waited for. The commands take the lights' latest-wins
+ * slots and share one sequence number, stored in *sequence. Returns ESP_ERR_TIMEOUT without
+ * submitting anything if one of the lights is saturated, ESP_ERR_NO_MEM if the batch cannot be
+ * allocated, ESP_ERR_INVALID_ARG if it is empty; the commands are freed on failure.
+ */
+esp_err_t lights_submit_batch(command_t *commands[NUM_LIGHTS], uint32_t *sequence);
+/* Drops every command waiting for a light, queued or coalesced */
+void lights_flush_commands(int light_index);
+void lights_get_queue_metrics(int light_index, light_queue_metrics_t *metrics);
+
+/* A light's state is written by its own task and read by others, so it is only accessed atomically */
+static inline LightState light_get_state(const ambient_light_t *light) {
+  return __atomic_load_n(&light->state, __ATOMIC_ACQUIRE);
+}
+
+static inline void light_set_state(ambient_light_t *light, LightState state) {
+  __atomic_store_n(&light->state, state, __ATOMIC_RELEASE);
+}
 
 #endif // MAIN_COMMON_H
\ No newline at end of file
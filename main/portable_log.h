@@ -0,0 +1,31 @@
+#ifndef PORTABLE_LOG_H
+#define PORTABLE_LOG_H
+
+/**
+ * Logging for modules that are also compiled off-target (e.g. by the CAN replay tool). On the
+ * ESP32 this is esp_log, on a host the messages up to PORTABLE_LOG_LEVEL (1 = errors, 2 = warnings,
+ * 3 = info, 4 = debug) go to stderr.
+ */
+#ifdef ESP_PLATFORM
+#include "esp_log.h"
+#else
+#include <stdio.h>
+#include <inttypes.h>
+
+#ifndef PORTABLE_LOG_LEVEL
+#define PORTABLE_LOG_LEVEL 2
+#endif
+
+#define PORTABLE_LOG(level, letter, tag, format, ...) do {                     \
+    if ((level) <= PORTABLE_LOG_LEVEL) {                                        \
+      fprintf(stderr, letter " (%s) " format "\n", tag, ##__VA_ARGS__);         \
+    }                                                                           \
+  } while (0)
+
+#define ESP_LOGE(tag, format, ...) PORTABLE_LOG(1, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) PORTABLE_LOG(2, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) PORTABLE_LOG(3, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) PORTABLE_LOG(4, "D", tag, format, ##__VA_ARGS__)
+#endif
+
+#endif
@@ -0,0 +1,81 @@
+#include "power_limiter.h"
+
+/* Current per channel step (uA), i.e. the full brightness current spread over 255 steps */
+#define RED_UA_PER_STEP   ((CONFIG_LED_RED_MA * 1000) / 255)
+#define GREEN_UA_PER_STEP ((CONFIG_LED_GREEN_MA * 1000) / 255)
+#define BLUE_UA_PER_STEP  ((CONFIG_LED_BLUE_MA * 1000) / 255)
+#define IDLE_UA_PER_LED   (CONFIG_LED_IDLE_MA * 1000)
+#define BUDGET_UA         (CONFIG_POWER_BUDGET_MA * 1000)
+
+/* Fraction (1 / 2^n) of the remaining headroom recovered per frame once the draw falls */
+#define RELEASE_SHIFT 3
+
+static portMUX_TYPE limiter_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Estimated current of each light (uA), split into the quiescent and the color dependent part */
+static uint32_t idle_ua[NUM_LIGHTS];
+static uint32_t color_ua[NUM_LIGHTS];
+
+static uint16_t output_scale = POWER_LIMITER_FULL_SCALE;
+static uint32_t limited_frames = 0;
+
+uint16_t power_limiter_update(int light_index, const channel_sums_t *sums, int num_leds) {
+  uint32_t light_color_ua = sums->red * RED_UA_PER_STEP +
+                            sums->green * GREEN_UA_PER_STEP +
+                            sums->blue * BLUE_UA_PER_STEP;
+
+  taskENTER_CRITICAL(&limiter_lock);
+  idle_ua[light_index] = num_leds * IDLE_UA_PER_LED;
+  color_ua[light_index] = light_color_ua;
+
+  uint32_t total_idle_ua = 0;
+  uint32_t total_color_ua = 0;
+  for (int i = 0; i < NUM_LIGHTS; i++) {
+    total_idle_ua += idle_ua[i];
+    total_color_ua += color_ua[i];
+  }
+
+  /* Only the color dependent current can be scaled, the quiescent current is always drawn */
+  uint32_t target = POWER_LIMITER_FULL_SCALE;
+  if (total_idle_ua + total_color_ua > BUDGET_UA) {
+    uint32_t headroom_ua = (BUDGET_UA > total_idle_ua) ? (BUDGET_UA - total_idle_ua) : 0;
+    /* headroom_ua * 256 stays within 32 bits thanks to the Kconfig range of the budget */
+    target = (headroom_ua * POWER_LIMITER_FULL_SCALE) / total_color_ua;
+  }
+
+  /* Clamp down immediately to protect the supply, release gradually to avoid visible jumps */
+  if (target < output_scale) {
+    output_scale = target;
+  } else if (target > output_scale) {
+    uint32_t step = (target - output_scale) >> RELEASE_SHIFT;
+    output_scale += (step > 0) ? step : 1;
+  }
+
+  if (output_scale < POWER_LIMITER_FULL_SCALE) {
+    limited_frames++;
+  }
+  uint16_t scale = output_scale;
+  taskEXIT_CRITICAL(&limiter_lock);
+
+  return scale;
+}
+
+uint16_t power_limiter_get_scale(void) {
+  return output_scale;
+}
+
+void power_limiter_get_metrics(power_limiter_metrics_t *metrics) {
+  taskENTER_CRITICAL(&limiter_lock);
+  uint32_t total_idle_ua = 0;
+  uint32_t total_color_ua = 0;
+  for (int i = 0; i < NUM_LIGHTS; i++) {
+    total_idle_ua += idle_ua[i];
+    total_color_ua += color_ua[i];
+  }
+  metrics->budget_ma = CONFIG_POWER_BUDGET_MA;
+  metrics->estimated_ma = (total_idle_ua + total_color_ua) / 1000;
+  metrics->limited_ma = (total_idle_ua + (uint32_t) (((uint64_t) total_color_ua * output_scale) / POWER_LIMITER_FULL_SCALE)) / 1000;
+  metrics->scale = output_scale;
+  metrics->limited_frames = limited_frames;
+  taskEXIT_CRITICAL(&limiter_lock);
+}
@@ -0,0 +1,44 @@
+#ifndef POWER_LIMITER_H
+#define POWER_LIMITER_H
+
+#include "main_common.h"
+#include "framebuffer.h"
+
+/* Output scale (Q8) that leaves the frame untouched */
+#define POWER_LIMITER_FULL_SCALE 256
+
+typedef struct {
+  uint32_t budget_ma;      /* Configured current budget shared by all strips */
+  uint32_t estimated_ma;   /* Estimated draw of the requested frames, before limiting */
+  uint32_t limited_ma;     /* Estimated draw after the output scale is applied */
+  uint16_t scale;          /* Current output scale (Q8, 256 = no limiting) */
+  uint32_t limited_frames; /* Number of frames rendered with a scale below full */
+} power_limiter_metrics_t;
+
+/**
+ * @brief Updates the current estimate of a light and returns the output scale for its next frame.
+ *
+ * The estimate uses the per-channel model configured in Kconfig (current per channel at full
+ * brightness plus a quiescent current per LED) and only needs the output level sums of the frame,
+ * so it costs the same regardless of strip length. When the combined estimate of every light
+ * exceeds the budget, the scale drops immediately to the level that fits the budget and is then
+ * released gradually once the draw falls again, so brightness changes stay smooth.
+ *
+ * @param light_index Index of the light in the lights array.
+ * @param sums        Output level sums of the frame about to be shown, before the scale (see led_output_frame_levels).
+ * @param num_leds    Number of LEDs in the strip.
+ * @return Output scale (Q8) to apply to every channel of the frame.
+ */
+uint16_t power_limiter_update(int light_index, const channel_sums_t *sums, int num_leds);
+
+/**
+ * @brief Returns the current output scale (Q8) without updating any estimate.
+ */
+uint16_t power_limiter_get_scale(void);
+
+/**
+ * @brief Copies a snapshot of the power limiter metrics.
+ */
+void power_limiter_get_metrics(power_limiter_metrics_t *metrics);
+
+#endif
@@ -0,0 +1,104 @@
+#include <string.h>
+
+#include "signal_filter.h"
+
+/* Moves a value towards a target by the difference divided by 2^shift, rounded to nearest so the target is reached */
+static inline int32_t approach(int32_t value, int32_t target, int shift) {
+  int32_t difference = target - value;
+  if (shift <= 0) {
+    return target;
+  }
+  int32_t half = 1 << (shift - 1);
+  return value + ((difference >= 0) ? (difference + half) >> shift : -((-difference + half) >> shift));
+}
+
+/* Median of the window, sorting a copy of at most SIGNAL_FILTER_MEDIAN_MAX samples */
+static int32_t window_median(const signal_filter_t *filter) {
+  int32_t sorted[SIGNAL_FILTER_MEDIAN_MAX];
+  for (int i = 0; i < filter->count; i++) {
+    int32_t sample = filter->window[i];
+    int j = i;
+    for (; j > 0 && sorted[j - 1] > sample; j--) {
+      sorted[j] = sorted[j - 1];
+    }
+    sorted[j] = sample;
+  }
+  /* The lower middle sample while the window is still filling up to an even count */
+  return sorted[(filter->count - 1) / 2];
+}
+
+void signal_filter_init(signal_filter_t *filter, signal_filter_kind_t kind, int32_t param) {
+  memset(filter, 0, sizeof(*filter));
+  filter->kind = kind;
+  filter->param = param;
+  if (kind == SIGNAL_FILTER_MEDIAN) {
+    /* Odd windows have a single middle sample */
+    if (filter->param > SIGNAL_FILTER_MEDIAN_MAX) {
+      filter->param = SIGNAL_FILTER_MEDIAN_MAX;
+    } else if (filter->param < 1) {
+      filter->param = 1;
+    }
+    filter->param |= 1;
+  }
+}
+
+int32_t signal_filter_update(signal_filter_t *filter, int32_t input, int64_t timestamp_us) {
+  if (!filter->primed && filter->kind != SIGNAL_FILTER_MEDIAN) {
+    filter->primed = true;
+    filter->output = input;
+    filter->last_us = timestamp_us;
+    return input;
+  }
+
+  switch (filter->kind) {
+    case SIGNAL_FILTER_EMA:
+      filter->output = approach(filter->output, input, filter->param);
+      break;
+    case SIGNAL_FILTER_MEDIAN:
+      filter->window[filter->next] = input;
+      filter->next = (filter->next + 1 < filter->param) ? filter->next + 1 : 0;
+      if (filter->count < filter->param) {
+        filter->count++;
+      }
+      filter->output = window_median(filter);
+      filter->primed = true;
+      break;
+    case SIGNAL_FILTER_SLEW: {
+      int64_t elapsed_us = timestamp_us - filter->last_us;
+      int64_t max_step = (elapsed_us > 0) ? ((int64_t) filter->param * SIGNAL_FILTER_ONE * elapsed_us) / 1000000 : 0;
+      int64_t step = (int64_t) input - filter->output;
+      if (step > max_step) {
+        step = max_step;
+      } else if (step < -max_step) {
+        step = -max_step;
+      }
+      filter->output += (int32_t) step;
+      break;
+    }
+    case SIGNAL_FILTER_HYSTERESIS: {
+      int32_t band = filter->param * SIGNAL_FILTER_ONE;
+      if (input > filter->output + band || input < filter->output - band) {
+        filter->output = input;
+      }
+      break;
+    }
+  }
+  filter->last_us = timestamp_us;
+  return filter->output;
+}
+
+bool signal_filter_chain_add(signal_filter_chain_t *chain, signal_filter_kind_t kind, int32_t param) {
+  if (chain->num_stages >= SIGNAL_FILTER_MAX_STAGES) {
+    return false;
+  }
+  signal_filter_init(&chain->stages[chain->num_stages++], kind, param);
+  return true;
+}
+
+int32_t signal_filter_chain_update(signal_filter_chain_t *chain, uint32_t raw, int64_t timestamp_us) {
+  int32_t value = (int32_t) (raw << SIGNAL_FILTER_Q);
+  for (int i = 0; i < chain->num_stages; i++) {
+    value = signal_filter_update(&chain->stages[i], value, timestamp_us);
+  }
+  return value;
+}
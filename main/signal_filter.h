@@ -0,0 +1,75 @@
+#ifndef SIGNAL_FILTER_H
+#define SIGNAL_FILTER_H
+
+/**
+ * Fixed-point smoothing filters for decoded vehicle signals: exponential moving average,
+ * median of N, slew-rate limiter and hysteresis (deadband). Values are signed Q8 fixed point
+ * (raw signal value * 256, so signals of up to 23 bits), every update costs a bounded number of
+ * operations. Filters are chained per signal, each stage feeding the next. Only depends on the C
+ * standard library.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIGNAL_FILTER_Q 8
+#define SIGNAL_FILTER_ONE (1 << SIGNAL_FILTER_Q)
+
+/* Longest median window and longest filter chain */
+#define SIGNAL_FILTER_MEDIAN_MAX 7
+#define SIGNAL_FILTER_MAX_STAGES 4
+
+typedef enum {
+  SIGNAL_FILTER_EMA,        /* param: smoothing shift n, each sample moves the output by 1/2^n of the difference */
+  SIGNAL_FILTER_MEDIAN,     /* param: window length, odd, up to SIGNAL_FILTER_MEDIAN_MAX samples */
+  SIGNAL_FILTER_SLEW,       /* param: largest change per second, in raw signal units */
+  SIGNAL_FILTER_HYSTERESIS, /* param: band in raw signal units, the output only follows inputs further away than this */
+} signal_filter_kind_t;
+
+typedef struct {
+  signal_filter_kind_t kind;
+  int32_t param;
+  bool primed;     /* Whether a sample was seen, the first one passes unfiltered */
+  int32_t output;  /* Latest output, Q8 */
+  int64_t last_us; /* Time of the latest sample (slew-rate limiter) */
+  uint8_t count;   /* Samples in the window (median) */
+  uint8_t next;    /* Window slot the next sample goes to (median) */
+  int32_t window[SIGNAL_FILTER_MEDIAN_MAX];
+} signal_filter_t;
+
+typedef struct {
+  uint8_t num_stages;
+  signal_filter_t stages[SIGNAL_FILTER_MAX_STAGES];
+} signal_filter_chain_t;
+
+/**
+ * @brief Resets a filter, the next sample primes its output.
+ *
+ * @param kind  Filter type.
+ * @param param Filter parameter, see signal_filter_kind_t.
+ */
+void signal_filter_init(signal_filter_t *filter, signal_filter_kind_t kind, int32_t param);
+
+/**
+ * @brief Filters one sample.
+ *
+ * @param input        Sample, Q8.
+ * @param timestamp_us Sample time, only used by the slew-rate limiter.
+ * @return Filtered value, Q8.
+ */
+int32_t signal_filter_update(signal_filter_t *filter, int32_t input, int64_t timestamp_us);
+
+/**
+ * @brief Appends a stage to a chain.
+ *
+ * @return false if the chain already has SIGNAL_FILTER_MAX_STAGES stages.
+ */
+bool signal_filter_chain_add(signal_filter_chain_t *chain, signal_filter_kind_t kind, int32_t param);
+
+/**
+ * @brief Runs a raw signal value through every stage of a chain.
+ *
+ * @return Output of the last stage, Q8 (the input in Q8 for an empty chain).
+ */
+int32_t signal_filter_chain_update(signal_filter_chain_t *chain, uint32_t raw, int64_t timestamp_us);
+
+#endif
@@ -0,0 +1,48 @@
+#include "vehicle_state.h"
+
+#define STATE_WORDS (sizeof(vehicle_state_t) / sizeof(uint32_t))
+
+/* Word view of the published state, so it can be copied with word-sized atomic accesses */
+typedef union {
+  vehicle_state_t state;
+  uint32_t words[STATE_WORDS];
+} state_words_t;
+
+static uint32_t sequence = 0;
+static state_words_t published;
+
+void vehicle_state_publish(const uint32_t *signals, const int32_t *filtered, int64_t updated_us) {
+  state_words_t update;
+  update.state.version = published.state.version + 1;
+  update.state.updated_us = updated_us;
+  for (int i = 0; i < CAN_SIGNAL_COUNT; i++) {
+    update.state.signals[i] = signals[i];
+    update.state.filtered[i] = filtered[i];
+  }
+
+  /* Odd sequence: an update is in progress */
+  uint32_t start = __atomic_load_n(&sequence, __ATOMIC_RELAXED);
+  __atomic_store_n(&sequence, start + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  for (size_t i = 0; i < STATE_WORDS; i++) {
+    __atomic_store_n(&published.words[i], update.words[i], __ATOMIC_RELAXED);
+  }
+
+  __atomic_store_n(&sequence, start + 2, __ATOMIC_RELEASE);
+}
+
+void vehicle_state_read(vehicle_state_t *state) {
+  state_words_t copy;
+  uint32_t before, after;
+  do {
+    before = __atomic_load_n(&sequence, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < STATE_WORDS; i++) {
+      copy.words[i] = __atomic_load_n(&published.words[i], __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&sequence, __ATOMIC_RELAXED);
+  } while ((before & 1) || before != after);
+
+  *state = copy.state;
+}
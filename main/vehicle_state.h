@@ -0,0 +1,61 @@
+#ifndef VEHICLE_STATE_H
+#define VEHICLE_STATE_H
+
+/**
+ * Latest decoded vehicle signals, published by the CAN task and readable from any task without
+ * locks or queues. Publishing goes through a sequence lock: the single writer makes the sequence
+ * odd while it updates the state, and readers retry whenever the sequence was odd or changed
+ * while they copied it. Only depends on the C standard library and GCC atomic builtins.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "can_signals.h"
+#include "signal_filter.h"
+
+typedef struct {
+  uint32_t version;                   /* Number of published updates, 0 if nothing was received yet */
+  int64_t updated_us;                 /* Reception time of the frame behind the last update */
+  uint32_t signals[CAN_SIGNAL_COUNT]; /* Raw signal values, indexed by can_signal_id_t */
+  int32_t filtered[CAN_SIGNAL_COUNT]; /* Filtered signal values in Q8 (see signal_filter.h), indexed by can_signal_id_t */
+} vehicle_state_t;
+
+/**
+ * @brief Publishes new signal values, must only be called from a single task (the CAN task).
+ *
+ * @param signals    Raw signal values, CAN_SIGNAL_COUNT entries.
+ * @param filtered   Filtered signal values in Q8, CAN_SIGNAL_COUNT entries.
+ * @param updated_us Reception time of the frame that produced the values.
+ */
+void vehicle_state_publish(const uint32_t *signals, const int32_t *filtered, int64_t updated_us);
+
+/**
+ * @brief Copies a consistent snapshot of the vehicle state, may be called from any task.
+ *
+ * Never blocks the writer, the copy is retried if it overlapped with an update.
+ */
+void vehicle_state_read(vehicle_state_t *state);
+
+/* Physical value of a filtered signal (filtered raw value * scale + offset) */
+static inline float vehicle_state_filtered_physical(const vehicle_state_t *state, can_signal_id_t signal) {
+  const can_signal_def_t *def = can_signals_get_def(signal);
+  return ((float) state->filtered[signal] / SIGNAL_FILTER_ONE) * def->scale + def->offset;
+}
+
+static inline bool vehicle_state_standard_ui(const vehicle_state_t *state) {
+  return state->signals[CAN_SIGNAL_DISPLAY_STANDARD_UI] != 0;
+}
+
+static inline bool vehicle_state_ambient_enabled(const vehicle_state_t *state) {
+  return state->signals[CAN_SIGNAL_AMBIENT_LIGHT] != 0;
+}
+
+static inline bool vehicle_state_left_turn(const vehicle_state_t *state) {
+  return state->signals[CAN_SIGNAL_LEFT_TURN_SIGNAL] != 0;
+}
+
+static inline bool vehicle_state_right_turn(const vehicle_state_t *state) {
+  return state->signals[CAN_SIGNAL_RIGHT_TURN_SIGNAL] != 0;
+}
+
+#endif
@@ -0,0 +1,490 @@
+/**
+ * Replays candump captures through the CAN frame handler on Linux.
+ *
+ * The frame handler, signal database and filter synthesis are the same sources the firmware is
+ * built from, so a capture from a drive can be used to regression-test both the light actions
+ * (compare the -o output between revisions) and the decode throughput.
+ *
+ * Build from the repository root:
+ *   gcc -O2 -Wall -Imain -o can_replay tools/can_replay/can_replay.c tools/can_replay/flight_log_file.c \
+ *       main/can_frame_handler.c main/can_signals.c main/can_filter.c main/can_bus_stats.c main/deferred_log.c \
+ *       main/signal_filter.c main/flight_log.c
+ *
+ * Add -DPORTABLE_LOG_LEVEL=3 to see the frame handler's log messages (4 includes frame dumps), and
+ * -DCAN_LIGHT_DEBOUNCE_MS=<ms> to replace every debounce time of CAN_LIGHT_INPUT_TABLE.
+ *
+ * tools/can_replay/check.sh replays testdata/drive.log with the table's debounce times and with
+ * debouncing disabled, and diffs the light actions against the expected ones.
+ *
+ * Usage:
+ *   can_replay [-s speed] [-r repeat] [-o actions.log] [-f flightlog.bin [-k size_kb]] capture.log
+ *
+ *   -s  Playback speed relative to the capture timestamps, 1 replays in real time, 10 ten times
+ *       faster. 0 (default) processes the frames back-to-back.
+ *   -r  Number of back-to-back passes used for the throughput measurement (default 10).
+ *   -o  File the resulting light actions are written to (default stdout), one line per action with
+ *       the time and ID of the frame that fired it and the origin of its CAN-to-LED latency, the
+ *       first frame showing the level (earlier by up to the debounce time).
+ *   -f  Also record the changed frames and light state transitions into a file backed flight log
+ *       (created erased if missing), as the device does in its "canlog" partition, then reopen it
+ *       to check recovery, including a torn record. Reports the write throughput.
+ *   -k  Size of the flight log in KB (default 512, as in partitions.csv).
+ *
+ * Both `candump -l` lines "(1700000000.123456) can0 3F5#0011223344556677" and `candump -ta`
+ * lines "(1700000000.123456)  can0  3F5   [8]  00 11 22 33 44 55 66 77" are accepted.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "can_frame_handler.h"
+#include "can_filter.h"
+#include "can_bus_stats.h"
+#include "flight_log.h"
+#include "flight_log_file.h"
+
+/* Most frames per second of a 500 kbit/s bus, for data frames without payload (47 bits + 3 bit interframe space) */
+#define SATURATED_FRAMES_PER_SECOND (500000.0 / 50.0)
+
+#define LATENCY_BUCKETS 32
+
+/* Flight log batches, one 256 byte flash page as on the device, and the LightState values recorded */
+#define FLIGHT_BATCH_RECORDS (256 / FLIGHT_LOG_RECORD_SIZE)
+#define LIGHT_STATE_ON 0
+#define LIGHT_STATE_OFF 2
+
+typedef struct {
+  flight_log_t log;
+  flight_record_t batch[FLIGHT_BATCH_RECORDS];
+  size_t pending;
+  uint64_t write_ns;
+  uint32_t written;
+  flight_record_t last;
+  bool failed;
+} flight_recorder_t;
+
+typedef struct {
+  double timestamp;
+  can_frame_t frame;
+} logged_frame_t;
+
+/* Light state simulated from the actions, and where the actions are recorded */
+typedef struct {
+  bool on;
+  FILE *output;
+  flight_recorder_t *recorder;
+} replay_lights_t;
+
+static const char *action_names[] = {
+  [CAN_LIGHT_ACTION_FADE_ON] = "fade_on",
+  [CAN_LIGHT_ACTION_FADE_OFF] = "fade_off",
+  [CAN_LIGHT_ACTION_STARTUP_SEQUENCE] = "startup_sequence",
+  [CAN_LIGHT_ACTION_NONE] = "none",
+};
+
+static inline uint64_t now_ns(void);
+
+static void flight_recorder_flush(flight_recorder_t *recorder) {
+  uint64_t start = now_ns();
+  recorder->failed |= !flight_log_append(&recorder->log, recorder->batch, recorder->pending);
+  recorder->write_ns += now_ns() - start;
+  recorder->written += recorder->pending;
+  recorder->pending = 0;
+}
+
+static void flight_recorder_add(flight_recorder_t *recorder, flight_record_type_t type, int64_t timestamp_us,
+                                uint32_t identifier, const uint8_t *data, uint8_t length) {
+  flight_record_init(&recorder->batch[recorder->pending], type, timestamp_us, identifier, data, length);
+  recorder->last = recorder->batch[recorder->pending++];
+  if (recorder->pending == FLIGHT_BATCH_RECORDS) {
+    flight_recorder_flush(recorder);
+  }
+}
+
+static void record_action(can_light_action_t action, const can_frame_t *frame, int64_t origin_us, void *context) {
+  replay_lights_t *lights = (replay_lights_t *) context;
+  bool on = (action != CAN_LIGHT_ACTION_FADE_OFF);
+  if (lights->recorder != NULL && on != lights->on) {
+    uint8_t state = on ? LIGHT_STATE_ON : LIGHT_STATE_OFF;
+    flight_recorder_add(lights->recorder, FLIGHT_RECORD_LIGHT_STATE, frame->timestamp_us, 0, &state, 1);
+  }
+  lights->on = on;
+  if (lights->output != NULL) {
+    fprintf(lights->output, "%.6f %03X %s origin %.6f\n", frame->timestamp_us / 1e6, (unsigned) frame->identifier,
+            action_names[action], origin_us / 1e6);
+  }
+}
+
+static bool lights_off(void *context) {
+  return !((replay_lights_t *) context)->on;
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  c = tolower((unsigned char) c);
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+static bool parse_hex_bytes(const char *text, uint8_t *data, uint8_t *dlc) {
+  *dlc = 0;
+  while (*text != '\0' && *text != '\n') {
+    if (isspace((unsigned char) *text)) {
+      text++;
+      continue;
+    }
+    int high = hex_value(text[0]);
+    int low = (high < 0) ? -1 : hex_value(text[1]);
+    if (low < 0 || *dlc >= CAN_FRAME_MAX_DLC) {
+      return false;
+    }
+    data[(*dlc)++] = (high << 4) | low;
+    text += 2;
+  }
+  return true;
+}
+
+/* Parse a single candump line, returning false for blank, remote, CAN FD or malformed lines */
+static bool parse_line(const char *line, logged_frame_t *entry) {
+  memset(entry, 0, sizeof(logged_frame_t));
+  if (sscanf(line, " (%lf)", &entry->timestamp) == 1) {
+    line = strchr(line, ')') + 1;
+    entry->frame.timestamp_us = (int64_t) (entry->timestamp * 1e6 + 0.5);
+  }
+
+  char interface[32], id[16];
+  int consumed = 0;
+  if (sscanf(line, " %31s %15[0-9A-Fa-f]%n", interface, id, &consumed) != 2) {
+    return false;
+  }
+  line += consumed;
+  entry->frame.identifier = strtoul(id, NULL, 16);
+  entry->frame.extd = strlen(id) > 3;
+
+  if (line[0] == '#') {
+    /* candump -l: ID#DATA, with R for remote frames and ## for CAN FD */
+    if (line[1] == 'R' || line[1] == '#') {
+      return false;
+    }
+    return parse_hex_bytes(line + 1, entry->frame.data, &entry->frame.dlc);
+  }
+
+  int dlc;
+  if (sscanf(line, " [%d]%n", &dlc, &consumed) != 1 || strstr(line, "remote request") != NULL) {
+    return false;
+  }
+  return parse_hex_bytes(line + consumed, entry->frame.data, &entry->frame.dlc) && entry->frame.dlc == dlc;
+}
+
+static logged_frame_t *load_capture(const char *path, size_t *count) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror(path);
+    return NULL;
+  }
+
+  size_t capacity = 4096;
+  logged_frame_t *frames = malloc(capacity * sizeof(logged_frame_t));
+  char line[256];
+  *count = 0;
+  while (frames != NULL && fgets(line, sizeof(line), file) != NULL) {
+    if (*count == capacity) {
+      capacity *= 2;
+      logged_frame_t *grown = realloc(frames, capacity * sizeof(logged_frame_t));
+      if (grown == NULL) {
+        free(frames);
+        frames = NULL;
+        break;
+      }
+      frames = grown;
+    }
+    if (parse_line(line, &frames[*count])) {
+      (*count)++;
+    }
+  }
+
+  fclose(file);
+  return frames;
+}
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline) {
+  uint64_t now = now_ns();
+  if (deadline > now) {
+    struct timespec ts = {(deadline - now) / 1000000000ull, (deadline - now) % 1000000000ull};
+    nanosleep(&ts, NULL);
+  }
+}
+
+/* Value below which the given fraction of the samples in a log2 latency histogram lies */
+static uint64_t histogram_percentile(const uint64_t *buckets, uint64_t samples, double fraction) {
+  uint64_t seen = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += buckets[i];
+    if (seen >= samples * fraction) {
+      return 1ull << i;
+    }
+  }
+  return 1ull << (LATENCY_BUCKETS - 1);
+}
+
+/* Report how the synthesized acceptance filter performs against the capture's identifiers */
+static void report_filter(const logged_frame_t *frames, size_t count) {
+  static uint32_t histogram[CAN_STANDARD_ID_COUNT];
+  static uint32_t log_ids[CAN_STANDARD_ID_COUNT];
+  static uint32_t log_counts[CAN_STANDARD_ID_COUNT];
+  for (size_t i = 0; i < count; i++) {
+    if (!frames[i].frame.extd) {
+      histogram[frames[i].frame.identifier & (CAN_STANDARD_ID_COUNT - 1)]++;
+    }
+  }
+
+  size_t entries = 0;
+  for (uint32_t id = 0; id < CAN_STANDARD_ID_COUNT; id++) {
+    if (histogram[id] != 0) {
+      log_ids[entries] = id;
+      log_counts[entries++] = histogram[id];
+    }
+  }
+
+  uint32_t watched_ids[CAN_SIGNAL_COUNT];
+  size_t watched = can_signals_watched_ids(watched_ids, CAN_SIGNAL_COUNT);
+  can_filter_config_t filter;
+  can_filter_report_t report;
+  can_filter_synthesize(watched_ids, watched, &filter);
+  can_filter_evaluate(&filter, watched_ids, watched, log_ids, log_counts, entries, &report);
+
+  printf("filter: %s code 0x%08X mask 0x%08X, accepts %u IDs\n", filter.single_filter ? "single" : "dual",
+         filter.acceptance_code, filter.acceptance_mask, can_filter_accepted_id_count(&filter));
+  printf("filter: %u of %u frames accepted, %u watched, %u false accepts (%.2f%% of accepted)\n",
+         report.accepted_frames, report.total_frames, report.watched_frames, report.false_accepts,
+         report.accepted_frames ? (100.0 * report.false_accepts) / report.accepted_frames : 0.0);
+}
+
+/* Bus load and the statistics of the watched identifiers, as the sniffer task would report them */
+static void report_bus_stats(const logged_frame_t *frames, size_t count) {
+  static can_bus_stats_t stats;
+  can_bus_stats_init(&stats, 500000);
+
+  uint64_t total_bits = 0;
+  for (size_t i = 0; i < count; i++) {
+    can_bus_stats_record(&stats, &frames[i].frame);
+    can_bus_stats_tick(&stats, frames[i].frame.timestamp_us, 0);
+    total_bits += can_bus_stats_frame_bits(&frames[i].frame);
+  }
+
+  int64_t duration_us = frames[count - 1].frame.timestamp_us - frames[0].frame.timestamp_us;
+  printf("bus: %u IDs (%u frames untracked), average load %.1f%%, peak %.1f%% over %d ms windows\n", stats.tracked_ids,
+         stats.untracked_frames, duration_us > 0 ? (100.0 * total_bits) / (500000.0 * duration_us / 1e6) : 0.0,
+         stats.peak_load_permille / 10.0, CAN_BUS_STATS_WINDOW_US / 1000);
+
+  uint32_t watched_ids[CAN_SIGNAL_COUNT];
+  size_t watched = can_signals_watched_ids(watched_ids, CAN_SIGNAL_COUNT);
+  for (size_t w = 0; w < watched; w++) {
+    for (size_t i = 0; i < CAN_BUS_STATS_MAX_IDS; i++) {
+      const can_id_stats_t *entry = &stats.ids[i];
+      if (entry->used && !entry->extd && entry->identifier == watched_ids[w]) {
+        printf("bus: 0x%03X %u frames, %.2f Hz, interval %.2f ms, jitter %.2f ms\n", entry->identifier, entry->frames,
+               can_bus_stats_rate_mhz(entry) / 1000.0, entry->interval_q / (1000.0 * (1 << CAN_BUS_STATS_Q)),
+               entry->jitter_q / (1000.0 * (1 << CAN_BUS_STATS_Q)));
+      }
+    }
+  }
+}
+
+/* Record the capture into a file backed flight log, then check that a reopened log recovers it */
+static bool replay_flight_log(const char *path, uint32_t size, const logged_frame_t *frames, size_t count) {
+  flight_log_storage_t storage;
+  flight_recorder_t recorder = {0};
+  if (!flight_log_file_open(path, size, &storage) || !flight_log_open(&recorder.log, &storage)) {
+    fprintf(stderr, "%s: cannot open flight log\n", path);
+    return false;
+  }
+
+  replay_lights_t lights = {.on = false, .output = NULL, .recorder = &recorder};
+  const can_light_actions_t actions = {.perform = record_action, .lights_off = lights_off, .context = &lights};
+  can_frame_handler_t handler;
+  can_frame_handler_init(&handler, &actions);
+
+  uint8_t reason = 1;
+  flight_recorder_add(&recorder, FLIGHT_RECORD_BOOT, frames[0].frame.timestamp_us, 0, &reason, 1);
+  for (size_t i = 0; i < count; i++) {
+    if (can_frame_handler_process(&handler, &frames[i].frame)) {
+      flight_recorder_add(&recorder, FLIGHT_RECORD_CAN_FRAME, frames[i].frame.timestamp_us, frames[i].frame.identifier,
+                          frames[i].frame.data, frames[i].frame.dlc);
+    }
+  }
+  flight_recorder_flush(&recorder);
+  flight_log_file_close(&storage);
+  if (recorder.failed) {
+    fprintf(stderr, "%s: flight log write failed\n", path);
+    return false;
+  }
+  printf("flight log: %u records written in %.3f ms (%.0f records/s)\n", recorder.written, recorder.write_ns / 1e6,
+         recorder.written / (recorder.write_ns / 1e9));
+
+  /* Reopen as after a reset, and read everything back */
+  flight_log_t reopened;
+  uint64_t start = now_ns();
+  if (!flight_log_file_open(path, size, &storage) || !flight_log_open(&reopened, &storage)) {
+    fprintf(stderr, "%s: cannot reopen flight log\n", path);
+    return false;
+  }
+  uint64_t open_ns = now_ns() - start;
+
+  flight_log_cursor_t cursor;
+  flight_record_t records[64], last = {0};
+  size_t read, retained = 0;
+  flight_log_cursor_init(&reopened, &cursor);
+  while ((read = flight_log_read(&reopened, &cursor, records, 64)) > 0) {
+    retained += read;
+    last = records[read - 1];
+  }
+  bool recovered = reopened.head_sequence == recorder.log.head_sequence && reopened.head_slot == recorder.log.head_slot &&
+                   memcmp(&last, &recorder.last, sizeof(last)) == 0;
+  printf("flight log: recovered in %.3f ms at sequence %u slot %u, %zu records retained (capacity %u), last record %s\n",
+         open_ns / 1e6, reopened.head_sequence, reopened.head_slot, retained, flight_log_capacity(&reopened),
+         recovered ? "intact" : "MISMATCH");
+
+  /* Tear the next record as a reset in the middle of a flash write would, it must be skipped and appended after */
+  const uint8_t torn[FLIGHT_LOG_RECORD_SIZE / 2] = {0};
+  uint32_t torn_sector = reopened.head_sector;
+  uint32_t torn_slot = reopened.head_slot;
+  if (torn_slot == FLIGHT_LOG_RECORDS_PER_SECTOR) {
+    flight_log_append(&reopened, &recorder.last, 1); /* Move to a fresh sector first */
+    torn_sector = reopened.head_sector;
+    torn_slot = reopened.head_slot;
+    retained = 0;
+  }
+  storage.write(storage.context, torn_sector * FLIGHT_LOG_SECTOR_SIZE + FLIGHT_LOG_HEADER_SIZE + torn_slot * FLIGHT_LOG_RECORD_SIZE,
+                torn, sizeof(torn));
+  flight_log_file_close(&storage);
+
+  flight_log_t torn_log;
+  if (!flight_log_file_open(path, size, &storage) || !flight_log_open(&torn_log, &storage)) {
+    fprintf(stderr, "%s: cannot reopen flight log\n", path);
+    return false;
+  }
+  bool torn_skipped = torn_log.head_slot == torn_slot + 1;
+  flight_log_cursor_init(&torn_log, &cursor);
+  while ((read = flight_log_read(&torn_log, &cursor, records, 64)) > 0) {
+    last = records[read - 1];
+  }
+  torn_skipped = torn_skipped && memcmp(&last, &recorder.last, sizeof(last)) == 0;
+  printf("flight log: torn record %s\n", torn_skipped ? "skipped" : "NOT SKIPPED");
+  flight_log_file_close(&storage);
+
+  return recovered && torn_skipped;
+}
+
+int main(int argc, char **argv) {
+  double speed = 0;
+  int repeat = 10;
+  const char *output_path = NULL;
+  const char *flight_log_path = NULL;
+  uint32_t flight_log_size = 512 * 1024;
+
+  int option;
+  while ((option = getopt(argc, argv, "s:r:o:f:k:")) != -1) {
+    switch (option) {
+      case 's': speed = atof(optarg); break;
+      case 'r': repeat = atoi(optarg); break;
+      case 'o': output_path = optarg; break;
+      case 'f': flight_log_path = optarg; break;
+      case 'k': flight_log_size = atoi(optarg) * 1024; break;
+      default:
+        fprintf(stderr, "usage: %s [-s speed] [-r repeat] [-o actions.log] [-f flightlog.bin [-k size_kb]] capture.log\n", argv[0]);
+        return 2;
+    }
+  }
+  if (optind >= argc || repeat < 1) {
+    fprintf(stderr, "usage: %s [-s speed] [-r repeat] [-o actions.log] [-f flightlog.bin [-k size_kb]] capture.log\n", argv[0]);
+    return 2;
+  }
+
+  size_t count;
+  logged_frame_t *frames = load_capture(argv[optind], &count);
+  if (frames == NULL) {
+    return 1;
+  }
+  if (count == 0) {
+    fprintf(stderr, "%s: no frames\n", argv[optind]);
+    free(frames);
+    return 1;
+  }
+
+  can_signals_init();
+
+  replay_lights_t lights = {.on = false, .output = stdout, .recorder = NULL};
+  if (output_path != NULL && (lights.output = fopen(output_path, "w")) == NULL) {
+    perror(output_path);
+    free(frames);
+    return 1;
+  }
+  const can_light_actions_t actions = {.perform = record_action, .lights_off = lights_off, .context = &lights};
+
+  /* First pass: record the light actions, paced by the capture timestamps if requested */
+  can_frame_handler_t handler;
+  can_frame_handler_init(&handler, &actions);
+  uint64_t latency_buckets[LATENCY_BUCKETS] = {0};
+  uint64_t latency_max = 0;
+  uint64_t start = now_ns();
+  for (size_t i = 0; i < count; i++) {
+    if (speed > 0) {
+      sleep_until_ns(start + (uint64_t) (((frames[i].timestamp - frames[0].timestamp) / speed) * 1e9));
+    }
+
+    uint64_t before = now_ns();
+    can_frame_handler_process(&handler, &frames[i].frame);
+    uint64_t latency = now_ns() - before;
+
+    int bucket = (latency == 0) ? 0 : 64 - __builtin_clzll(latency);
+    latency_buckets[(bucket < LATENCY_BUCKETS) ? bucket : LATENCY_BUCKETS - 1]++;
+    if (latency > latency_max) {
+      latency_max = latency;
+    }
+  }
+  if (output_path != NULL) {
+    fclose(lights.output);
+  }
+
+  /* Throughput passes: back-to-back processing with the actions only simulated */
+  lights.output = NULL;
+  uint64_t busy = 0;
+  for (int pass = 0; pass < repeat; pass++) {
+    can_frame_handler_init(&handler, &actions);
+    lights.on = false;
+    uint64_t pass_start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+      can_frame_handler_process(&handler, &frames[i].frame);
+    }
+    busy += now_ns() - pass_start;
+  }
+
+  double frames_per_second = (double) count * repeat / (busy / 1e9);
+  printf("frames: %zu over %.3f s of capture\n", count, frames[count - 1].timestamp - frames[0].timestamp);
+  printf("throughput: %.0f frames/s (%.1fx a saturated 500 kbit/s bus)\n",
+         frames_per_second, frames_per_second / SATURATED_FRAMES_PER_SECOND);
+  printf("latency: p50 < %llu ns, p99 < %llu ns, max %llu ns\n",
+         (unsigned long long) histogram_percentile(latency_buckets, count, 0.50),
+         (unsigned long long) histogram_percentile(latency_buckets, count, 0.99),
+         (unsigned long long) latency_max);
+  report_filter(frames, count);
+  report_bus_stats(frames, count);
+
+  bool flight_log_ok = true;
+  if (flight_log_path != NULL) {
+    flight_log_ok = replay_flight_log(flight_log_path, flight_log_size, frames, count);
+  }
+
+  free(frames);
+  return flight_log_ok ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Regression check of the CAN light reactions: replays testdata/drive.log through can_replay,
+# built with the debounce times of CAN_LIGHT_INPUT_TABLE and with debouncing disabled, and diffs
+# the resulting light actions against the expected ones in testdata. Exits non-zero on any
+# difference.
+#
+# Run from the repository root:
+#   sh tools/can_replay/check.sh
+#
+# After an intended change of the light reactions, review the printed diff and copy the new
+# actions (kept in the temporary directory named on failure) over the expected files.
+
+CC=${CC:-gcc}
+DIR=tools/can_replay
+SOURCES="$DIR/can_replay.c $DIR/flight_log_file.c main/can_frame_handler.c main/can_signals.c main/can_filter.c \
+  main/can_bus_stats.c main/deferred_log.c main/signal_filter.c main/flight_log.c"
+WORK=$(mktemp -d)
+FAILED=0
+
+# check <name> <expected actions> [extra compiler flags]
+check() {
+  name=$1
+  expected=$2
+  shift 2
+  if ! $CC -O2 -Wall -Imain -I$DIR "$@" -o "$WORK/$name" $SOURCES; then
+    echo "$name: build failed"
+    FAILED=1
+    return
+  fi
+  if ! "$WORK/$name" -r 1 -o "$WORK/$name.txt" $DIR/testdata/drive.log > /dev/null; then
+    echo "$name: replay failed"
+    FAILED=1
+  elif diff -u "$expected" "$WORK/$name.txt"; then
+    echo "$name: actions match"
+  else
+    FAILED=1
+  fi
+}
+
+check default $DIR/testdata/drive_actions.txt
+check debounce0 $DIR/testdata/drive_actions_debounce0.txt -DCAN_LIGHT_DEBOUNCE_MS=0
+
+if [ $FAILED -ne 0 ]; then
+  echo "Light actions differ, new outputs in $WORK"
+  exit 1
+fi
+rm -rf "$WORK"
@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "flight_log_file.h"
+
+static bool file_read(void *context, uint32_t offset, void *buffer, size_t length) {
+  FILE *file = (FILE *) context;
+  return fseek(file, offset, SEEK_SET) == 0 && fread(buffer, 1, length, file) == length;
+}
+
+static bool file_write(void *context, uint32_t offset, const void *buffer, size_t length) {
+  FILE *file = (FILE *) context;
+  uint8_t current[FLIGHT_LOG_SECTOR_SIZE];
+  const uint8_t *bytes = (const uint8_t *) buffer;
+
+  while (length > 0) {
+    size_t chunk = (length < sizeof(current)) ? length : sizeof(current);
+    if (!file_read(context, offset, current, chunk)) {
+      return false;
+    }
+    /* Programming flash only clears bits */
+    for (size_t i = 0; i < chunk; i++) {
+      current[i] &= bytes[i];
+    }
+    if (fseek(file, offset, SEEK_SET) != 0 || fwrite(current, 1, chunk, file) != chunk) {
+      return false;
+    }
+    offset += chunk;
+    bytes += chunk;
+    length -= chunk;
+  }
+  return true;
+}
+
+static bool file_erase_sector(void *context, uint32_t offset) {
+  FILE *file = (FILE *) context;
+  uint8_t erased[FLIGHT_LOG_SECTOR_SIZE];
+  memset(erased, 0xFF, sizeof(erased));
+  return fseek(file, offset, SEEK_SET) == 0 && fwrite(erased, 1, sizeof(erased), file) == sizeof(erased);
+}
+
+bool flight_log_file_open(const char *path, uint32_t size, flight_log_storage_t *storage) {
+  FILE *file = fopen(path, "r+b");
+  if (file == NULL) {
+    /* A new file starts out erased */
+    file = fopen(path, "w+b");
+    if (file == NULL) {
+      return false;
+    }
+    for (uint32_t offset = 0; offset < size; offset += FLIGHT_LOG_SECTOR_SIZE) {
+      if (!file_erase_sector(file, offset)) {
+        fclose(file);
+        return false;
+      }
+    }
+  }
+
+  *storage = (flight_log_storage_t) {
+    .read = file_read,
+    .write = file_write,
+    .erase_sector = file_erase_sector,
+    .size = size,
+    .context = file,
+  };
+  return true;
+}
+
+void flight_log_file_close(flight_log_storage_t *storage) {
+  fclose((FILE *) storage->context);
+  storage->context = NULL;
+}
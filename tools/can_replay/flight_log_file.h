@@ -0,0 +1,20 @@
+#ifndef FLIGHT_LOG_FILE_H
+#define FLIGHT_LOG_FILE_H
+
+#include <stdio.h>
+
+#include "flight_log.h"
+
+/**
+ * @brief Opens (creating it if needed) a file emulating a NOR flash log area of the given size.
+ *
+ * Erasing fills a sector with 0xFF and writing can only clear bits, as on flash, so recovery
+ * after an interrupted write behaves like on the device.
+ *
+ * @return false if the file cannot be opened or sized.
+ */
+bool flight_log_file_open(const char *path, uint32_t size, flight_log_storage_t *storage);
+
+void flight_log_file_close(flight_log_storage_t *storage);
+
+#endif
@@ -0,0 +1,2 @@
+/* libraries/cJson.c includes "cJSON.h", which only resolves on case-insensitive file systems */
+#include "../../libraries/cJson.h"
@@ -0,0 +1,272 @@
+/**
+ * Compares the zero-allocation /api request parser with the bundled cJSON on Linux, with cJSON
+ * allocating from the heap and from the per-request arena the HTTP server uses.
+ *
+ * Each payload is parsed every way, the results are checked against each other, and the time per
+ * parse is reported, along with the heap traffic per parse (counted through cJSON_InitHooks) and
+ * the arena bytes a parse takes. The cJSON
+ * side extracts the fields the way the firmware's /api handler used to, with the scanner's rules
+ * where that handler relied on undefined behavior or accepted junk: numbers are clamped to 0-255,
+ * and bodies that are not a single object are rejected.
+ *
+ * Build from the repository root:
+ *   gcc -O2 -Wall -Imain -Ilibraries -Itools/json_bench -o json_bench tools/json_bench/json_bench.c main/command_json.c \
+ *       main/json_arena.c libraries/cJson.c -lm
+ *
+ * Usage:
+ *   json_bench [-n iterations] [payload.json ...]
+ *
+ *   -n  Parses per payload and parser (default 200000).
+ *
+ * Without payload files, a built-in set of representative requests is used.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cJson.h"
+#include "command_json.h"
+#include "json_arena.h"
+
+/* Arena large enough for the largest built-in payload */
+#define ARENA_SIZE (16 * 1024)
+
+typedef struct {
+  const char *name;
+  const char *json;
+} payload_t;
+
+static const payload_t builtin_payloads[] = {
+  {"color", "{\"red\":255,\"green\":128,\"blue\":0}"},
+  {"color, formatted", "{\n  \"red\": 12,\n  \"green\": 200,\n  \"blue\": 99,\n  \"client\": \"web\"\n}"},
+  {"gradient, 3 stops",
+   "{\"red\":0,\"green\":0,\"blue\":0,\"gradient\":[{\"position\":0,\"red\":255,\"green\":0,\"blue\":0},"
+   "{\"position\":128,\"red\":0,\"green\":255,\"blue\":0},{\"position\":255,\"red\":0,\"green\":0,\"blue\":255}]}"},
+  {"gradient, 8 stops",
+   "{\"gradient\":[{\"position\":0,\"red\":1,\"green\":2,\"blue\":3},{\"position\":36,\"red\":4,\"green\":5,\"blue\":6},"
+   "{\"position\":72,\"red\":7,\"green\":8,\"blue\":9},{\"position\":108,\"red\":10,\"green\":11,\"blue\":12},"
+   "{\"position\":144,\"red\":13,\"green\":14,\"blue\":15},{\"position\":180,\"red\":16,\"green\":17,\"blue\":18},"
+   "{\"position\":216,\"red\":19,\"green\":20,\"blue\":21},{\"position\":255,\"red\":22,\"green\":23,\"blue\":24}]}"},
+};
+
+/* Arena the cJSON parses allocate from, NULL while cJSON uses the counting heap hooks */
+static json_arena_t *active_arena = NULL;
+
+/* Heap traffic of cJSON, counted with a size header in front of every block */
+static size_t allocations = 0;
+static size_t allocated_bytes = 0;
+
+static void *counting_malloc(size_t size) {
+  size_t *block = malloc(sizeof(size_t) + size);
+  if (block == NULL) {
+    return NULL;
+  }
+  *block = size;
+  allocations++;
+  allocated_bytes += size;
+  return block + 1;
+}
+
+static void counting_free(void *pointer) {
+  if (pointer != NULL) {
+    free((size_t *) pointer - 1);
+  }
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Numeric field clamped to 0-255, 0 if missing or not a number */
+static uint8_t color_value(const cJSON *object, const char *key) {
+  const cJSON *item = cJSON_GetObjectItemCaseSensitive(object, key);
+  if (!cJSON_IsNumber(item) || !(item->valuedouble > 0.0)) {
+    return 0;
+  }
+  return (item->valuedouble >= 255.0) ? 255 : (uint8_t) item->valuedouble;
+}
+
+static bool only_whitespace(const char *text, const char *end) {
+  for (; text < end; text++) {
+    if (*text != ' ' && *text != '\t' && *text != '\n' && *text != '\r') {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Free a tree node by node, or reset the arena it came from */
+static void release_tree(cJSON *root) {
+  if (active_arena != NULL) {
+    json_arena_end();
+  } else {
+    cJSON_Delete(root);
+  }
+}
+
+/* Same extraction as the firmware's former cJSON based /api handler */
+static bool parse_with_cjson(const char *json, size_t length, command_json_request_t *request) {
+  memset(request, 0, sizeof(*request));
+  if (active_arena != NULL) {
+    json_arena_begin(active_arena);
+  }
+  const char *parse_end = NULL;
+  cJSON *root = cJSON_ParseWithLengthOpts(json, length, &parse_end, false);
+  if (root == NULL) {
+    release_tree(NULL);
+    return false;
+  }
+  if (!cJSON_IsObject(root) || !only_whitespace(parse_end, json + length)) {
+    release_tree(root);
+    return false;
+  }
+  request->red = color_value(root, "red");
+  request->green = color_value(root, "green");
+  request->blue = color_value(root, "blue");
+
+  const cJSON *gradient = cJSON_GetObjectItemCaseSensitive(root, "gradient");
+  const cJSON *item;
+  if (cJSON_IsArray(gradient)) {
+    cJSON_ArrayForEach(item, gradient) {
+      if (request->num_stops == COMMAND_JSON_MAX_STOPS) {
+        break;
+      }
+      if (!cJSON_IsObject(item)) {
+        release_tree(root);
+        return false;
+      }
+      command_json_stop_t *stop = &request->stops[request->num_stops];
+      stop->position = color_value(item, "position");
+      stop->red = color_value(item, "red");
+      stop->green = color_value(item, "green");
+      stop->blue = color_value(item, "blue");
+      if (request->num_stops > 0 && stop->position < request->stops[request->num_stops - 1].position) {
+        request->num_stops = 0;
+        break;
+      }
+      request->num_stops++;
+    }
+  }
+  release_tree(root);
+  return true;
+}
+
+static bool same_request(const command_json_request_t *a, const command_json_request_t *b) {
+  if (a->red != b->red || a->green != b->green || a->blue != b->blue || a->num_stops != b->num_stops) {
+    return false;
+  }
+  return memcmp(a->stops, b->stops, a->num_stops * sizeof(command_json_stop_t)) == 0;
+}
+
+/* Keeps the optimizer from dropping the parses */
+static volatile uint32_t sink;
+
+static bool bench_payload(const char *name, const char *json, size_t length, long iterations) {
+  static uint8_t arena_buffer[ARENA_SIZE];
+  json_arena_t arena;
+  json_arena_init(&arena, arena_buffer, sizeof(arena_buffer));
+
+  command_json_request_t scanned;
+  command_json_request_t tree;
+  cJSON_Hooks hooks = {counting_malloc, counting_free};
+  cJSON_InitHooks(&hooks);
+  bool scanned_valid = command_json_parse(json, length, &scanned);
+  bool tree_valid = parse_with_cjson(json, length, &tree);
+  if (scanned_valid != tree_valid || (scanned_valid && !same_request(&scanned, &tree))) {
+    printf("%-20s MISMATCH (scanner %s, cJSON %s)\n", name, scanned_valid ? "valid" : "invalid",
+           tree_valid ? "valid" : "invalid");
+    return false;
+  }
+
+  uint64_t start = now_ns();
+  for (long i = 0; i < iterations; i++) {
+    command_json_parse(json, length, &scanned);
+    sink += scanned.red;
+  }
+  double scanner_ns = (double) (now_ns() - start) / iterations;
+
+  cJSON_InitHooks(&hooks);
+  allocations = 0;
+  allocated_bytes = 0;
+  start = now_ns();
+  for (long i = 0; i < iterations; i++) {
+    parse_with_cjson(json, length, &tree);
+    sink += tree.red;
+  }
+  double cjson_ns = (double) (now_ns() - start) / iterations;
+
+  json_arena_install();
+  active_arena = &arena;
+  start = now_ns();
+  for (long i = 0; i < iterations; i++) {
+    parse_with_cjson(json, length, &tree);
+    sink += tree.red;
+  }
+  double arena_ns = (double) (now_ns() - start) / iterations;
+  active_arena = NULL;
+
+  printf("%-18s %4zu B  scanner %6.0f ns   cJSON heap %6.0f ns, %5.1f allocs, %6.0f B   cJSON arena %6.0f ns, %5zu B,"
+         " %zu B spilled\n",
+         name, length, scanner_ns, cjson_ns, (double) allocations / iterations,
+         (double) allocated_bytes / iterations, arena_ns, arena.high_water, arena.max_spilled);
+  return true;
+}
+
+static char *read_file(const char *path, size_t *length) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *data = malloc(size > 0 ? size : 1);
+  if (data != NULL && fread(data, 1, size, file) != (size_t) size) {
+    free(data);
+    data = NULL;
+  }
+  fclose(file);
+  *length = size;
+  return data;
+}
+
+int main(int argc, char **argv) {
+  long iterations = 200000;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n':
+        iterations = atol(optarg);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-n iterations] [payload.json ...]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (iterations <= 0) {
+    iterations = 1;
+  }
+
+  bool ok = true;
+  if (optind == argc) {
+    for (size_t i = 0; i < sizeof(builtin_payloads) / sizeof(builtin_payloads[0]); i++) {
+      ok &= bench_payload(builtin_payloads[i].name, builtin_payloads[i].json, strlen(builtin_payloads[i].json),
+                          iterations);
+    }
+  }
+  for (int i = optind; i < argc; i++) {
+    size_t length;
+    char *json = read_file(argv[i], &length);
+    if (json == NULL) {
+      fprintf(stderr, "Cannot read %s\n", argv[i]);
+      return 1;
+    }
+    ok &= bench_payload(argv[i], json, length, iterations);
+    free(json);
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,374 @@
+/**
+ * Fuzzes and benchmarks the binary light control protocol on Linux.
+ *
+ * The packet parser is the same source the firmware is built from. Random packets and mutations
+ * of valid ones are parsed from heap buffers of their exact length, so a sanitizer build catches
+ * any read past the received bytes. Every packet the parser accepts must decode message by
+ * message to exactly its length and re-encode to the same bytes, and every generated valid packet
+ * must be accepted with the messages it was built from. The decode throughput is reported after
+ * the fuzzing.
+ *
+ * With -u, valid packets are also sent to a device's UDP control port and the acknowledgements
+ * checked, reporting the round trip times. This changes the lights.
+ *
+ * Build from the repository root:
+ *   gcc -O2 -Wall -Imain -o protocol_fuzz tools/protocol_fuzz/protocol_fuzz.c main/light_protocol.c
+ *
+ * Add -g -fsanitize=address,undefined for the fuzzing runs.
+ *
+ * Usage:
+ *   protocol_fuzz [-n iterations] [-s seed] [-u host[:port] [-c count]]
+ *
+ *   -n  Fuzzed packets, and decoded packets for the throughput measurement (default 1000000).
+ *   -s  Random seed (default 1), printed with any failure so it can be reproduced.
+ *   -u  Device to send packets to over UDP, the port defaults to 4210 (CONFIG_UDP_CONTROL_PORT).
+ *   -c  Packets sent with -u (default 100).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "light_protocol.h"
+
+#define DEFAULT_UDP_PORT "4210"
+
+static const uint8_t opcodes[] = {
+#define PROTOCOL_FUZZ_OPCODE(name, opcode, length) opcode,
+  LIGHT_PROTOCOL_MESSAGE_TABLE(PROTOCOL_FUZZ_OPCODE)
+#undef PROTOCOL_FUZZ_OPCODE
+};
+#define NUM_OPCODES (sizeof(opcodes) / sizeof(opcodes[0]))
+
+static uint64_t rng_state;
+
+/* xorshift64*, reproducible across platforms for a given seed */
+static uint32_t next_random(void) {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return (uint32_t) ((rng_state * 0x2545F4914F6CDD1Dull) >> 32);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Valid message with random fields, only the fields its opcode carries are set */
+static light_message_t random_message(void) {
+  light_message_t message;
+  memset(&message, 0, sizeof(message));
+  message.opcode = opcodes[next_random() % NUM_OPCODES];
+  message.zone_mask = next_random();
+  message.red = next_random();
+  message.green = next_random();
+  message.blue = next_random();
+  switch (message.opcode) {
+    case LIGHT_MESSAGE_SET_COLOR:
+      break;
+    case LIGHT_MESSAGE_FADE_TO:
+      message.duration_ms = next_random();
+      break;
+    case LIGHT_MESSAGE_SEQUENTIAL:
+      message.flags = next_random();
+      break;
+    case LIGHT_MESSAGE_EFFECT:
+      message.effect = next_random() % LIGHT_EFFECT_COUNT;
+      message.duration_ms = next_random();
+      break;
+  }
+  return message;
+}
+
+/* Encode a valid packet of random messages, returns its length */
+static size_t random_packet(uint8_t *buffer, light_message_t *messages, uint8_t num_messages) {
+  size_t length = light_protocol_encode_header(num_messages, buffer, LIGHT_PROTOCOL_MAX_PACKET);
+  for (int i = 0; i < num_messages; i++) {
+    messages[i] = random_message();
+    length += light_protocol_encode(&messages[i], buffer + length, LIGHT_PROTOCOL_MAX_PACKET - length);
+  }
+  return length;
+}
+
+static bool same_message(const light_message_t *a, const light_message_t *b) {
+  return a->opcode == b->opcode && a->zone_mask == b->zone_mask && a->red == b->red && a->green == b->green &&
+         a->blue == b->blue && a->flags == b->flags && a->effect == b->effect && a->duration_ms == b->duration_ms;
+}
+
+/* Parse from an exactly sized copy and check the invariants of accepted packets */
+static bool check_packet(const uint8_t *data, size_t length, const light_message_t *expected, long iteration,
+                         uint64_t seed, light_packet_status_t *status) {
+  uint8_t *copy = malloc(length > 0 ? length : 1);
+  memcpy(copy, data, length);
+
+  light_packet_t packet;
+  *status = light_protocol_parse_packet(copy, length, &packet);
+  bool ok = true;
+  if (*status == LIGHT_PACKET_OK) {
+    uint8_t encoded[LIGHT_PROTOCOL_MAX_PACKET];
+    size_t encoded_length = light_protocol_encode_header(packet.num_messages, encoded, sizeof(encoded));
+    size_t offset = 0;
+    for (int i = 0; i < packet.num_messages && ok; i++) {
+      light_message_t message;
+      size_t message_length = light_protocol_decode(packet.messages + offset, packet.length - offset, &message);
+      if (message_length == 0 || (expected != NULL && !same_message(&message, &expected[i]))) {
+        ok = false;
+        break;
+      }
+      offset += message_length;
+      encoded_length += light_protocol_encode(&message, encoded + encoded_length, sizeof(encoded) - encoded_length);
+    }
+    ok = ok && offset == packet.length && encoded_length == length && memcmp(encoded, copy, length) == 0;
+  } else {
+    ok = (expected == NULL);
+  }
+  if (!ok) {
+    printf("FAILED iteration %ld (seed %llu), status %d, %zu bytes:", iteration, (unsigned long long) seed, *status,
+           length);
+    for (size_t i = 0; i < length; i++) {
+      printf(" %02x", data[i]);
+    }
+    printf("\n");
+  }
+  free(copy);
+  return ok;
+}
+
+static bool fuzz(long iterations, uint64_t seed) {
+  static light_message_t messages[255];
+  static uint8_t packet[LIGHT_PROTOCOL_MAX_PACKET + 16];
+  long accepted = 0;
+  long by_status[LIGHT_PACKET_TRAILING + 1] = {0};
+
+  for (long i = 0; i < iterations; i++) {
+    /* Mostly short packets, the way clients batch, with the occasional full one */
+    uint8_t num_messages = (next_random() % 16 == 0) ? next_random() % 256 : next_random() % 8;
+    size_t length = random_packet(packet, messages, num_messages);
+    light_packet_status_t status;
+    const light_message_t *expected = messages;
+
+    switch (i % 4) {
+      case 0:
+        /* Valid as generated */
+        break;
+      case 1: {
+        /* Flip, overwrite, drop or append a few bytes */
+        int mutations = 1 + next_random() % 4;
+        for (int m = 0; m < mutations; m++) {
+          switch (next_random() % 4) {
+            case 0:
+              if (length > 0) {
+                packet[next_random() % length] ^= 1 << (next_random() % 8);
+              }
+              break;
+            case 1:
+              if (length > 0) {
+                packet[next_random() % length] = next_random();
+              }
+              break;
+            case 2:
+              if (length > 0) {
+                length -= next_random() % (length < 16 ? length + 1 : 16);
+              }
+              break;
+            case 3:
+              if (length < sizeof(packet)) {
+                packet[length++] = next_random();
+              }
+              break;
+          }
+        }
+        expected = NULL;
+        break;
+      }
+      case 2:
+        /* Random bytes behind a valid header */
+        length = LIGHT_PROTOCOL_HEADER_LENGTH + next_random() % 64;
+        for (size_t b = LIGHT_PROTOCOL_HEADER_LENGTH; b < length; b++) {
+          packet[b] = next_random();
+        }
+        expected = NULL;
+        break;
+      case 3:
+        /* Random bytes */
+        length = next_random() % 32;
+        for (size_t b = 0; b < length; b++) {
+          packet[b] = next_random();
+        }
+        expected = NULL;
+        break;
+    }
+
+    if (!check_packet(packet, length, expected, i, seed, &status)) {
+      return false;
+    }
+    by_status[status]++;
+    accepted += (status == LIGHT_PACKET_OK);
+  }
+
+  printf("Fuzzed %ld packets: %ld accepted, %ld truncated, %ld bad magic, %ld bad version, %ld bad message, "
+         "%ld trailing\n",
+         iterations, accepted, by_status[LIGHT_PACKET_TRUNCATED], by_status[LIGHT_PACKET_BAD_MAGIC],
+         by_status[LIGHT_PACKET_BAD_VERSION], by_status[LIGHT_PACKET_BAD_MESSAGE], by_status[LIGHT_PACKET_TRAILING]);
+  return true;
+}
+
+/* Keeps the optimizer from dropping the decodes */
+static volatile uint32_t sink;
+
+static void bench(long iterations) {
+  static const uint8_t batch_sizes[] = {1, 8, 64};
+  static light_message_t messages[255];
+  uint8_t packet[LIGHT_PROTOCOL_MAX_PACKET];
+
+  for (size_t b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); b++) {
+    size_t length = random_packet(packet, messages, batch_sizes[b]);
+    long packets = iterations / batch_sizes[b];
+    if (packets == 0) {
+      packets = 1;
+    }
+
+    uint64_t start = now_ns();
+    for (long i = 0; i < packets; i++) {
+      light_packet_t parsed;
+      if (light_protocol_parse_packet(packet, length, &parsed) != LIGHT_PACKET_OK) {
+        return;
+      }
+      size_t offset = 0;
+      for (int m = 0; m < parsed.num_messages; m++) {
+        light_message_t message;
+        offset += light_protocol_decode(parsed.messages + offset, parsed.length - offset, &message);
+        sink += message.red;
+      }
+    }
+    double elapsed_ns = (double) (now_ns() - start);
+    printf("%3u messages per packet (%4zu B): %7.1f ns per packet, %5.1f ns per message, %6.1f M messages/s\n",
+           batch_sizes[b], length, elapsed_ns / packets, elapsed_ns / (packets * (double) batch_sizes[b]),
+           packets * (double) batch_sizes[b] * 1000.0 / elapsed_ns);
+  }
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+/* Send valid packets to a device and check the acknowledgements */
+static bool send_udp(const char *target, long count) {
+  char host[256];
+  snprintf(host, sizeof(host), "%s", target);
+  const char *port = DEFAULT_UDP_PORT;
+  char *colon = strrchr(host, ':');
+  if (colon != NULL) {
+    *colon = '\0';
+    port = colon + 1;
+  }
+
+  struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM};
+  struct addrinfo *address;
+  if (getaddrinfo(host, port, &hints, &address) != 0) {
+    fprintf(stderr, "Cannot resolve %s\n", target);
+    return false;
+  }
+  int sock = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+  if (sock < 0 || connect(sock, address->ai_addr, address->ai_addrlen) < 0) {
+    fprintf(stderr, "Cannot connect to %s\n", target);
+    freeaddrinfo(address);
+    return false;
+  }
+  freeaddrinfo(address);
+  struct timeval timeout = {.tv_sec = 1};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  uint64_t *round_trips = calloc(count, sizeof(uint64_t));
+  long acked = 0;
+  long rejected = 0;
+  long dropped = 0;
+  for (long i = 0; i < count; i++) {
+    /* Set colors only, so a run does not leave a queue of animations behind */
+    uint8_t packet[LIGHT_PROTOCOL_HEADER_LENGTH + 5];
+    light_message_t message = {
+      .opcode = LIGHT_MESSAGE_SET_COLOR,
+      .zone_mask = 0xFF,
+      .red = i * 7,
+      .green = i * 13,
+      .blue = i * 29,
+    };
+    size_t length = light_protocol_encode_header(1, packet, sizeof(packet));
+    length += light_protocol_encode(&message, packet + length, sizeof(packet) - length);
+
+    uint64_t start = now_ns();
+    uint8_t ack[LIGHT_PROTOCOL_ACK_LENGTH + 1];
+    if (send(sock, packet, length, 0) < 0 || recv(sock, ack, sizeof(ack), 0) != LIGHT_PROTOCOL_ACK_LENGTH ||
+        ack[3] != LIGHT_PROTOCOL_ACK) {
+      continue;
+    }
+    round_trips[acked++] = now_ns() - start;
+    rejected += (ack[4] != LIGHT_PACKET_OK);
+    dropped += ack[6];
+  }
+  close(sock);
+
+  if (acked == 0) {
+    printf("No acknowledgements from %s\n", target);
+    free(round_trips);
+    return false;
+  }
+  qsort(round_trips, acked, sizeof(uint64_t), compare_u64);
+  printf("UDP %s: %ld of %ld acknowledged, %ld rejected, %ld commands dropped, round trip p50 %.2f ms, "
+         "p99 %.2f ms, max %.2f ms\n",
+         target, acked, count, rejected, dropped, round_trips[acked / 2] / 1e6, round_trips[acked * 99 / 100] / 1e6,
+         round_trips[acked - 1] / 1e6);
+  free(round_trips);
+  return rejected == 0;
+}
+
+int main(int argc, char **argv) {
+  long iterations = 1000000;
+  uint64_t seed = 1;
+  const char *target = NULL;
+  long count = 100;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:u:c:")) != -1) {
+    switch (opt) {
+      case 'n':
+        iterations = atol(optarg);
+        break;
+      case 's':
+        seed = strtoull(optarg, NULL, 0);
+        break;
+      case 'u':
+        target = optarg;
+        break;
+      case 'c':
+        count = atol(optarg);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-n iterations] [-s seed] [-u host[:port] [-c count]]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (iterations <= 0) {
+    iterations = 1;
+  }
+  if (count <= 0) {
+    count = 1;
+  }
+  rng_state = seed != 0 ? seed : 1;
+
+  if (!fuzz(iterations, seed)) {
+    return 1;
+  }
+  bench(iterations);
+  if (target != NULL && !send_udp(target, count)) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,197 @@
+/**
+ * Checks the signal filters on Linux against reference outputs.
+ *
+ * Fixed noisy input vectors with timestamps are run through each filter and through chains of
+ * them, as the CAN frame handler runs decoded signals, and every output is compared with the
+ * reference checked in below. Any mismatch is reported and makes the exit status non-zero.
+ *
+ * Build from the repository root:
+ *   gcc -O2 -Wall -Imain -o signal_filter_test tools/signal_filter_test/signal_filter_test.c main/signal_filter.c
+ *
+ * Usage:
+ *   signal_filter_test [-p]
+ *
+ *   -p  Print the actual outputs as reference initializers instead of checking them, to update the
+ *       references after an intended change of the filters (review the differences first).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "signal_filter.h"
+
+#define MAX_SAMPLES 24
+
+/* Milliseconds to sample timestamps */
+#define MS(ms) ((int64_t) (ms) * 1000)
+
+typedef struct {
+  signal_filter_kind_t kind;
+  int32_t param;
+} stage_t;
+
+typedef struct {
+  const char *name;
+  uint8_t num_stages;
+  stage_t stages[SIGNAL_FILTER_MAX_STAGES];
+  uint8_t num_samples;
+  uint32_t inputs[MAX_SAMPLES];      /* Raw signal values */
+  int64_t timestamps_us[MAX_SAMPLES];
+  int32_t expected[MAX_SAMPLES];     /* Chain outputs, Q8 */
+} test_case_t;
+
+/* Every 10 ms, as most signals are broadcast */
+#define EVERY_10_MS \
+  { MS(0), MS(10), MS(20), MS(30), MS(40), MS(50), MS(60), MS(70), MS(80), MS(90), MS(100), MS(110), \
+    MS(120), MS(130), MS(140), MS(150) }
+
+static const test_case_t test_cases[] = {
+  {
+    /* Noise around 100, then a step to 140 the output approaches by a quarter of the difference per sample */
+    .name = "ema_shift_2",
+    .num_stages = 1,
+    .stages = {{SIGNAL_FILTER_EMA, 2}},
+    .num_samples = 16,
+    .inputs = {100, 104, 97, 101, 99, 140, 138, 143, 139, 141, 140, 140, 140, 140, 140, 140},
+    .timestamps_us = EVERY_10_MS,
+    .expected = {25600, 25856, 25600, 25664, 25584, 28148, 29943, 31609, 32603, 33476, 34067, 34510, 34843,
+                 35092, 35279, 35419},
+  },
+  {
+    /* Without smoothing every sample passes */
+    .name = "ema_shift_0",
+    .num_stages = 1,
+    .stages = {{SIGNAL_FILTER_EMA, 0}},
+    .num_samples = 4,
+    .inputs = {5, 9, 3, 7},
+    .timestamps_us = {MS(0), MS(10), MS(20), MS(30)},
+    .expected = {1280, 2304, 768, 1792},
+  },
+  {
+    /* Single sample spikes are removed, the output lags by one sample */
+    .name = "median_3",
+    .num_stages = 1,
+    .stages = {{SIGNAL_FILTER_MEDIAN, 3}},
+    .num_samples = 12,
+    .inputs = {50, 50, 255, 51, 49, 0, 50, 52, 250, 251, 252, 53},
+    .timestamps_us = EVERY_10_MS,
+    .expected = {12800, 12800, 12800, 13056, 13056, 12544, 12544, 12800, 13312, 64000, 64256, 64256},
+  },
+  {
+    /* An even window is widened to 5, which removes spikes of two samples */
+    .name = "median_4_widened",
+    .num_stages = 1,
+    .stages = {{SIGNAL_FILTER_MEDIAN, 4}},
+    .num_samples = 10,
+    .inputs = {10, 12, 200, 201, 11, 9, 13, 0, 0, 10},
+    .timestamps_us = EVERY_10_MS,
+    .expected = {2560, 2560, 3072, 3072, 3072, 3072, 3328, 2816, 2304, 2304},
+  },
+  {
+    /* At most 10 units per second, irregular intervals, a repeated and a backwards timestamp hold the output */
+    .name = "slew_10_per_second",
+    .num_stages = 1,
+    .stages = {{SIGNAL_FILTER_SLEW, 10}},
+    .num_samples = 9,
+    .inputs = {0, 100, 100, 100, 100, 100, 0, 0, 0},
+    .timestamps_us = {MS(0), MS(100), MS(350), MS(1350), MS(1350), MS(1300), MS(1400), MS(11400), MS(11401)},
+    .expected = {0, 256, 896, 3456, 3456, 3456, 3200, 0, 0},
+  },
+  {
+    /* Jitter within 2 units of the output is ignored, larger moves are followed at once */
+    .name = "hysteresis_2",
+    .num_stages = 1,
+    .stages = {{SIGNAL_FILTER_HYSTERESIS, 2}},
+    .num_samples = 12,
+    .inputs = {100, 101, 102, 103, 101, 99, 97, 98, 100, 96, 94, 97},
+    .timestamps_us = EVERY_10_MS,
+    .expected = {25600, 25600, 25600, 26368, 26368, 25344, 25344, 25344, 25344, 24576, 24576, 24576},
+  },
+  {
+    /* Spike removal, smoothing and a deadband, as configured for a noisy analog signal */
+    .name = "chain_median_ema_hysteresis",
+    .num_stages = 3,
+    .stages = {{SIGNAL_FILTER_MEDIAN, 3}, {SIGNAL_FILTER_EMA, 1}, {SIGNAL_FILTER_HYSTERESIS, 1}},
+    .num_samples = 16,
+    .inputs = {60, 61, 59, 255, 60, 62, 61, 0, 60, 70, 71, 69, 70, 72, 70, 71},
+    .timestamps_us = EVERY_10_MS,
+    .expected = {15360, 15360, 15360, 15360, 15360, 15648, 15648, 15648, 15648, 15648, 16673, 17297, 17609,
+                 17609, 17609, 18010},
+  },
+  {
+    /* Spike removal and a slew limit at 100 units per second, with frames arriving late and in bursts */
+    .name = "chain_median_slew",
+    .num_stages = 2,
+    .stages = {{SIGNAL_FILTER_MEDIAN, 3}, {SIGNAL_FILTER_SLEW, 100}},
+    .num_samples = 10,
+    .inputs = {0, 0, 255, 80, 80, 80, 80, 80, 0, 0},
+    .timestamps_us = {MS(0), MS(10), MS(20), MS(30), MS(31), MS(32), MS(250), MS(1000), MS(1010), MS(1020)},
+    .expected = {0, 0, 0, 256, 281, 306, 5886, 20480, 20480, 20224},
+  },
+};
+
+#define NUM_TEST_CASES (sizeof(test_cases) / sizeof(test_cases[0]))
+
+static void run(const test_case_t *test_case, int32_t *outputs) {
+  signal_filter_chain_t chain = {0};
+  for (int i = 0; i < test_case->num_stages; i++) {
+    signal_filter_chain_add(&chain, test_case->stages[i].kind, test_case->stages[i].param);
+  }
+  for (int i = 0; i < test_case->num_samples; i++) {
+    outputs[i] = signal_filter_chain_update(&chain, test_case->inputs[i], test_case->timestamps_us[i]);
+  }
+}
+
+static bool check(const test_case_t *test_case, const int32_t *outputs) {
+  bool passed = true;
+  for (int i = 0; i < test_case->num_samples; i++) {
+    if (outputs[i] != test_case->expected[i]) {
+      printf("%s: sample %d (input %u at %lld us) gave %d (%.3f), expected %d (%.3f)\n", test_case->name, i,
+             (unsigned) test_case->inputs[i], (long long) test_case->timestamps_us[i], (int) outputs[i],
+             outputs[i] / (double) SIGNAL_FILTER_ONE, (int) test_case->expected[i],
+             test_case->expected[i] / (double) SIGNAL_FILTER_ONE);
+      passed = false;
+    }
+  }
+  return passed;
+}
+
+static void print_reference(const test_case_t *test_case, const int32_t *outputs) {
+  printf("%s:\n    .expected = {", test_case->name);
+  for (int i = 0; i < test_case->num_samples; i++) {
+    printf("%s%d", (i == 0) ? "" : ", ", (int) outputs[i]);
+  }
+  printf("},\n");
+}
+
+int main(int argc, char **argv) {
+  bool print = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "p")) != -1) {
+    switch (opt) {
+      case 'p':
+        print = true;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-p]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  unsigned failed = 0;
+  for (size_t i = 0; i < NUM_TEST_CASES; i++) {
+    int32_t outputs[MAX_SAMPLES];
+    run(&test_cases[i], outputs);
+    if (print) {
+      print_reference(&test_cases[i], outputs);
+    } else if (!check(&test_cases[i], outputs)) {
+      failed++;
+    }
+  }
+  if (print) {
+    return 0;
+  }
+  printf("%u of %zu filter tests failed\n", failed, NUM_TEST_CASES);
+  return (failed == 0) ? 0 : 1;
+}
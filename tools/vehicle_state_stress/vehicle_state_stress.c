@@ -0,0 +1,146 @@
+/**
+ * Stress tests the vehicle state sequence lock on Linux.
+ *
+ * One writer thread publishes numbered updates through the same source the firmware is built
+ * from, while reader threads copy snapshots as fast as they can. Every field of an update is
+ * derived from its number, so a reader can tell a snapshot mixing two updates from a consistent
+ * one. Any torn snapshot, or a version going backwards, is reported and makes the exit status
+ * non-zero.
+ *
+ * Build from the repository root:
+ *   gcc -O2 -Wall -pthread -Imain -o vehicle_state_stress tools/vehicle_state_stress/vehicle_state_stress.c main/vehicle_state.c
+ *
+ * Usage:
+ *   vehicle_state_stress [-n updates] [-r readers]
+ *
+ *   -n  Updates published by the writer (default 5000000).
+ *   -r  Reader threads (default 2).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "vehicle_state.h"
+
+#define MAX_READERS 16
+
+typedef struct {
+  pthread_t thread;
+  uint64_t reads;
+  uint64_t torn;
+} reader_t;
+
+static uint32_t num_updates = 5000000;
+static bool writer_done = false;
+
+/* Field values of update number n, distinct per field so that mixing two updates shows */
+static inline int64_t expected_updated_us(uint32_t n) {
+  return (int64_t) n * 1000;
+}
+
+static inline uint32_t expected_signal(uint32_t n, int i) {
+  return n * 31u + (uint32_t) i;
+}
+
+static inline int32_t expected_filtered(uint32_t n, int i) {
+  return (int32_t) (0u - (n * 7u + (uint32_t) i));
+}
+
+/* Whether every field of the snapshot belongs to the update its version names, the initial state being all zero */
+static bool consistent(const vehicle_state_t *state) {
+  uint32_t n = state->version;
+  if (state->updated_us != ((n == 0) ? 0 : expected_updated_us(n))) {
+    return false;
+  }
+  for (int i = 0; i < CAN_SIGNAL_COUNT; i++) {
+    uint32_t signal = (n == 0) ? 0 : expected_signal(n, i);
+    int32_t filtered = (n == 0) ? 0 : expected_filtered(n, i);
+    if (state->signals[i] != signal || state->filtered[i] != filtered) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void *writer_task(void *arg) {
+  uint32_t signals[CAN_SIGNAL_COUNT];
+  int32_t filtered[CAN_SIGNAL_COUNT];
+  for (uint32_t n = 1; n <= num_updates; n++) {
+    for (int i = 0; i < CAN_SIGNAL_COUNT; i++) {
+      signals[i] = expected_signal(n, i);
+      filtered[i] = expected_filtered(n, i);
+    }
+    vehicle_state_publish(signals, filtered, expected_updated_us(n));
+  }
+  __atomic_store_n(&writer_done, true, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static void *reader_task(void *arg) {
+  reader_t *reader = arg;
+  uint32_t last_version = 0;
+  bool done;
+  do {
+    /* Checked before the read, so the final state is read at least once */
+    done = __atomic_load_n(&writer_done, __ATOMIC_ACQUIRE);
+    vehicle_state_t state;
+    vehicle_state_read(&state);
+    reader->reads++;
+    if (!consistent(&state) || state.version < last_version) {
+      if (reader->torn < 10) {
+        printf("torn snapshot: version %u (previous %u), updated_us %lld\n", (unsigned) state.version,
+               (unsigned) last_version, (long long) state.updated_us);
+      }
+      reader->torn++;
+    }
+    last_version = state.version;
+  } while (!done);
+
+  if (last_version != num_updates) {
+    printf("last snapshot has version %u, expected %u\n", (unsigned) last_version, (unsigned) num_updates);
+    reader->torn++;
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  int num_readers = 2;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+    switch (opt) {
+      case 'n':
+        num_updates = strtoul(optarg, NULL, 0);
+        break;
+      case 'r':
+        num_readers = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-n updates] [-r readers]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (num_updates == 0 || num_readers < 1 || num_readers > MAX_READERS) {
+    fprintf(stderr, "Need at least 1 update and 1 to %d readers\n", MAX_READERS);
+    return 2;
+  }
+
+  reader_t readers[MAX_READERS] = {0};
+  pthread_t writer;
+  for (int i = 0; i < num_readers; i++) {
+    pthread_create(&readers[i].thread, NULL, reader_task, &readers[i]);
+  }
+  pthread_create(&writer, NULL, writer_task, NULL);
+
+  pthread_join(writer, NULL);
+  uint64_t reads = 0, torn = 0;
+  for (int i = 0; i < num_readers; i++) {
+    pthread_join(readers[i].thread, NULL);
+    reads += readers[i].reads;
+    torn += readers[i].torn;
+  }
+
+  printf("%u updates, %llu reads by %d readers, %llu torn snapshots\n", (unsigned) num_updates,
+         (unsigned long long) reads, num_readers, (unsigned long long) torn);
+  return (torn == 0) ? 0 : 1;
+}